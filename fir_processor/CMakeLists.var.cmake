@@ -240,7 +240,14 @@ set(common_private_headers
     src/convolution_filter/ConvolutionFilter.h
     src/convolution_filter/IRFilter.h
     src/convolution_filter/StaticIRShare.h
+    src/GpuMemoryPool.h
+    src/ImpulseResponseCache.h
     src/ImpulseResponseStore.h
+    src/MappedFile.h
+    src/PartitionPlan.h
+    src/SpectrumBuilder.h
+    src/SpectrumCache.h
+    src/WavFile.h
 )
 
 if(APPLE)
@@ -252,6 +259,7 @@ if(APPLE)
         src/device/${component_id_capitalized}Processor.cuh
         src/device/Properties.h
         src/device/SM_FFT_parameters.cuh
+        src/device/SpectrumStorage.h
     )
 else()
     set(nvidia_private_headers
@@ -266,12 +274,14 @@ else()
         src/device/${component_id_capitalized}Processor.cuh
         src/device/Properties.h
         src/device/SM_FFT_parameters.cuh
+        src/device/SpectrumStorage.h
     )
 
     set(device_amd_private_headers
         src/device/${component_id_capitalized}Processor.cuh
         src/device/Properties.h
         src/device/SM_FFT_parameters.cuh
+        src/device/SpectrumStorage.h
     )
 endif()
 
@@ -284,8 +294,13 @@ set(common_sources
     src/${component_id_capitalized}Processor.cpp
     src/convolution_filter/IRFilter.cpp
     src/convolution_filter/StaticIRShare.cpp
+    src/ImpulseResponseCache.cpp
     src/ImpulseResponseStore.cpp
-
+    src/MappedFile.cpp
+    src/PartitionPlan.cpp
+    src/SpectrumBuilder.cpp
+    src/SpectrumCache.cpp
+    src/WavFile.cpp
 )
 
 if(APPLE)
@@ -334,7 +349,10 @@ else()
 endif()
 
 set(common_test_headers
+    tests/CpuTestContext.h
     tests/TestCommon.h
+    tests/TestMemoryManager.h
+    tests/TestWavFile.h
 )
 
 if(APPLE)
@@ -352,7 +370,24 @@ else()
 endif()
 
 set(common_test_sources
+    tests/${component_id_capitalized}DeviceTests.cpp
     tests/${component_id_capitalized}ModuleInfoProviderTests.cpp
+    tests/${component_id_capitalized}ProcessorTests.cpp
+    tests/GpuMemoryPoolTests.cpp
+    tests/ImpulseResponseCacheTests.cpp
+    tests/ImpulseResponseStoreTests.cpp
+    tests/SpectrumCacheTests.cpp
+    tests/WavFileTests.cpp
+    src/${component_id_capitalized}Processor.cpp
+    src/ImpulseResponseCache.cpp
+    src/ImpulseResponseStore.cpp
+    src/MappedFile.cpp
+    src/PartitionPlan.cpp
+    src/SpectrumBuilder.cpp
+    src/SpectrumCache.cpp
+    src/WavFile.cpp
+    src/convolution_filter/IRFilter.cpp
+    src/convolution_filter/StaticIRShare.cpp
 )
 
 if(APPLE)
@@ -384,7 +419,9 @@ if(LINUX)
 endif()
 
 set(common_test_private_target_libraries
+    AudioFile::AudioFile
     GTest::gtest_main
+    gpu_primitives::gpu_primitives
     os_utilities::os_utilities
     processor_api::processor_api
     processor_utilities::processor_utilities
@@ -19,6 +19,77 @@ struct Parameters {
     uint32_t ir_index {};
 };
 
+// query answered by FirProcessor::GetData
+struct LatencyInfo {
+    static constexpr uint32_t LatencyQuery = 0x4C8E27D5;
+    uint32_t ThisQuery {LatencyQuery};
+
+    // samples between an input sample and the first output sample it contributes to
+    uint32_t latency {};
+    // samples the processor handles per call
+    uint32_t grain {};
+    // leading filter samples convolved in the time domain (the whole filter for short filters)
+    uint32_t direct_length {};
+};
+
+// query answered by FirProcessor::GetData
+struct FilterInfo {
+    static constexpr uint32_t FilterQuery = 0x7D16A3F0;
+    uint32_t ThisQuery {FilterQuery};
+
+    // non-zero if the impulse response is classified as a tap delay and runs the sparse task
+    uint32_t sparse {};
+    // taps of the channel with the most (sparse impulse responses only)
+    uint32_t tap_count {};
+    // filter samples convolved after trimming the leading zeros
+    uint32_t filter_length {};
+    // trimmed leading zeros, applied as an output delay
+    uint32_t leading_delay {};
+    // impulse response that is playing (see Parameters::ir_index)
+    uint32_t choice {};
+    // non-zero while the last requested impulse response is loaded, the previous one keeps playing until then
+    uint32_t loading {};
+    // requested impulse responses that could not be loaded and the last of them
+    uint32_t load_failures {};
+    uint32_t failed_choice {};
+};
+
+// query answered by FirProcessor::GetData, reads the state of a channel back from the device
+struct ChannelInfo {
+    static constexpr uint32_t ChannelQuery = 0x3A5C91E6;
+    uint32_t ThisQuery {ChannelQuery};
+
+    // output channel to query (in matrix mode the shared state of all outputs, see fir::ChannelState)
+    uint32_t channel {};
+    // non-zero while the input and the whole filter of the channel are silent and its transforms are skipped
+    uint32_t idle {};
+};
+
+enum class PartitionMode : uint32_t {
+    // all segments use the processor FFT size
+    eUniform = 0u,
+    // the head of the filter is convolved on every grain, the tail only once per completed block
+    eNonUniform = 1u,
+};
+
+// storage format of the spectra on the GPU, all formats accumulate in fp32. the 16 bit formats halve the memory
+// of the spectra and the bytes read per segment at the cost of accuracy (roughly 70 dB SNR for eFloat16, 50 dB for eBFloat16).
+// eFloat16 has a limited range, eBFloat16 the range of fp32 with fewer mantissa bits.
+enum class SpectrumPrecision : uint32_t {
+    eFloat32 = 0u,
+    eFloat16 = 1u,
+    eBFloat16 = 2u,
+};
+
+// truncation of the impulse response tail: the samples behind the point where the remaining energy falls below the
+// threshold (relative to the energy of the channel) are dropped, which shortens the filter and reduces the segments
+// convolved per grain. the truncated length is reported by FilterInfo::filter_length.
+enum class TailQuality : uint32_t {
+    eFull = 0u,
+    eMinus90dB = 1u,
+    eMinus60dB = 2u,
+};
+
 struct Specification {
     static constexpr uint32_t FirConstructionType = 0xAC90FB31;
     uint32_t ThisType {FirConstructionType};
@@ -26,6 +97,30 @@ struct Specification {
     uint32_t filter_length {121522u};
     uint32_t filter_index {121522u / 2u};
     uint32_t last_choice {0u};
+    PartitionMode partition_mode {PartitionMode::eUniform};
+    // hybrid mode: the first direct_head_length filter samples (at most 512) are convolved in the time domain
+    // within the current grain, the rest by the FFT path once complete blocks are available. 0 disables the hybrid mode.
+    uint32_t direct_head_length {0u};
+    // matrix mode: every input channel is convolved into each of matrix_output_count output channels.
+    // channel i * matrix_output_count + o of the impulse response filters input i into output o, missing channels
+    // use channel 0. the matrix mode always uses the uniform partitioned convolution. 0 disables the matrix mode.
+    uint32_t matrix_output_count {0u};
+    // segment slices: long filters split the segments of a channel into slices of segments_per_slice segments, which
+    // are accumulated by separate blocks before the FFT task reduces them. 0 accumulates all segments in one block.
+    uint32_t segments_per_slice {0u};
+    // storage format of the impulse response spectra and of the input spectra (the frequency-domain delay line). the
+    // input spectra use eFloat32 or the format of the impulse response spectra, and the matrix mode only supports
+    // eFloat32. the constructor of the processor throws for other combinations.
+    SpectrumPrecision spectrum_precision {SpectrumPrecision::eFloat32};
+    SpectrumPrecision input_spectrum_precision {SpectrumPrecision::eFloat32};
+    TailQuality tail_quality {TailQuality::eFull};
+    // worst case the device buffers are allocated for at construction: port changes with at most max_channel_count
+    // channels (inputs in the matrix mode) and impulse responses of at most max_filter_length samples (leading zeros
+    // included) with as many channels as the initial one only recompute the layout and do not allocate. the port
+    // capacity does not matter, with SHARED_IRS the spectra of every layout it can select are built up front as well.
+    // 0 allocates on demand.
+    uint32_t max_channel_count {0u};
+    uint32_t max_filter_length {0u};
 };
 
 } // namespace FirConfig
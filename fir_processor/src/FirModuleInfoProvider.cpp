@@ -101,8 +101,8 @@ GPUA::processor::v2::ErrorCode FirModuleInfoProvider::GetProcessorExecutionInfo(
     static std::wstring init_processor = std::wstring(QUOTEW(SEL(1)));
     static std::wstring destroy_processor = std::wstring(QUOTEW(SEL(2)));
 
-    // Set the number of GPU tasks of the processor. Fir has only one (see FirProcessor.cu)
-    static constexpr uint32_t task_cnt = 1;
+    // Set the number of GPU tasks of the processor. Fir has one per FFT size, the direct form task, the stereo tasks, the slice tasks and the sparse task (see FirProcessor.cu)
+    static constexpr uint32_t task_cnt = FFT_TASK_COUNT + 1 + STEREO_TASK_COUNT + SLICE_TASK_COUNT + 1;
 
     ////////////////
     // Set up processor GPU task names. Required for the engine to call the processor.
@@ -112,13 +112,47 @@ GPUA::processor::v2::ErrorCode FirModuleInfoProvider::GetProcessorExecutionInfo(
     // Add two entries for each additional processor task.
     static std::array<std::wstring, 2 * task_cnt> task_names = {
         QUOTEW(SEL(3)),
-        QUOTEW(SEL(4))};
+        QUOTEW(SEL(4)),
+        QUOTEW(SEL(5)),
+        QUOTEW(SEL(6)),
+        QUOTEW(SEL(7)),
+        QUOTEW(SEL(8)),
+        QUOTEW(SEL(9)),
+        QUOTEW(SEL(10)),
+        QUOTEW(SEL(11)),
+        QUOTEW(SEL(12)),
+        QUOTEW(SEL(13)),
+        QUOTEW(SEL(14)),
+        QUOTEW(SEL(15)),
+        QUOTEW(SEL(16)),
+        QUOTEW(SEL(17)),
+        QUOTEW(SEL(18)),
+        QUOTEW(SEL(19)),
+        QUOTEW(SEL(20)),
+        QUOTEW(SEL(21)),
+        QUOTEW(SEL(22)),
+#if !defined(GPU_AUDIO_MAC)
+        QUOTEW(SEL(23)),
+        QUOTEW(SEL(24)),
+        QUOTEW(SEL(25)),
+        QUOTEW(SEL(26)),
+        QUOTEW(SEL(27)),
+        QUOTEW(SEL(28)),
+        QUOTEW(SEL(29)),
+        QUOTEW(SEL(30)),
+        QUOTEW(SEL(31)),
+        QUOTEW(SEL(32)),
+        QUOTEW(SEL(33)),
+        QUOTEW(SEL(34)),
+#endif
+    };
 
     // convert task names from wstring to const wchar_t*
-    // Add two entries for each additional processor task.
-    static std::array<const wchar_t*, 2 * task_cnt> task_names_p = {
-        task_names[0].c_str(),
-        task_names[1].c_str()};
+    static std::array<const wchar_t*, 2 * task_cnt> task_names_p = [] {
+        std::array<const wchar_t*, 2 * task_cnt> names {};
+        std::transform(task_names.begin(), task_names.end(), names.begin(), [](const std::wstring& name) { return name.c_str(); });
+        return names;
+    }();
     //
     ////////////////
 
@@ -9,6 +9,7 @@
 #include "device/Properties.h"
 #include "device/SM_FFT_parameters.cuh"
 #include "ImpulseResponseStore.h"
+#include "SpectrumBuilder.h"
 
 #include <processor_api/PortChangedFlags.h>
 #include <processor_api/PortDescription.h>
@@ -39,6 +40,12 @@ uint32_t getSampleBytes(PortDataType const& pdt) {
 
     throw std::runtime_error("Error getSampleBytes: unsupported sample type\n");
 }
+
+#ifndef SHARED_IRS
+// layouts of the time-domain forms, the FFT layouts are identified by their FFT length
+constexpr uint32_t SPARSE_FILTER_LAYOUT = 1u;
+constexpr uint32_t DIRECT_FILTER_LAYOUT = 2u;
+#endif
 } // namespace
 
 Module& FirProcessor::GetModule() const noexcept {
@@ -51,9 +58,10 @@ ErrorCode FirProcessor::SetData(void* data, uint32_t data_size) noexcept {
         auto params = reinterpret_cast<const FirConfig::Parameters*>(data);
         // determine the message type - the processor only supports a fir message
         if (params->ThisMessage == FirConfig::Parameters::FirMessage) {
-            if (m_old_choice != params->ir_index) {
-                UpdateProcessorFilter(params->ir_index);
-                m_old_choice = params->ir_index;
+            // the choice is committed once the loader prepared it and the processor switched to it
+            if (m_requested_choice.load(std::memory_order_relaxed) != params->ir_index) {
+                m_requested_choice.store(params->ir_index, std::memory_order_relaxed);
+                RequestFilter(params->ir_index);
             }
             return ErrorCode::eSuccess;
         }
@@ -62,7 +70,53 @@ ErrorCode FirProcessor::SetData(void* data, uint32_t data_size) noexcept {
 }
 
 ErrorCode FirProcessor::GetData(void* data, uint32_t& data_size) const noexcept {
-    // not implemented; could potentially satisfy user queries
+    // make sure we get a valid query
+    if (data != nullptr && data_size == sizeof(FirConfig::LatencyInfo)) {
+        auto info = reinterpret_cast<FirConfig::LatencyInfo*>(data);
+        if (info->ThisQuery == FirConfig::LatencyInfo::LatencyQuery) {
+            // every mode produces the output of a grain in the same call, the tail stages of non-uniform
+            // and hybrid plans only run once their blocks are complete but start at filter offsets behind them
+            info->latency = 0u;
+            info->grain = m_real_grain;
+            info->direct_length = m_direct_length;
+            return ErrorCode::eSuccess;
+        }
+    }
+    else if (data != nullptr && data_size == sizeof(FirConfig::FilterInfo)) {
+        auto info = reinterpret_cast<FirConfig::FilterInfo*>(data);
+        if (info->ThisQuery == FirConfig::FilterInfo::FilterQuery) {
+            info->sparse = m_sparse_form ? 1u : 0u;
+            info->tap_count = m_sparse_form ? m_sparse_tap_count : 0u;
+            info->filter_length = m_current_ir_filter->GetFilterLength();
+            info->leading_delay = m_output_delay;
+            info->choice = m_current_choice.load(std::memory_order_relaxed);
+            const uint32_t requested = m_requested_choice.load(std::memory_order_relaxed);
+            info->load_failures = m_load_failures.load(std::memory_order_acquire);
+            info->failed_choice = m_failed_choice.load(std::memory_order_relaxed);
+            info->loading = (requested != info->choice && (info->load_failures == 0 || requested != info->failed_choice)) ? 1u : 0u;
+            return ErrorCode::eSuccess;
+        }
+    }
+    else if (data != nullptr && data_size == sizeof(FirConfig::ChannelInfo)) {
+        auto info = reinterpret_cast<FirConfig::ChannelInfo*>(data);
+        if (info->ThisQuery == FirConfig::ChannelInfo::ChannelQuery) {
+            // the direct form and sparse tasks keep no silence state
+            if (m_direct_form || m_sparse_form || !m_channel_states) {
+                info->idle = 0u;
+                return ErrorCode::eSuccess;
+            }
+            // the stereo and matrix tasks run a single block, which keeps the shared state in the first entry
+            const uint32_t channel = m_gpu_task.block_count < m_channel_count ? 0u : info->channel;
+            if (info->channel >= m_channel_count || (channel + 1u) * sizeof(fir::ChannelState) > m_channel_states_length)
+                return ErrorCode::eOutOfRange;
+            fir::ChannelState state {};
+            const auto result = m_memory_manager.MemCpyGpuToCpu(&state, *m_channel_states, channel * sizeof(fir::ChannelState), sizeof(fir::ChannelState));
+            if (result != ErrorCode::eSuccess)
+                return result;
+            info->idle = state.idle != 0 ? 1u : 0u;
+            return ErrorCode::eSuccess;
+        }
+    }
     return ErrorCode::eFail;
 }
 
@@ -85,6 +139,8 @@ ErrorCode FirProcessor::GetInputPort(uint32_t index, InputPort*& port) noexcept
 ErrorCode FirProcessor::PrepareForProcess(const LaunchData& data, uint32_t expected_chunks) noexcept {
     // process the provided user-data
     SetData(data.app_data, data.app_data_size);
+    // switch to an impulse response the loader has finished in the meantime
+    AdoptPreparedFilter();
 
     // communicate a blueprint rebuild if anything changed that requires one
     if (m_changed)
@@ -95,6 +151,15 @@ ErrorCode FirProcessor::PrepareForProcess(const LaunchData& data, uint32_t expec
 
 ErrorCode FirProcessor::OnBlueprintRebuild(const ProcessorBlueprint*& blueprint) noexcept {
     m_changed = false;
+    // with segment slices, the slice task runs before the FFT task in every call (see UpdateFilterCoefficients)
+    if (m_slice_count != 0) {
+        m_sliced_tasks[0] = m_slice_task;
+        m_sliced_tasks[1] = m_gpu_task;
+        m_proc_data = ProcessorBlueprint {m_proc_data.num_calls, sizeof(fir::ProcessorParameter), ProcessorEndCallback::eNoCallback, 2u, m_sliced_tasks};
+    }
+    else {
+        m_proc_data = ProcessorBlueprint {m_proc_data.num_calls, sizeof(fir::ProcessorParameter), ProcessorEndCallback::eNoCallback, 1u, &m_gpu_task};
+    }
     blueprint = &m_proc_data;
     return ErrorCode::eSuccess;
 }
@@ -104,34 +169,35 @@ ErrorCode FirProcessor::PrepareChunk(void* proc_data, void** task_data, uint32_t
 
     fir::ProcessorParameter processor_parameter_struct {};
 
-    processor_parameter_struct.fourier_input_segments = reinterpret_cast<float2*>(m_fourier_input_segments->GetGpuPointer());
-    processor_parameter_struct.overlap = reinterpret_cast<float*>(m_overlap->GetGpuPointer());
+    if (!m_direct_form) {
+        processor_parameter_struct.fourier_input_segments = reinterpret_cast<float2*>(m_fourier_input_segments->GetGpuPointer());
+        // hybrid plans have no head partition and no overlap
+        if (m_max_overlap != 0) {
+            processor_parameter_struct.overlap = reinterpret_cast<float*>(m_overlap->GetGpuPointer());
+        }
+    }
 
-    int channel = 0;
-#ifdef SHARED_IRS
-    for (; channel < m_channel_count; ++channel) {
-        processor_parameter_struct.fourier_impulse_response_segments[channel] =
-            reinterpret_cast<float2*>(m_current_ir_filter->getSegments(channel, m_fourier_impulse_response_segments_length));
-        processor_parameter_struct.real_filter[channel] =
-            reinterpret_cast<float*>(m_current_ir_filter->getRawIR(channel));
+    // the impulse responses and the channel state are addressed through device-side tables, so the
+    // parameter struct does not grow with the channel count (see UpdateChannelTable)
+    processor_parameter_struct.channels = reinterpret_cast<fir::ChannelDescriptor*>(m_channel_table->GetGpuPointer());
+    processor_parameter_struct.channel_states = reinterpret_cast<fir::ChannelState*>(m_channel_states->GetGpuPointer());
+
+    processor_parameter_struct.ir_spectrum_precision = static_cast<int>(m_ir_spectrum_precision);
+    processor_parameter_struct.input_spectrum_precision = static_cast<int>(m_input_spectrum_precision);
+
+    if (m_slice_count != 0) {
+        processor_parameter_struct.slice_spectra = reinterpret_cast<float2*>(m_slice_spectra->GetGpuPointer());
+        processor_parameter_struct.slice_count = static_cast<int>(m_slice_count);
     }
-#else
-    for (; channel < m_current_ir_filter->GetChannelCount(); ++channel) {
-        processor_parameter_struct.fourier_impulse_response_segments[channel] =
-            reinterpret_cast<float2*>(m_fourier_impulse_response_segments[channel]->GetGpuPointer());
-        processor_parameter_struct.real_filter[channel] =
-            reinterpret_cast<float*>(m_real_filter[channel]->GetGpuPointer());
-    }
-    for (; channel < m_channel_count; ++channel) {
-        processor_parameter_struct.fourier_impulse_response_segments[channel] =
-            reinterpret_cast<float2*>(m_fourier_impulse_response_segments[0]->GetGpuPointer());
-        processor_parameter_struct.real_filter[channel] =
-            reinterpret_cast<float*>(m_real_filter[0]->GetGpuPointer());
+
+    if (m_output_delay != 0) {
+        processor_parameter_struct.output_delay_line = reinterpret_cast<float*>(m_output_delay_line->GetGpuPointer());
+        processor_parameter_struct.output_delay = static_cast<int>(m_output_delay);
     }
-#endif
-    for (; channel < MAX_CHANNELS; ++channel) {
-        processor_parameter_struct.fourier_impulse_response_segments[channel] = 0;
-        processor_parameter_struct.real_filter[channel] = 0;
+
+    if (m_matrix_output_count != 0) {
+        processor_parameter_struct.matrix_inputs = static_cast<int>(m_input_channel_count);
+        processor_parameter_struct.matrix_outputs = static_cast<int>(m_channel_count);
     }
 
     processor_parameter_struct.segments_count = static_cast<int>(m_segment_count);
@@ -140,10 +206,28 @@ ErrorCode FirProcessor::PrepareChunk(void* proc_data, void** task_data, uint32_t
     processor_parameter_struct.overlap_length = static_cast<int>(m_max_overlap);
     processor_parameter_struct.input_length = static_cast<int>(output_port.size_in_bytes / getSampleBytes(output_port.data_type));
     processor_parameter_struct.grain = static_cast<int>(m_real_grain);
+    processor_parameter_struct.spectrum_length = static_cast<int>(m_partition_plan.spectrum_length);
+
+    processor_parameter_struct.tail_stage_count = static_cast<int>(m_partition_plan.tail_stage_count);
+    if (m_partition_plan.tail_stage_count != 0) {
+        processor_parameter_struct.tail_history = reinterpret_cast<float*>(m_tail_history->GetGpuPointer());
+        processor_parameter_struct.tail_output = reinterpret_cast<float*>(m_tail_output->GetGpuPointer());
+        processor_parameter_struct.tail_history_length = static_cast<int>(m_partition_plan.tail_history_length);
+        processor_parameter_struct.tail_output_length = static_cast<int>(m_partition_plan.tail_output_length);
+        std::copy(std::begin(m_partition_plan.tail_stages), std::end(m_partition_plan.tail_stages), std::begin(processor_parameter_struct.tail_stages));
+    }
 
+    if (m_direct_length != 0) {
+        processor_parameter_struct.history = reinterpret_cast<float*>(m_history->GetGpuPointer());
+        processor_parameter_struct.history_length = static_cast<int>(m_direct_length) - 1;
+        processor_parameter_struct.filter_length = static_cast<int>(m_direct_length);
+    }
+
+    // a filter change only resets the state of this instance on the device, the spectra are ready on the host side
+    // (with SHARED_IRS built once per impulse response, see StaticIRShare::getSegments)
     if (m_recompute_filter) {
         uint32_t offset = 0;
-        if (m_real_grain < FftParameters::config::fft_length_quarter) {
+        if (m_segment_count != 0 && m_real_grain < m_fft_length / 4) {
             offset = m_real_grain * static_cast<uint32_t>(rand()) % m_input_size_per_iteration;
         }
         processor_parameter_struct.filter_length_to_translate_init = static_cast<int>(m_current_ir_filter->GetFilterLength());
@@ -170,13 +254,16 @@ ErrorCode FirProcessor::Connect(const OutputPort& data_port) noexcept {
     auto& input_port = data_port.GetPortInfo();
 
     if (input_port.type != PortType::eRegularPort ||
-        input_port.data_type != PortDataType::eSample32 ||
-        input_port.channel_count > MAX_CHANNELS) {
+        input_port.data_type != PortDataType::eSample32) {
         return ErrorCode::eUnsupported;
     }
 
     auto& output_port = m_output_port->GetPortInfo();
     output_port = input_port;
+    m_input_channel_count = input_port.channel_count;
+    if (m_matrix_output_count != 0) {
+        output_port.channel_count = m_matrix_output_count;
+    }
     UpdateFilterCoefficients();
     output_port.grain = m_real_grain;
     output_port.transfer_to_cpu = false;
@@ -184,9 +271,9 @@ ErrorCode FirProcessor::Connect(const OutputPort& data_port) noexcept {
     m_output_port->Changed(PortChangedFlags::eReset);
 
     size_t num_calls = divup(input_port.capacity_in_bytes / getSampleBytes(input_port.data_type), m_real_grain);
-    if ((num_calls != m_proc_data.num_calls) || (m_gpu_task.block_count != m_channel_count)) {
+    // the block count depends on the selected task and is set in UpdateFilterCoefficients
+    if (num_calls != m_proc_data.num_calls) {
         m_proc_data.num_calls = num_calls;
-        m_gpu_task.block_count = m_channel_count;
         m_changed = true;
     }
 
@@ -210,8 +297,7 @@ ErrorCode FirProcessor::InputPortUpdated(PortChangedFlags flags, const OutputPor
     auto& input_port = data_port.GetPortInfo();
 
     if (input_port.type != PortType::eRegularPort ||
-        input_port.data_type != PortDataType::eSample32 ||
-        input_port.channel_count > MAX_CHANNELS) {
+        input_port.data_type != PortDataType::eSample32) {
         Disconnect();
         return ErrorCode::eUnsupported;
     }
@@ -228,15 +314,19 @@ ErrorCode FirProcessor::InputPortUpdated(PortChangedFlags flags, const OutputPor
 
     auto& output_port = m_output_port->GetPortInfo();
     output_port = input_port;
+    m_input_channel_count = input_port.channel_count;
+    if (m_matrix_output_count != 0) {
+        output_port.channel_count = m_matrix_output_count;
+    }
     UpdateFilterCoefficients();
     output_port.grain = m_real_grain;
     output_port.transfer_to_cpu = false;
     output_port.is_produced = true;
 
     size_t num_calls = divup(input_port.capacity_in_bytes / getSampleBytes(input_port.data_type), m_real_grain);
-    if ((num_calls != m_proc_data.num_calls) || (m_gpu_task.block_count != m_channel_count)) {
+    // the block count depends on the selected task and is set in UpdateFilterCoefficients
+    if (num_calls != m_proc_data.num_calls) {
         m_proc_data.num_calls = num_calls;
-        m_gpu_task.block_count = m_channel_count;
         m_changed = true;
     }
 
@@ -297,98 +387,742 @@ void FirProcessor::UpdateFilterCoefficients(bool force) {
     const auto new_channel_count = output_port.channel_count;
     const auto buffer_length = output_port.capacity_in_bytes / getSampleBytes(output_port.data_type);
 
-    const uint32_t new_grain = std::min<uint32_t>(buffer_length, m_max_grain);
-    if (m_real_grain != new_grain || m_channel_count != new_channel_count || force) {
-        m_real_grain = new_grain;
+    // the matrix mode only supports the uniform partitioned convolution
+    const bool matrix = m_matrix_output_count != 0;
+    const uint32_t new_path_count = matrix ? m_input_channel_count * new_channel_count : new_channel_count;
+
+    // tap delays only read the input at the offsets of their few non-zero samples
+    if (!matrix && m_current_ir_filter->GetSparseTapCount() != 0) {
+        const uint32_t new_grain = std::min<uint32_t>(buffer_length, MAX_FFT_WIDTH);
+        if (m_real_grain != new_grain || m_channel_count != new_channel_count || !m_sparse_form || force) {
+            m_real_grain = new_grain;
+            m_channel_count = new_channel_count;
+            m_path_count = new_path_count;
+            UpdateSparseForm();
+        }
+        return;
+    }
+
+    // short filters are cheaper to convolve in the time domain than with a FFT round trip
+    const bool direct_form = !matrix && m_current_ir_filter->GetFilterLength() <= DIRECT_FORM_MAX_FILTER_LENGTH;
+    if (direct_form) {
+        const uint32_t new_grain = std::min<uint32_t>(buffer_length, DIRECT_FORM_MAX_GRAIN);
+        if (m_real_grain != new_grain || m_channel_count != new_channel_count || !m_direct_form || m_sparse_form || force) {
+            m_real_grain = new_grain;
+            m_channel_count = new_channel_count;
+            m_path_count = new_path_count;
+            UpdateDirectForm();
+        }
+        return;
+    }
+
+    const Partitioning partitioning = SelectPartitioning(m_current_ir_filter->GetFilterLength(), buffer_length);
+    if (m_real_grain != partitioning.grain || m_channel_count != new_channel_count || m_path_count != new_path_count || m_fft_length != partitioning.fft_length ||
+        m_direct_form || force) {
+        m_real_grain = partitioning.grain;
         m_channel_count = new_channel_count;
+        m_path_count = new_path_count;
+
+        m_direct_form = false;
+        m_sparse_form = false;
+        m_fft_length = partitioning.fft_length;
+        m_max_grain = partitioning.fft_length;
+        m_fir_samples_per_segment = partitioning.fir_samples_per_segment;
+        m_input_size_per_iteration = partitioning.input_size_per_iteration;
+        m_partition_plan = partitioning.plan;
+
+        // the same lengths bound the buffers allocated up front (see PreallocateBuffers)
+        const PartitionBufferLengths lengths = GetPartitionBufferLengths(partitioning, m_current_ir_filter->GetFilterLength(), GetPartitioningOptions());
+        m_segment_count = lengths.head_segment_count;
+        m_max_overlap = lengths.overlap_length;
+
+        m_direct_length = m_partition_plan.direct_length;
+
+        // long heads are split into slices accumulated by several blocks per channel (see accumulateSlices)
+        const uint32_t slice_count = SelectPartitioningSliceCount(partitioning, GetPartitioningOptions());
+        if (m_slice_count != slice_count) {
+            m_slice_count = slice_count;
+            m_changed = true;
+        }
+
+        // the tail stages transform blocks of the task FFT size, the time-domain part keeps
+        // filter, history and input of the grain in shared memory
+        const uint32_t shared_mem_size = std::max<uint32_t>(GetTransformSharedMemorySize(m_partition_plan.max_block_length),
+            static_cast<uint32_t>((2 * m_direct_length + m_real_grain) * sample_size));
 
-        if (m_current_ir_filter->GetFilterLength() < FftParameters::config::fft_length) {
-            // use as many samples of the input as possible
-            m_fir_samples_per_segment = m_current_ir_filter->GetFilterLength();
-            m_input_size_per_iteration = std::max(m_real_grain, 2 * FftParameters::config::fft_length - m_current_ir_filter->GetFilterLength());
+        if (matrix) {
+            // a single block convolves all inputs, so every input is transformed only once
+            SelectTask(m_gpu_task, GetFftTaskIndex(m_fft_length), m_fft_length / 4, 1u, shared_mem_size);
+        }
+        // stereo signals without tail stages are transformed in pairs by a single block (see processStereo256)
+        else if (m_channel_count == 2 && m_partition_plan.tail_stage_count == 0 && m_direct_length == 0 && m_slice_count == 0 &&
+                 m_ir_spectrum_precision == SPECTRUM_FLOAT32 && m_input_spectrum_precision == SPECTRUM_FLOAT32 && 2 * m_fft_length <= MAX_FFT_WIDTH) {
+            SelectTask(m_gpu_task, GetStereoTaskIndex(m_fft_length), m_fft_length / 2, 1u, std::max(shared_mem_size, GetTransformSharedMemorySize(2 * m_fft_length)));
         }
         else {
-            // simply use half split
-            m_input_size_per_iteration = FftParameters::config::fft_length;
-            m_fir_samples_per_segment = FftParameters::config::fft_length;
+            SelectTask(m_gpu_task, GetFftTaskIndex(m_fft_length), m_fft_length / 4, m_channel_count, shared_mem_size);
+        }
+        if (m_slice_count != 0) {
+            SelectTask(m_slice_task, GetSliceTaskIndex(m_fft_length), m_fft_length / 4, m_channel_count * m_slice_count, 0u);
         }
-
-        m_segment_count = divup(m_current_ir_filter->GetFilterLength(), m_fir_samples_per_segment);
-        m_max_overlap = std::min<uint32_t>(m_current_ir_filter->GetFilterLength(), 2 * FftParameters::config::fft_length);
 
         // allocate the device buffers
-        const size_t inputsegmentstoragesize = static_cast<size_t>(m_segment_count) * FftParameters::config::fft_length * m_channel_count * sample_size * 2;
+        const size_t inputsegmentstoragesize = static_cast<size_t>(lengths.spectrum_length) * (matrix ? m_input_channel_count : m_channel_count) * GetSpectrumBinSize(m_input_spectrum_precision);
         if (m_fourier_input_segments_length < inputsegmentstoragesize) {
-            m_fourier_input_segments = m_memory_manager.AllocateGpuMemory(inputsegmentstoragesize);
+            m_fourier_input_segments = m_memory_pool->Allocate(inputsegmentstoragesize);
             m_fourier_input_segments_length = inputsegmentstoragesize;
         }
 
+        const size_t tailhistorystoragesize = static_cast<size_t>(lengths.tail_history_length) * m_channel_count * sample_size;
+        if (m_tail_history_length < tailhistorystoragesize) {
+            m_tail_history = m_memory_pool->Allocate(tailhistorystoragesize);
+            m_tail_history_length = tailhistorystoragesize;
+        }
+
+        const size_t tailoutputstoragesize = static_cast<size_t>(lengths.tail_output_length) * m_channel_count * sample_size;
+        if (m_tail_output_length < tailoutputstoragesize) {
+            m_tail_output = m_memory_pool->Allocate(tailoutputstoragesize);
+            m_tail_output_length = tailoutputstoragesize;
+        }
+
+        const size_t historystoragesize = static_cast<size_t>(lengths.history_length) * m_channel_count * sample_size;
+        if (m_history_length < historystoragesize) {
+            m_history = m_memory_pool->Allocate(historystoragesize);
+            m_history_length = historystoragesize;
+        }
+
         const size_t overlapstoragesize = static_cast<size_t>(m_max_overlap) * m_channel_count * sample_size;
         if (m_overlap_length < overlapstoragesize) {
-            m_overlap = m_memory_manager.AllocateGpuMemory(overlapstoragesize);
+            m_overlap = m_memory_pool->Allocate(overlapstoragesize);
             m_overlap_length = overlapstoragesize;
         }
 
+        const size_t slicestoragesize = static_cast<size_t>(lengths.slice_spectra_length) * m_channel_count * sample_size * 2;
+        if (m_slice_spectra_length < slicestoragesize) {
+            m_slice_spectra = m_memory_pool->Allocate(slicestoragesize);
+            m_slice_spectra_length = slicestoragesize;
+        }
+
 #ifdef SHARED_IRS
         // ensure IR buffers are allocated
         const uint32_t filterLength = m_current_ir_filter->GetFilterLength() * sample_size;
-        m_current_ir_filter->getRawIR(0);
         m_real_filter_length = filterLength;
 
-        const uint32_t firSegmentLengths = m_segment_count * FftParameters::config::fft_length * sample_size * 2;
+        const uint32_t firSegmentLengths = m_partition_plan.spectrum_length * GetSpectrumBinSize(m_ir_spectrum_precision);
+        m_current_ir_filter->SetSegmentsLength(firSegmentLengths, m_ir_spectrum_precision, m_partition_plan);
+        m_current_ir_filter->getRawIR(0);
         m_current_ir_filter->getSegments(0, firSegmentLengths);
         m_fourier_impulse_response_segments_length = firSegmentLengths;
 #else
-        for (size_t channel = m_current_ir_filter->GetChannelCount(); channel < MAX_CHANNELS; ++channel) {
-            m_real_filter[channel].reset();
-            m_fourier_impulse_response_segments[channel].reset();
+        // the loader built the data of a new impulse response already (see ReserveBuffers), port changes selecting
+        // another FFT length rebuild it here
+        if (m_filter_data.layout != partitioning.fft_length) {
+            BuildFilterData(*m_current_ir_filter, buffer_length, m_filter_data);
         }
+        m_real_filter_length = m_current_ir_filter->GetFilterLength() * sample_size;
+        m_fourier_impulse_response_segments_length = m_partition_plan.spectrum_length * GetSpectrumBinSize(m_ir_spectrum_precision);
+#endif
 
-        const uint32_t filterLength = m_current_ir_filter->GetFilterLength() * sample_size;
+        UpdateChannelTable();
+        UpdateOutputDelay();
+        m_recompute_filter = true;
+    }
+}
 
-        if (m_real_filter_length < filterLength) {
-            for (size_t channel = 0; channel < m_current_ir_filter->GetChannelCount(); ++channel) {
-                m_real_filter[channel] = m_memory_manager.AllocateGpuMemory(filterLength);
-            }
+PartitioningOptions FirProcessor::GetPartitioningOptions() const {
+    PartitioningOptions options;
+    // the matrix mode only supports the uniform partitioned convolution
+    options.matrix = m_matrix_output_count != 0;
+    options.non_uniform = m_partition_mode == FirConfig::PartitionMode::eNonUniform;
+    options.hybrid_direct_length = m_hybrid_direct_length;
+    options.segments_per_slice = m_segments_per_slice;
+    return options;
+}
+
+Partitioning FirProcessor::SelectPartitioning(uint32_t filter_length, uint32_t buffer_length) const {
+    return ::SelectPartitioning(filter_length, buffer_length, GetPartitioningOptions());
+}
+
+void FirProcessor::PreallocateBuffers(uint32_t max_channel_count, uint32_t max_filter_length) {
+    const auto sample_size = sizeof(float);
+    const bool matrix = m_matrix_output_count != 0;
+    const size_t channel_count = std::max(matrix ? m_matrix_output_count : max_channel_count, 1u);
+    const size_t input_channel_count = matrix ? max_channel_count : channel_count;
+    const size_t path_count = matrix ? input_channel_count * channel_count : channel_count;
+    const PartitionBufferLengths lengths = GetMaxPartitionBufferLengths(max_filter_length, GetPartitioningOptions());
+
+    const auto reserve = [this](GpuMemoryPool::Block& buffer, uint32_t& length, size_t size) {
+        if (length < size) {
+            buffer = m_memory_pool->Allocate(size);
+            length = static_cast<uint32_t>(size);
         }
-        m_real_filter_length = filterLength;
+    };
+    reserve(m_fourier_input_segments, m_fourier_input_segments_length, lengths.spectrum_length * input_channel_count * GetSpectrumBinSize(m_input_spectrum_precision));
+    reserve(m_tail_history, m_tail_history_length, lengths.tail_history_length * channel_count * sample_size);
+    reserve(m_tail_output, m_tail_output_length, lengths.tail_output_length * channel_count * sample_size);
+    reserve(m_overlap, m_overlap_length, lengths.overlap_length * channel_count * sample_size);
+    reserve(m_slice_spectra, m_slice_spectra_length, lengths.slice_spectra_length * channel_count * sample_size * 2);
+    // the history of the hybrid plan, of the direct form and the ring of the sparse form
+    const size_t history_length = std::max<size_t>({lengths.history_length, DIRECT_FORM_MAX_FILTER_LENGTH - 1, std::max(max_filter_length, 1u) - 1});
+    reserve(m_history, m_history_length, history_length * channel_count * sample_size);
+    // at most every sample but the last is a leading zero
+    reserve(m_output_delay_line, m_output_delay_line_length, static_cast<size_t>(std::max(max_filter_length, 1u) - 1) * channel_count * sample_size);
+    reserve(m_channel_table, m_channel_table_length, path_count * sizeof(fir::ChannelDescriptor));
+    if (m_channel_states_length < channel_count * sizeof(fir::ChannelState)) {
+        const std::vector<fir::ChannelState> states(channel_count, fir::ChannelState {});
+        reserve(m_channel_states, m_channel_states_length, channel_count * sizeof(fir::ChannelState));
+        m_memory_manager.MemCpyCpuToGpu(*m_channel_states, 0, states.data(), m_channel_states_length);
+    }
 
-        for (size_t channel = 0; channel < m_current_ir_filter->GetChannelCount(); ++channel) {
-            if (!m_real_filter[channel]) {
-                m_real_filter[channel] = m_memory_manager.AllocateGpuMemory(filterLength);
-            }
-            m_memory_manager.MemCpyCpuToGpu(*m_real_filter[channel], 0, &m_current_ir_filter->GetValueAt(channel, 0), filterLength);
+#ifndef SHARED_IRS
+    // the impulse response buffers of this instance, for impulse responses with as many channels as the current one.
+    // with SHARED_IRS they belong to the shared impulse responses (see StaticIRShare)
+    const auto reserve_block = [this](GpuMemoryPool::Block& buffer, size_t size) {
+        if (!buffer || buffer.GetSize() < size) {
+            buffer = m_memory_pool->Allocate(size);
         }
+    };
+    m_filter_data.real_filter.resize(GetIrChannelCount());
+    m_filter_data.fourier_impulse_response_segments.resize(GetIrChannelCount());
+    for (size_t channel = 0; channel < GetIrChannelCount(); ++channel) {
+        reserve_block(m_filter_data.real_filter[channel], static_cast<size_t>(max_filter_length) * sample_size);
+        reserve_block(m_filter_data.fourier_impulse_response_segments[channel], static_cast<size_t>(lengths.spectrum_length) * GetSpectrumBinSize(m_ir_spectrum_precision));
+    }
+    reserve_block(m_filter_data.active_segments, static_cast<size_t>(std::max(lengths.head_segment_count, 1u)) * GetIrChannelCount() * sizeof(int));
+    reserve_block(m_filter_data.sparse_taps, GetIrChannelCount() * sizeof(fir::SparseTaps));
+#else
+    // the shared buffers of every layout of the impulse response, so port changes only look them up
+    PrepareFilter(*m_current_ir_filter, 0u);
+#endif
+}
 
-        const uint32_t firSegmentLengths = m_segment_count * FftParameters::config::fft_length * sample_size * 2;
-        if (m_fourier_impulse_response_segments_length < firSegmentLengths) {
-            for (size_t channel = 0; channel < m_current_ir_filter->GetChannelCount(); ++channel) {
-                m_fourier_impulse_response_segments[channel] = m_memory_manager.AllocateGpuMemory(firSegmentLengths);
-            }
+void FirProcessor::UpdateDirectForm() {
+    const auto sample_size = sizeof(float);
+    const uint32_t filter_length = m_current_ir_filter->GetFilterLength();
+
+    m_direct_form = true;
+    m_sparse_form = false;
+    m_max_grain = DIRECT_FORM_MAX_GRAIN;
+    if (m_slice_count != 0) {
+        m_slice_count = 0;
+        m_changed = true;
+    }
+    m_partition_plan = {};
+    m_direct_length = filter_length;
+
+    // filter, history and input of the grain are kept in shared memory
+    SelectTask(m_gpu_task, DIRECT_FORM_TASK_INDEX, DIRECT_FORM_THREAD_COUNT, m_channel_count, static_cast<uint32_t>((2 * filter_length + m_real_grain) * sample_size));
+
+    const size_t historystoragesize = static_cast<size_t>(DIRECT_FORM_MAX_FILTER_LENGTH - 1) * m_channel_count * sample_size;
+    if (m_history_length < historystoragesize) {
+        m_history = m_memory_pool->Allocate(historystoragesize);
+        m_history_length = historystoragesize;
+    }
+
+#ifdef SHARED_IRS
+    m_real_filter_length = filter_length * sample_size;
+    // the direct form task does not use spectra
+    m_current_ir_filter->SetSegmentsLength(0);
+    m_current_ir_filter->getRawIR(0);
+#else
+    if (m_filter_data.layout != DIRECT_FILTER_LAYOUT) {
+        BuildFilterData(*m_current_ir_filter, m_real_grain, m_filter_data);
+    }
+    m_real_filter_length = filter_length * sample_size;
+#endif
+
+    UpdateChannelTable();
+    UpdateOutputDelay();
+    m_recompute_filter = true;
+}
+
+void FirProcessor::UpdateSparseForm() {
+    const auto sample_size = sizeof(float);
+    const uint32_t filter_length = m_current_ir_filter->GetFilterLength();
+
+    // the sparse task uses the history of the direct form as a ring covering the whole filter
+    m_direct_form = true;
+    m_sparse_form = true;
+    m_max_grain = MAX_FFT_WIDTH;
+    if (m_slice_count != 0) {
+        m_slice_count = 0;
+        m_changed = true;
+    }
+    m_partition_plan = {};
+    m_direct_length = filter_length;
+    m_sparse_tap_count = m_current_ir_filter->GetSparseTapCount();
+
+    SelectTask(m_gpu_task, SPARSE_TASK_INDEX, SPARSE_THREAD_COUNT, m_channel_count, 0u);
+
+    const size_t historystoragesize = static_cast<size_t>(std::max(filter_length, 1u) - 1) * m_channel_count * sample_size;
+    if (m_history_length < historystoragesize) {
+        m_history = m_memory_pool->Allocate(historystoragesize);
+        m_history_length = historystoragesize;
+    }
+
+#ifdef SHARED_IRS
+    // neither spectra nor the time-domain filter are used
+    m_current_ir_filter->SetSegmentsLength(0);
+#else
+    if (m_filter_data.layout != SPARSE_FILTER_LAYOUT) {
+        BuildFilterData(*m_current_ir_filter, m_real_grain, m_filter_data);
+    }
+#endif
+
+    UpdateChannelTable();
+    UpdateOutputDelay();
+    m_recompute_filter = true;
+}
+
+void FirProcessor::UpdateOutputDelay() {
+    m_output_delay = m_current_ir_filter->GetLeadingDelay();
+
+    // cleared by the device whenever the filter changes
+    const size_t delaystoragesize = static_cast<size_t>(m_output_delay) * m_channel_count * sizeof(float);
+    if (m_output_delay_line_length < delaystoragesize) {
+        m_output_delay_line = m_memory_pool->Allocate(delaystoragesize);
+        m_output_delay_line_length = delaystoragesize;
+    }
+}
+
+void FirProcessor::UpdateChannelTable() {
+    std::vector<fir::ChannelDescriptor> table(m_path_count);
+    for (uint32_t path = 0; path < m_path_count; ++path) {
+#ifdef SHARED_IRS
+        // the direct form task only reads the time-domain filter
+        if (!m_direct_form) {
+            table[path].fourier_impulse_response_segments =
+                reinterpret_cast<float2*>(m_current_ir_filter->getSegments(path, m_fourier_impulse_response_segments_length));
+            table[path].active_segments = reinterpret_cast<int*>(m_current_ir_filter->getActiveSegments(path, m_fir_samples_per_segment, m_segment_count));
+            table[path].active_segment_count = static_cast<int>(m_current_ir_filter->getActiveSegmentCount(path));
+        }
+        // the sparse task only reads the taps
+        if (m_sparse_form) {
+            table[path].sparse_taps = reinterpret_cast<fir::SparseTaps*>(m_current_ir_filter->getSparseTaps(path));
         }
         else {
-            for (size_t channel = 0; channel < m_current_ir_filter->GetChannelCount(); ++channel)
-                if (!m_fourier_impulse_response_segments[channel]) {
-                    m_fourier_impulse_response_segments[channel] = m_memory_manager.AllocateGpuMemory(firSegmentLengths);
-                }
+            table[path].real_filter = reinterpret_cast<float*>(m_current_ir_filter->getRawIR(path));
+        }
+#else
+        // paths without an impulse response channel of their own use the first one
+        const uint32_t channel = path < GetIrChannelCount() ? path : 0u;
+        if (!m_direct_form) {
+            table[path].fourier_impulse_response_segments =
+                reinterpret_cast<float2*>(m_filter_data.fourier_impulse_response_segments[channel]->GetGpuPointer());
+            table[path].active_segments =
+                reinterpret_cast<int*>(m_filter_data.active_segments->GetGpuPointer() + static_cast<size_t>(channel) * m_segment_count * sizeof(int));
+            // silent head segments are skipped by the device (see FindActiveSegments)
+            table[path].active_segment_count = static_cast<int>(m_filter_data.active_segment_counts[channel]);
+        }
+        if (m_sparse_form) {
+            table[path].sparse_taps =
+                reinterpret_cast<fir::SparseTaps*>(m_filter_data.sparse_taps->GetGpuPointer() + static_cast<size_t>(channel) * sizeof(fir::SparseTaps));
+        }
+        else {
+            table[path].real_filter = reinterpret_cast<float*>(m_filter_data.real_filter[channel]->GetGpuPointer());
         }
-        m_fourier_impulse_response_segments_length = firSegmentLengths;
 #endif
+    }
 
-        m_recompute_filter = true;
+    const size_t tablesize = table.size() * sizeof(fir::ChannelDescriptor);
+    if (m_channel_table_length < tablesize) {
+        m_channel_table = m_memory_pool->Allocate(tablesize);
+        m_channel_table_length = tablesize;
+    }
+    m_memory_manager.MemCpyCpuToGpu(*m_channel_table, 0, table.data(), tablesize);
+
+    // the state is reset by the device whenever the filter changes, new storage starts zeroed nonetheless
+    const size_t statesize = static_cast<size_t>(std::max(m_channel_count, 1u)) * sizeof(fir::ChannelState);
+    if (m_channel_states_length < statesize) {
+        const std::vector<fir::ChannelState> states(std::max(m_channel_count, 1u), fir::ChannelState {});
+        m_channel_states = m_memory_pool->Allocate(statesize);
+        m_channel_states_length = statesize;
+        m_memory_manager.MemCpyCpuToGpu(*m_channel_states, 0, states.data(), statesize);
     }
 }
 
-void FirProcessor::UpdateProcessorFilter(uint32_t choice) {
-    m_current_ir_filter->LoadImpulseResponse(choice);
-    UpdateFilterCoefficients(true);
+uint32_t FirProcessor::GetSpectrumBinSize(uint32_t precision) {
+    // a complex bin is stored as two floats or packed into 32 bit
+    return precision == SPECTRUM_FLOAT32 ? 2 * sizeof(float) : sizeof(uint32_t);
+}
+
+uint32_t FirProcessor::GetIrChannelCount() const {
+    return m_current_ir_filter->GetChannelCount();
+}
+
+void FirProcessor::SelectTask(GpuTaskData& task, uint32_t entry_idx, uint32_t thread_count, uint32_t block_count, uint32_t shared_mem_size) {
+    if (task.entry_idx != entry_idx || task.thread_count != thread_count || task.block_count != block_count ||
+        task.shared_mem_size != shared_mem_size) {
+        task.entry_idx = entry_idx;
+        task.thread_count = thread_count;
+        task.block_count = block_count;
+        task.shared_mem_size = shared_mem_size;
+        m_changed = true;
+    }
+}
+
+std::unique_ptr<FirProcessor::MyIRFilter> FirProcessor::CreateFilter(uint32_t choice) const {
+#ifdef SHARED_IRS
+    std::unique_ptr<MyIRFilter> filter {new MyIRFilter(m_memory_manager, m_generated_filter_length, m_generated_filter_index)};
+#else
+    std::unique_ptr<MyIRFilter> filter {new MyIRFilter(m_generated_filter_length, m_generated_filter_index)};
+#endif
+    filter->SetTailThreshold(m_tail_threshold_db);
+    filter->LoadImpulseResponse(choice);
+    return filter;
+}
+
+void FirProcessor::PrepareFilter(MyIRFilter& filter, uint32_t buffer_length) const {
+#ifdef SHARED_IRS
+    // builds the shared buffers UpdateFilterCoefficients will request, so the switch and later port changes only look
+    // them up. without declared bounds, a different buffer length at that point still works, the buffers of its layout
+    // are then built there.
+    const bool matrix = m_matrix_output_count != 0;
+    if (!matrix && filter.GetSparseTapCount() != 0) {
+        filter.SetSegmentsLength(0);
+        filter.getSparseTaps(0);
+        return;
+    }
+    filter.getRawIR(0);
+    if (!matrix && filter.GetFilterLength() <= DIRECT_FORM_MAX_FILTER_LENGTH) {
+        filter.SetSegmentsLength(0);
+        return;
+    }
+
+    if (m_max_channel_count != 0) {
+        for (const Partitioning& partitioning : GetPossiblePartitionings(filter.GetFilterLength(), GetPartitioningOptions())) {
+            PrepareLayout(filter, partitioning);
+        }
+    }
+    else {
+        PrepareLayout(filter, SelectPartitioning(filter.GetFilterLength(), buffer_length));
+    }
+#endif
+}
+
+void FirProcessor::PrepareLayout(MyIRFilter& filter, const Partitioning& partitioning) const {
+#ifdef SHARED_IRS
+    const uint32_t segments_length = partitioning.plan.spectrum_length * GetSpectrumBinSize(m_ir_spectrum_precision);
+    filter.SetSegmentsLength(segments_length, m_ir_spectrum_precision, partitioning.plan);
+    filter.getSegments(0, segments_length);
+    filter.getActiveSegments(0, partitioning.fir_samples_per_segment, partitioning.plan.head_segment_count);
+#endif
+}
+
+#ifndef SHARED_IRS
+uint32_t FirProcessor::GetFilterLayout(MyIRFilter& filter, uint32_t buffer_length) const {
+    const bool matrix = m_matrix_output_count != 0;
+    if (!matrix && filter.GetSparseTapCount() != 0) {
+        return SPARSE_FILTER_LAYOUT;
+    }
+    if (!matrix && filter.GetFilterLength() <= DIRECT_FORM_MAX_FILTER_LENGTH) {
+        return DIRECT_FILTER_LAYOUT;
+    }
+    // plan, spectra and active segments of an impulse response only depend on the FFT length
+    return SelectPartitioning(filter.GetFilterLength(), buffer_length).fft_length;
+}
+
+void FirProcessor::BuildFilterData(MyIRFilter& filter, uint32_t buffer_length, FilterData& data) const {
+    const auto sample_size = sizeof(float);
+    const uint32_t filter_length = filter.GetFilterLength();
+    const uint32_t channel_count = filter.GetChannelCount();
+    // the blocks keep their size, so buffers allocated up front or for a longer filter are reused
+    const auto reserve = [this](GpuMemoryPool::Block& buffer, size_t size) {
+        if (!buffer || buffer.GetSize() < size) {
+            buffer = m_memory_pool->Allocate(size);
+        }
+    };
+
+    data.layout = GetFilterLayout(filter, buffer_length);
+    if (data.layout == SPARSE_FILTER_LAYOUT) {
+        std::vector<fir::SparseTaps> taps(channel_count);
+        for (uint32_t channel = 0; channel < channel_count; ++channel) {
+            ImpulseResponseStore::FindSparseTaps(&filter.GetValueAt(channel, 0), filter_length, taps[channel]);
+        }
+        const size_t tapsstoragesize = taps.size() * sizeof(fir::SparseTaps);
+        reserve(data.sparse_taps, tapsstoragesize);
+        m_memory_manager.MemCpyCpuToGpu(*data.sparse_taps, 0, taps.data(), tapsstoragesize);
+        return;
+    }
+
+    const size_t filterstoragesize = static_cast<size_t>(filter_length) * sample_size;
+    data.real_filter.resize(channel_count);
+    for (uint32_t channel = 0; channel < channel_count; ++channel) {
+        reserve(data.real_filter[channel], filterstoragesize);
+        m_memory_manager.MemCpyCpuToGpu(*data.real_filter[channel], 0, &filter.GetValueAt(channel, 0), filterstoragesize);
+    }
+    if (data.layout == DIRECT_FILTER_LAYOUT) {
+        return;
+    }
+
+    const Partitioning partitioning = SelectPartitioning(filter_length, buffer_length);
+    const uint32_t segment_count = partitioning.plan.head_segment_count;
+    const PartitionBufferLengths lengths = m_max_channel_count != 0 ? GetMaxPartitionBufferLengths(filter_length, GetPartitioningOptions()) :
+                                                                      GetPartitionBufferLengths(partitioning, filter_length, GetPartitioningOptions());
+    data.fourier_impulse_response_segments.resize(channel_count);
+    data.active_segment_counts.assign(channel_count, 0u);
+    reserve(data.active_segments, static_cast<size_t>(std::max(lengths.head_segment_count, 1u)) * channel_count * sizeof(int));
+
+    // the spectra are built on the host, so the first call after the change does not transform the filter
+    SpectrumBuilder builder {partitioning.plan, m_ir_spectrum_precision};
+    std::vector<uint8_t> spectrum;
+    for (uint32_t channel = 0; channel < channel_count; ++channel) {
+        reserve(data.fourier_impulse_response_segments[channel], static_cast<size_t>(lengths.spectrum_length) * GetSpectrumBinSize(m_ir_spectrum_precision));
+        builder.Build(&filter.GetValueAt(channel, 0), filter_length, spectrum);
+        m_memory_manager.MemCpyCpuToGpu(*data.fourier_impulse_response_segments[channel], 0, spectrum.data(), spectrum.size());
+
+        const std::vector<int> active = FindActiveSegments(&filter.GetValueAt(channel, 0), filter_length, partitioning.fir_samples_per_segment, segment_count);
+        data.active_segment_counts[channel] = static_cast<uint32_t>(active.size());
+        if (!active.empty()) {
+            m_memory_manager.MemCpyCpuToGpu(*data.active_segments, static_cast<size_t>(channel) * segment_count * sizeof(int), active.data(), active.size() * sizeof(int));
+        }
+    }
+}
+#endif
+
+bool FirProcessor::IsPrepared(MyIRFilter& filter, const ReservedBuffers& reserved, uint32_t buffer_length) const {
+#ifdef SHARED_IRS
+    const bool matrix = m_matrix_output_count != 0;
+    if (!matrix && (filter.GetSparseTapCount() != 0 || filter.GetFilterLength() <= DIRECT_FORM_MAX_FILTER_LENGTH)) {
+        return true;
+    }
+    const Partitioning partitioning = SelectPartitioning(filter.GetFilterLength(), buffer_length);
+    const uint32_t segments_length = partitioning.plan.spectrum_length * GetSpectrumBinSize(m_ir_spectrum_precision);
+    return filter.IsLayoutBuilt(segments_length, m_ir_spectrum_precision, partitioning.plan, partitioning.fir_samples_per_segment);
+#else
+    return reserved.filter_data.layout == GetFilterLayout(filter, buffer_length);
+#endif
+}
+
+FirProcessor::BufferSizes FirProcessor::GetBufferSizes(MyIRFilter& filter, uint32_t channel_count, uint32_t input_channel_count, uint32_t buffer_length) const {
+    // the sizes UpdateFilterCoefficients, UpdateDirectForm, UpdateSparseForm, UpdateOutputDelay and UpdateChannelTable grow the buffers to
+    const auto sample_size = sizeof(float);
+    const bool matrix = m_matrix_output_count != 0;
+    const size_t path_count = matrix ? static_cast<size_t>(input_channel_count) * channel_count : channel_count;
+    const uint32_t filter_length = filter.GetFilterLength();
+
+    BufferSizes sizes;
+    sizes.output_delay_line = static_cast<size_t>(filter.GetLeadingDelay()) * channel_count * sample_size;
+    sizes.channel_table = path_count * sizeof(fir::ChannelDescriptor);
+    sizes.channel_states = static_cast<size_t>(std::max(channel_count, 1u)) * sizeof(fir::ChannelState);
+    if (!matrix && filter.GetSparseTapCount() != 0) {
+        sizes.history = static_cast<size_t>(std::max(filter_length, 1u) - 1) * channel_count * sample_size;
+        return sizes;
+    }
+    if (!matrix && filter_length <= DIRECT_FORM_MAX_FILTER_LENGTH) {
+        sizes.history = static_cast<size_t>(DIRECT_FORM_MAX_FILTER_LENGTH - 1) * channel_count * sample_size;
+        return sizes;
+    }
+
+    const Partitioning partitioning = SelectPartitioning(filter_length, buffer_length);
+    const PartitionBufferLengths lengths = GetPartitionBufferLengths(partitioning, filter_length, GetPartitioningOptions());
+    sizes.fourier_input_segments = static_cast<size_t>(lengths.spectrum_length) * (matrix ? input_channel_count : channel_count) * GetSpectrumBinSize(m_input_spectrum_precision);
+    sizes.tail_history = static_cast<size_t>(lengths.tail_history_length) * channel_count * sample_size;
+    sizes.tail_output = static_cast<size_t>(lengths.tail_output_length) * channel_count * sample_size;
+    sizes.history = static_cast<size_t>(lengths.history_length) * channel_count * sample_size;
+    sizes.overlap = static_cast<size_t>(lengths.overlap_length) * channel_count * sample_size;
+    sizes.slice_spectra = static_cast<size_t>(lengths.slice_spectra_length) * channel_count * sample_size * 2;
+    return sizes;
+}
+
+FirProcessor::BufferSizes FirProcessor::GetBufferLengths() const {
+    BufferSizes lengths;
+    lengths.fourier_input_segments = m_fourier_input_segments_length;
+    lengths.tail_history = m_tail_history_length;
+    lengths.tail_output = m_tail_output_length;
+    lengths.history = m_history_length;
+    lengths.overlap = m_overlap_length;
+    lengths.slice_spectra = m_slice_spectra_length;
+    lengths.output_delay_line = m_output_delay_line_length;
+    lengths.channel_table = m_channel_table_length;
+    lengths.channel_states = m_channel_states_length;
+    return lengths;
+}
+
+bool FirProcessor::BuffersFit(const BufferSizes& sizes, const ReservedBuffers& reserved) const {
+    const auto fits = [](size_t size, uint32_t length, const GpuMemoryPool::Block& buffer) {
+        return size <= length || (buffer && size <= buffer.GetSize());
+    };
+    return fits(sizes.fourier_input_segments, m_fourier_input_segments_length, reserved.fourier_input_segments) &&
+        fits(sizes.tail_history, m_tail_history_length, reserved.tail_history) && fits(sizes.tail_output, m_tail_output_length, reserved.tail_output) &&
+        fits(sizes.history, m_history_length, reserved.history) && fits(sizes.overlap, m_overlap_length, reserved.overlap) &&
+        fits(sizes.slice_spectra, m_slice_spectra_length, reserved.slice_spectra) && fits(sizes.output_delay_line, m_output_delay_line_length, reserved.output_delay_line) &&
+        fits(sizes.channel_table, m_channel_table_length, reserved.channel_table) && fits(sizes.channel_states, m_channel_states_length, reserved.channel_states);
+}
+
+void FirProcessor::AdoptBuffers(ReservedBuffers& reserved) {
+    const auto adopt = [](GpuMemoryPool::Block& buffer, uint32_t& length, GpuMemoryPool::Block& larger) {
+        if (larger && larger.GetSize() > length) {
+            std::swap(buffer, larger);
+            length = static_cast<uint32_t>(buffer.GetSize());
+        }
+    };
+    adopt(m_fourier_input_segments, m_fourier_input_segments_length, reserved.fourier_input_segments);
+    adopt(m_tail_history, m_tail_history_length, reserved.tail_history);
+    adopt(m_tail_output, m_tail_output_length, reserved.tail_output);
+    adopt(m_history, m_history_length, reserved.history);
+    adopt(m_overlap, m_overlap_length, reserved.overlap);
+    adopt(m_slice_spectra, m_slice_spectra_length, reserved.slice_spectra);
+    adopt(m_output_delay_line, m_output_delay_line_length, reserved.output_delay_line);
+    adopt(m_channel_table, m_channel_table_length, reserved.channel_table);
+    adopt(m_channel_states, m_channel_states_length, reserved.channel_states);
+#ifndef SHARED_IRS
+    // the buffers of the previous impulse response are released with the reserved ones
+    std::swap(m_filter_data, reserved.filter_data);
+#endif
+}
+
+void FirProcessor::ReserveBuffers(MyIRFilter& filter, const FilterRequest& request, ReservedBuffers& reserved) const {
+    const BufferSizes sizes = GetBufferSizes(filter, request.channel_count, request.input_channel_count, request.buffer_length);
+    const auto reserve = [this](GpuMemoryPool::Block& buffer, size_t length, size_t size) {
+        if (length < size) {
+            buffer = m_memory_pool->Allocate(size);
+        }
+    };
+    reserve(reserved.fourier_input_segments, request.buffer_sizes.fourier_input_segments, sizes.fourier_input_segments);
+    reserve(reserved.tail_history, request.buffer_sizes.tail_history, sizes.tail_history);
+    reserve(reserved.tail_output, request.buffer_sizes.tail_output, sizes.tail_output);
+    reserve(reserved.history, request.buffer_sizes.history, sizes.history);
+    reserve(reserved.overlap, request.buffer_sizes.overlap, sizes.overlap);
+    reserve(reserved.slice_spectra, request.buffer_sizes.slice_spectra, sizes.slice_spectra);
+    reserve(reserved.output_delay_line, request.buffer_sizes.output_delay_line, sizes.output_delay_line);
+    reserve(reserved.channel_table, request.buffer_sizes.channel_table, sizes.channel_table);
+    reserve(reserved.channel_states, request.buffer_sizes.channel_states, sizes.channel_states);
+    // new state storage starts zeroed, like in UpdateChannelTable
+    if (reserved.channel_states) {
+        const std::vector<fir::ChannelState> states(sizes.channel_states / sizeof(fir::ChannelState), fir::ChannelState {});
+        m_memory_manager.MemCpyCpuToGpu(*reserved.channel_states, 0, states.data(), sizes.channel_states);
+    }
+#ifndef SHARED_IRS
+    // the impulse response buffers of the instance are in use until the switch, so the data is built into new ones
+    BuildFilterData(filter, request.buffer_length, reserved.filter_data);
+#endif
+}
+
+FirProcessor::FilterRequest FirProcessor::GetFilterRequest(uint32_t choice) const {
+    const auto& output_port = m_output_port->GetPortInfo();
+    FilterRequest request;
+    request.choice = choice;
+    request.buffer_length = output_port.capacity_in_bytes / getSampleBytes(output_port.data_type);
+    request.channel_count = output_port.channel_count;
+    request.input_channel_count = m_input_channel_count;
+    request.buffer_sizes = GetBufferLengths();
+    return request;
+}
+
+void FirProcessor::RequestFilter(uint32_t choice) {
+    const FilterRequest request = GetFilterRequest(choice);
+    {
+        std::unique_lock<std::mutex> lock(m_loader_mutex);
+        m_request = request;
+        m_filter_requested = true;
+    }
+    m_loader_condition.notify_one();
+}
+
+void FirProcessor::AdoptPreparedFilter() {
+    if (!m_filter_ready.load(std::memory_order_acquire)) {
+        return;
+    }
+    // the loader only holds the lock briefly, if it does right now the switch happens in the next call
+    std::unique_lock<std::mutex> lock(m_loader_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    // the port may have changed since the request. the switch neither allocates nor builds spectra, a filter prepared
+    // for another port is requested again for the current one and the current impulse response keeps playing
+    const auto& output_port = m_output_port->GetPortInfo();
+    const uint32_t buffer_length = output_port.capacity_in_bytes / getSampleBytes(output_port.data_type);
+    const bool prepared = IsPrepared(*m_prepared_filter, m_prepared_buffers, buffer_length) &&
+        BuffersFit(GetBufferSizes(*m_prepared_filter, output_port.channel_count, m_input_channel_count, buffer_length), m_prepared_buffers);
+    if (prepared) {
+        std::swap(m_current_ir_filter, m_prepared_filter);
+        AdoptBuffers(m_prepared_buffers);
+        m_current_choice.store(m_prepared_choice, std::memory_order_relaxed);
+    }
+    else if (!m_filter_requested) {
+        // a newer request replaces it anyway
+        m_request = GetFilterRequest(m_prepared_choice);
+        m_filter_requested = true;
+    }
+    // the previous impulse response and the replaced buffers are released by the loader, the shared buffers of the
+    // impulse response may be freed with them
+    m_retired_filters.push_back(std::move(m_prepared_filter));
+    m_retired_buffers.push_back(std::move(m_prepared_buffers));
+    m_filter_ready.store(false, std::memory_order_relaxed);
+    lock.unlock();
+    m_loader_condition.notify_one();
+
+    if (prepared) {
+        UpdateFilterCoefficients(true);
+    }
+}
+
+void FirProcessor::RunFilterLoader() {
+    std::unique_lock<std::mutex> lock(m_loader_mutex);
+    while (true) {
+        m_loader_condition.wait(lock, [this] { return m_loader_stop || m_filter_requested || !m_retired_filters.empty() || !m_retired_buffers.empty(); });
+        if (m_loader_stop) {
+            return;
+        }
+
+        std::vector<std::unique_ptr<MyIRFilter>> retired;
+        retired.swap(m_retired_filters);
+        m_retired_filters.reserve(retired.capacity());
+        std::vector<ReservedBuffers> retired_buffers;
+        retired_buffers.swap(m_retired_buffers);
+        m_retired_buffers.reserve(retired_buffers.capacity());
+        const bool requested = m_filter_requested;
+        const FilterRequest request = m_request;
+        m_filter_requested = false;
+        lock.unlock();
+
+        std::unique_ptr<MyIRFilter> filter;
+        ReservedBuffers reserved;
+        if (requested) {
+            try {
+                filter = CreateFilter(request.choice);
+                PrepareFilter(*filter, request.buffer_length);
+                ReserveBuffers(*filter, request, reserved);
+            }
+            catch (const std::exception&) {
+                // keeps the current impulse response and reports the failure through FirConfig::FilterInfo
+                filter.reset();
+                m_failed_choice.store(request.choice, std::memory_order_relaxed);
+                m_load_failures.fetch_add(1u, std::memory_order_release);
+            }
+        }
+        // released once the new filter is prepared, so a request for a retired impulse response finds its shared buffers
+        retired.clear();
+        retired_buffers.clear();
+
+        lock.lock();
+        if (filter == nullptr) {
+            continue;
+        }
+        // a newer request replaces this one
+        if (m_filter_requested) {
+            m_retired_filters.push_back(std::move(filter));
+            m_retired_buffers.push_back(std::move(reserved));
+            continue;
+        }
+        if (m_prepared_filter != nullptr) {
+            m_retired_filters.push_back(std::move(m_prepared_filter));
+            m_retired_buffers.push_back(std::move(m_prepared_buffers));
+        }
+        m_prepared_filter = std::move(filter);
+        m_prepared_buffers = std::move(reserved);
+        m_prepared_choice = request.choice;
+        m_filter_ready.store(true, std::memory_order_release);
+    }
 }
 
 FirProcessor::FirProcessor(::ProcessorSpecification& specification, ::Module& module) :
     m_module {module},
     m_proc_data {1u, sizeof(fir::ProcessorParameter), ProcessorEndCallback::eNoCallback, 1u, &m_gpu_task},
     m_port_factory {specification.port_factory},
-    m_memory_manager {specification.memory_manager} {
+    m_memory_manager {specification.memory_manager},
+    m_memory_pool {GpuMemoryPool::GetShared(specification.memory_manager)} {
     // Get the user-data for processor construction from the ProcessorSpecification
     auto spec = reinterpret_cast<const FirConfig::Specification*>(specification.user_data);
     // make sure the user-data is what we expect it to be, i.e., a FirConfig::Specification
@@ -406,17 +1140,72 @@ FirProcessor::FirProcessor(::ProcessorSpecification& specification, ::Module& mo
     output_port_info.grain = m_real_grain;
     m_output_port = m_port_factory.CreateDataPort(0u, output_port_info);
 
-    m_current_ir_filter.reset(new MyIRFilter(m_memory_manager, spec->filter_length, spec->filter_index));
-    UpdateProcessorFilter(spec->last_choice);
-
-    // the processor only has one task/step, and its index is 0. See `DeclareProcessorStep` in `FirProcessor.cu`
-    m_gpu_task.entry_idx = 0u;
+    // the processor has one task/step per FFT size. See `DeclareProcessorStep` in `FirProcessor.cu`
+    m_gpu_task.entry_idx = GetFftTaskIndex(m_fft_length);
     // number of threads required
-    m_gpu_task.thread_count = FftParameters::config::fft_length_quarter;
+    m_gpu_task.thread_count = m_fft_length / 4;
     // how many blocks we launch into the process function
     m_gpu_task.block_count = output_port_info.channel_count;
-    // required per-block shared memory for the task
-    m_gpu_task.shared_mem_size = FftParameters::config::fft_sm_required * sizeof(float) * 2;
+    // required per-block shared memory for the task (depends on the FFT size and the tail stages, see UpdateFilterCoefficients)
+    m_gpu_task.shared_mem_size = GetTransformSharedMemorySize(m_fft_length);
     // it does not take task parameters. see `using TaskParameter = void;` in `Properties.h`)
     m_gpu_task.task_param_size = 0u;
+
+    m_partition_mode = spec->partition_mode;
+    m_hybrid_direct_length = std::min<uint32_t>(spec->direct_head_length, DIRECT_FORM_MAX_FILTER_LENGTH);
+    m_matrix_output_count = spec->matrix_output_count;
+    m_segments_per_slice = spec->segments_per_slice;
+    m_ir_spectrum_precision = static_cast<uint32_t>(spec->spectrum_precision);
+    m_input_spectrum_precision = static_cast<uint32_t>(spec->input_spectrum_precision);
+    if (m_ir_spectrum_precision > SPECTRUM_BFLOAT16 || m_input_spectrum_precision > SPECTRUM_BFLOAT16) {
+        throw std::runtime_error("Error in FirProcessor::FirProcessor: unsupported spectrum precision");
+    }
+    // the device reads the input spectra in fp32 or in the format of the impulse response spectra
+    if (m_input_spectrum_precision != SPECTRUM_FLOAT32 && m_input_spectrum_precision != m_ir_spectrum_precision) {
+        throw std::runtime_error("Error in FirProcessor::FirProcessor: unsupported input spectrum precision");
+    }
+    // the stereo and matrix tasks only use fp32 spectra, the stereo path is skipped for the reduced formats
+    if (m_matrix_output_count != 0 && (m_ir_spectrum_precision != SPECTRUM_FLOAT32 || m_input_spectrum_precision != SPECTRUM_FLOAT32)) {
+        throw std::runtime_error("Error in FirProcessor::FirProcessor: the matrix mode only supports fp32 spectra");
+    }
+    m_generated_filter_length = spec->filter_length;
+    m_generated_filter_index = spec->filter_index;
+    // trade the inaudible end of the tail for fewer segments
+    switch (spec->tail_quality) {
+    case FirConfig::TailQuality::eFull:
+        break;
+    case FirConfig::TailQuality::eMinus90dB:
+        m_tail_threshold_db = -90.f;
+        break;
+    case FirConfig::TailQuality::eMinus60dB:
+        m_tail_threshold_db = -60.f;
+        break;
+    default:
+        throw std::runtime_error("Error in FirProcessor::FirProcessor: unsupported tail quality");
+    }
+    m_current_ir_filter = CreateFilter(spec->last_choice);
+    if (spec->max_channel_count != 0) {
+        // the initial impulse response fits in any case
+        const uint32_t filter_length = m_current_ir_filter->GetLeadingDelay() + m_current_ir_filter->GetFilterLength();
+        m_max_channel_count = spec->max_channel_count;
+        m_max_filter_length = std::max(spec->max_filter_length, filter_length);
+        PreallocateBuffers(m_max_channel_count, m_max_filter_length);
+    }
+    UpdateFilterCoefficients(true);
+    m_requested_choice.store(spec->last_choice, std::memory_order_relaxed);
+    m_current_choice.store(spec->last_choice, std::memory_order_relaxed);
+
+    // later impulse response changes are loaded off the processing thread (see SetData)
+    m_retired_filters.reserve(4);
+    m_retired_buffers.reserve(4);
+    m_loader_thread = std::thread(&FirProcessor::RunFilterLoader, this);
+}
+
+FirProcessor::~FirProcessor() {
+    {
+        std::unique_lock<std::mutex> lock(m_loader_mutex);
+        m_loader_stop = true;
+    }
+    m_loader_condition.notify_one();
+    m_loader_thread.join();
 }
@@ -8,7 +8,10 @@
 #define FIR_FIR_PROCESSOR_H
 
 #include "device/Properties.h"
-#include "IRFilter.h"
+#include "device/SpectrumStorage.h"
+#include "GpuMemoryPool.h"
+#include "PartitionPlan.h"
+#include "convolution_filter/IRFilter.h"
 #include "convolution_filter/StaticIRShare.h"
 
 #include <fir_processor/FirSpecification.h>
@@ -24,15 +27,20 @@
 #include <processor_api/ProcessorProfiler.h>
 #include <processor_api/PortFactory.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 class FirProcessor : public GPUA::processor::v2::Processor, public GPUA::processor::v2::InputPort, private GPUA::processor::v2::ProcessorProfiler {
 public:
     explicit FirProcessor(GPUA::processor::v2::ProcessorSpecification& specification, GPUA::processor::v2::Module& module);
 
-    ~FirProcessor() = default;
+    ~FirProcessor();
 
     // Copy ctor and copy assignment are deleted along with move assignment operator deletion
     FirProcessor& operator=(FirProcessor&) = delete;
@@ -63,16 +71,127 @@ public:
     GPUA::processor::v2::ProcessorProfiler* GetProcessorProfiler() noexcept override;
 
 private:
+#ifdef SHARED_IRS
+    using MyIRFilter = StaticIRShare;
+#else
+    using MyIRFilter = IRFilter;
+#endif
+
     uint32_t RunProfiling(const GPUA::processor::v2::ProfileSpecification& spec, GPUA::processor::v2::LatencyProfiler& profiler) noexcept override;
 
     void UpdateFilterCoefficients(bool force = false);
-    void UpdateProcessorFilter(uint32_t choice);
+    void UpdateDirectForm();
+    void UpdateSparseForm();
+    // bytes per complex bin of a spectrum with the given storage format (see SpectrumStorage.h)
+    static uint32_t GetSpectrumBinSize(uint32_t precision);
+    // impulse response channels with a buffer of their own
+    uint32_t GetIrChannelCount() const;
+    // uploads the impulse responses of every path to the device-side table and sizes the channel state
+    void UpdateChannelTable();
+    // sizes the output delay line for the leading zeros trimmed from the impulse response
+    void UpdateOutputDelay();
+    // sets the launch configuration of a task and requests a blueprint rebuild if it changed
+    void SelectTask(GPUA::processor::v2::GpuTaskData& task, uint32_t entry_idx, uint32_t thread_count, uint32_t block_count, uint32_t shared_mem_size);
+
+    // the partitioning UpdateFilterCoefficients selects for a filter and port buffer length
+    PartitioningOptions GetPartitioningOptions() const;
+    Partitioning SelectPartitioning(uint32_t filter_length, uint32_t buffer_length) const;
+    // allocates the device buffers of the processor for every port configuration of up to `max_channel_count` channels
+    // and filters of up to `max_filter_length` samples, so UpdateFilterCoefficients does not allocate within these bounds
+    void PreallocateBuffers(uint32_t max_channel_count, uint32_t max_filter_length);
+
+    // sizes in bytes of the device buffers of the processor that UpdateFilterCoefficients grows for a filter and port
+    // configuration, 0 for the ones the selected task does not use
+    struct BufferSizes {
+        size_t fourier_input_segments {0u};
+        size_t tail_history {0u};
+        size_t tail_output {0u};
+        size_t history {0u};
+        size_t overlap {0u};
+        size_t slice_spectra {0u};
+        size_t output_delay_line {0u};
+        size_t channel_table {0u};
+        size_t channel_states {0u};
+    };
+#ifndef SHARED_IRS
+    // the impulse response buffers of the instance for one layout (see GetFilterLayout). with SHARED_IRS they belong to
+    // the shared impulse responses (see StaticIRShare)
+    struct FilterData {
+        // layout the buffers were built for, 0 if they hold no impulse response
+        uint32_t layout {0u};
+        std::vector<GpuMemoryPool::Block> real_filter; // real -> audio signal
+        std::vector<GpuMemoryPool::Block> fourier_impulse_response_segments;
+        // head_segment_count indices of the non-silent head segments per impulse response channel
+        GpuMemoryPool::Block active_segments;
+        std::vector<uint32_t> active_segment_counts;
+        // one fir::SparseTaps per impulse response channel
+        GpuMemoryPool::Block sparse_taps;
+    };
+    // the form `buffer_length` selects for the filter: SPARSE_FILTER_LAYOUT, DIRECT_FILTER_LAYOUT or the FFT length
+    uint32_t GetFilterLayout(MyIRFilter& filter, uint32_t buffer_length) const;
+    // builds and uploads the impulse response data of that layout, reusing the blocks of `data` that are large enough.
+    // with declared bounds the blocks fit every layout of the filter, so port changes rebuild the data in place
+    void BuildFilterData(MyIRFilter& filter, uint32_t buffer_length, FilterData& data) const;
+#endif
+    // buffers the loader allocated for a prepared filter where the ones of the processor are too small
+    struct ReservedBuffers {
+        GpuMemoryPool::Block fourier_input_segments;
+        GpuMemoryPool::Block tail_history;
+        GpuMemoryPool::Block tail_output;
+        GpuMemoryPool::Block history;
+        GpuMemoryPool::Block overlap;
+        GpuMemoryPool::Block slice_spectra;
+        GpuMemoryPool::Block output_delay_line;
+        GpuMemoryPool::Block channel_table;
+        GpuMemoryPool::Block channel_states;
+#ifndef SHARED_IRS
+        // the impulse response of the prepared filter, built and uploaded by the loader for the port of the request
+        FilterData filter_data;
+#endif
+    };
+    // port configuration a filter is requested for and the sizes of the buffers of the processor at that point
+    struct FilterRequest {
+        uint32_t choice {0};
+        uint32_t buffer_length {0};
+        uint32_t channel_count {1};
+        uint32_t input_channel_count {1};
+        BufferSizes buffer_sizes {};
+    };
+    FilterRequest GetFilterRequest(uint32_t choice) const;
+    BufferSizes GetBufferSizes(MyIRFilter& filter, uint32_t channel_count, uint32_t input_channel_count, uint32_t buffer_length) const;
+    BufferSizes GetBufferLengths() const;
+    // whether `reserved` and the buffers of the processor cover `sizes`
+    bool BuffersFit(const BufferSizes& sizes, const ReservedBuffers& reserved) const;
+    // replaces the buffers of the processor with the larger reserved ones, `reserved` then holds the replaced ones
+    void AdoptBuffers(ReservedBuffers& reserved);
+
+    // impulse response changes are loaded by a worker thread: SetData queues the choice, the worker loads the impulse
+    // response, builds its shared device buffers and allocates the buffers of the processor it needs for the port
+    // configuration of the request. PrepareForProcess switches to it once it is ready, without allocating or
+    // transforming the filter; if the port changed in the meantime and the prepared buffers do not cover it, the filter
+    // is requested again for the current port. the current impulse response keeps playing until then.
+    std::unique_ptr<MyIRFilter> CreateFilter(uint32_t choice) const;
+    // with declared bounds every layout the port buffer length may select is built, otherwise the one of `buffer_length`
+    void PrepareFilter(MyIRFilter& filter, uint32_t buffer_length) const;
+    void PrepareLayout(MyIRFilter& filter, const Partitioning& partitioning) const;
+    // whether the impulse response buffers of the layout selected for `buffer_length` are built: the shared ones (see
+    // PrepareFilter) or without SHARED_IRS the ones of `reserved` (see BuildFilterData)
+    bool IsPrepared(MyIRFilter& filter, const ReservedBuffers& reserved, uint32_t buffer_length) const;
+    void ReserveBuffers(MyIRFilter& filter, const FilterRequest& request, ReservedBuffers& reserved) const;
+    void RequestFilter(uint32_t choice);
+    void AdoptPreparedFilter();
+    void RunFilterLoader();
 
     GPUA::processor::v2::Module& m_module;
     GPUA::processor::v2::PortFactory& m_port_factory;
     GPUA::processor::v2::MemoryManager& m_memory_manager;
+    // every buffer of the processor comes from the pool shared by the processors of the memory manager
+    std::shared_ptr<GpuMemoryPool> m_memory_pool;
 
     GPUA::processor::v2::GpuTaskData m_gpu_task {};
+    // slice task and the task list of the blueprint when the head segments are split into slices
+    GPUA::processor::v2::GpuTaskData m_slice_task {};
+    GPUA::processor::v2::GpuTaskData m_sliced_tasks[2] {};
     GPUA::processor::v2::ProcessorBlueprint m_proc_data;
 
     GPUA::processor::v2::OutputPortPointer m_output_port {0, 0};
@@ -82,36 +201,111 @@ private:
     bool m_recompute_filter {true};
 
     uint32_t m_channel_count {1};
-    uint32_t m_max_grain {FftParameters::config::fft_length};
+    // matrix mode: every input channel is convolved into each output channel (0 disables it)
+    uint32_t m_matrix_output_count {0};
+    uint32_t m_input_channel_count {1};
+    // impulse responses in use: one per channel, or one per input/output channel pair in matrix mode
+    uint32_t m_path_count {1};
+    // FFT size (complex bins) of the selected task, see SelectFftLength
+    uint32_t m_fft_length {MAX_FFT_WIDTH};
+    uint32_t m_max_grain {MAX_FFT_WIDTH};
     uint32_t m_real_grain {0}; // real -> actual
 
     // inputsize per iteration = FFTwidth, filter samples per segment = FFTwidth
-    uint32_t m_input_size_per_iteration {FftParameters::config::fft_length};
-    uint32_t m_fir_samples_per_segment {FftParameters::config::fft_length};
+    uint32_t m_input_size_per_iteration {MAX_FFT_WIDTH};
+    uint32_t m_fir_samples_per_segment {MAX_FFT_WIDTH};
     uint32_t m_segment_count {1};
 
+    FirConfig::PartitionMode m_partition_mode {FirConfig::PartitionMode::eUniform};
+    PartitionPlan m_partition_plan {};
+
+    // short filters run the direct form task instead of the partitioned convolution (see DIRECT_FORM_MAX_FILTER_LENGTH)
+    bool m_direct_form {false};
+    // sparse impulse responses run the sparse task, which uses the buffers of the direct form (see SPARSE_MAX_TAPS)
+    bool m_sparse_form {false};
+    uint32_t m_sparse_tap_count {0};
+    // requested time-domain part of the hybrid mode (0 disables it) and the number of filter samples actually
+    // convolved in the time domain (by the direct form task or the hybrid plan)
+    uint32_t m_hybrid_direct_length {0};
+    uint32_t m_direct_length {0};
+
+    // requested head segments per slice (0 disables the slices) and the slices per channel in use
+    uint32_t m_segments_per_slice {0};
+    uint32_t m_slice_count {0};
+    GpuMemoryPool::Block m_slice_spectra;
+    uint32_t m_slice_spectra_length {0};
+
+    // leading zeros of the impulse response, applied to every output channel through a ring buffer on the device
+    uint32_t m_output_delay {0};
+    GpuMemoryPool::Block m_output_delay_line;
+    uint32_t m_output_delay_line_length {0};
+
+    // storage format of the impulse response and input spectra (SPECTRUM_FLOAT32, ...)
+    uint32_t m_ir_spectrum_precision {SPECTRUM_FLOAT32};
+    uint32_t m_input_spectrum_precision {SPECTRUM_FLOAT32};
+    GpuMemoryPool::Block m_history;
+    uint32_t m_history_length {0};
+
     // if we know the grain, we can determine the min input samples per iteration (max difference of multiples of InputSize and FFT)
-    uint32_t m_max_overlap {FftParameters::config::fft_length};
+    uint32_t m_max_overlap {MAX_FFT_WIDTH};
 
-    GPUA::processor::v2::MemoryManager::GpuMemoryPointer m_fourier_input_segments {0, 0};
-    GPUA::processor::v2::MemoryManager::GpuMemoryPointer m_overlap {0, 0};
+    GpuMemoryPool::Block m_fourier_input_segments;
+    GpuMemoryPool::Block m_overlap;
     uint32_t m_fourier_input_segments_length {0};
     uint32_t m_overlap_length {0};
 
+    GpuMemoryPool::Block m_tail_history;
+    GpuMemoryPool::Block m_tail_output;
+    uint32_t m_tail_history_length {0};
+    uint32_t m_tail_output_length {0};
+
     uint32_t m_fourier_impulse_response_segments_length {0};
-    uint32_t m_old_choice {};
+    // impulse response SetData requested last and the one that is playing, they differ until the loader prepared the
+    // request and PrepareForProcess switched to it (see AdoptPreparedFilter)
+    std::atomic<uint32_t> m_requested_choice {0u};
+    std::atomic<uint32_t> m_current_choice {0u};
+
+    // one fir::ChannelDescriptor per path and one fir::ChannelState per channel, grown with the channel count
+    GpuMemoryPool::Block m_channel_table;
+    GpuMemoryPool::Block m_channel_states;
+    uint32_t m_channel_table_length {0};
+    uint32_t m_channel_states_length {0};
 
 #ifdef SHARED_IRS
-    using MyIRFilter = StaticIRShare;
     std::unique_ptr<MyIRFilter> m_current_ir_filter {nullptr};
 #else
-    using MyIRFilter = IRFilter;
     std::unique_ptr<IRFilter> m_current_ir_filter {nullptr};
-    GPUA::processor::v2::MemoryManager::GpuMemoryPointer m_fourier_impulse_response_segments[MAX_CHANNELS];
-    GPUA::processor::v2::MemoryManager::GpuMemoryPointer m_real_filter[MAX_CHANNELS]; // real -> audio signal
+    FilterData m_filter_data;
 #endif
 
     uint32_t m_real_filter_length {0};
+    // bounds of the port and the impulse responses declared in the specification, 0 if none are declared
+    uint32_t m_max_channel_count {0};
+    uint32_t m_max_filter_length {0};
+
+    // construction parameters of every impulse response filter
+    uint32_t m_generated_filter_length {0};
+    uint32_t m_generated_filter_index {0};
+    float m_tail_threshold_db {0.f};
+
+    std::thread m_loader_thread;
+    std::mutex m_loader_mutex;
+    std::condition_variable m_loader_condition;
+    bool m_loader_stop {false};
+    // latest queued request
+    bool m_filter_requested {false};
+    FilterRequest m_request {};
+    // filter ready to be switched to with its buffers, m_filter_ready lets the processing thread check without locking
+    std::unique_ptr<MyIRFilter> m_prepared_filter {nullptr};
+    ReservedBuffers m_prepared_buffers;
+    uint32_t m_prepared_choice {0u};
+    std::atomic<bool> m_filter_ready {false};
+    // requests the loader could not prepare and the choice of the last of them (see FirConfig::FilterInfo)
+    std::atomic<uint32_t> m_load_failures {0u};
+    std::atomic<uint32_t> m_failed_choice {0u};
+    // filters and buffers that are no longer used, destroyed by the loader
+    std::vector<std::unique_ptr<MyIRFilter>> m_retired_filters;
+    std::vector<ReservedBuffers> m_retired_buffers;
 };
 
 #endif // FIR_FIR_PROCESSOR_H
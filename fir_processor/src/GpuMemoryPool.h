@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_GPU_MEMORY_POOL_H
+#define FIR_GPU_MEMORY_POOL_H
+
+#include <processor_api/MemoryManager.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// free device memory a pool keeps for reuse by default, blocks returned beyond it are freed
+constexpr size_t DEFAULT_GPU_POOL_FREE_BUDGET = size_t {64u} << 20;
+
+// Slab allocator on top of a memory manager: requests are rounded up to size classes (multiples of
+// GPU_POOL_ALIGNMENT, and at most 1/4 of the next smaller power of two apart above GPU_POOL_FINE_LIMIT), and blocks
+// that are released go back to the free list of their class instead of to the memory manager. Growing a buffer on
+// reconfiguration or creating another instance then takes a block of the same class without allocating.
+//
+// Every allocation of the memory manager stays a separate buffer, the device pointers handed to the kernels and the
+// GpuMemory passed to MemCpyCpuToGpu are the ones of the memory manager. `TMemoryManager` only needs a
+// GpuMemoryPointer type and AllocateGpuMemory(size_t), so the pool can be tested without a device.
+//
+// Thread-safe. Blocks keep their pool alive, so they may outlive the processor that allocated them.
+template <class TMemoryManager>
+class BasicGpuMemoryPool : public std::enable_shared_from_this<BasicGpuMemoryPool<TMemoryManager>> {
+public:
+    using MemoryPointer = typename TMemoryManager::GpuMemoryPointer;
+
+    static constexpr size_t GPU_POOL_ALIGNMENT = 128u;
+    static constexpr size_t GPU_POOL_FINE_LIMIT = 4096u;
+
+    struct Statistics {
+        // memory held from the memory manager, in use or free
+        size_t allocated_bytes {0u};
+        // size classes of the blocks in use
+        size_t in_use_bytes {0u};
+        // sizes requested for the blocks in use
+        size_t requested_bytes {0u};
+        size_t free_bytes {0u};
+        size_t peak_allocated_bytes {0u};
+        size_t peak_requested_bytes {0u};
+        // calls to AllocateGpuMemory
+        uint64_t allocations {0u};
+        // requests served from a free list
+        uint64_t reuses {0u};
+        // blocks freed because the free budget was exceeded or the pool was trimmed
+        uint64_t releases {0u};
+
+        // share of the held memory that is not requested: rounding to the size classes and free blocks
+        double GetFragmentation() const {
+            return allocated_bytes == 0u ? 0.0 : 1.0 - static_cast<double>(requested_bytes) / static_cast<double>(allocated_bytes);
+        }
+    };
+
+    // a block of device memory, returned to its pool when it is destroyed or reassigned. used like GpuMemoryPointer.
+    class Block {
+    public:
+        Block() = default;
+        Block(Block&& other) noexcept { *this = std::move(other); }
+        Block& operator=(Block&& other) noexcept {
+            if (this != &other) {
+                reset();
+                m_pool = std::move(other.m_pool);
+                m_memory = std::move(other.m_memory);
+                m_size = std::exchange(other.m_size, 0u);
+                m_capacity = std::exchange(other.m_capacity, 0u);
+            }
+            return *this;
+        }
+        Block(const Block&) = delete;
+        Block& operator=(const Block&) = delete;
+        ~Block() { reset(); }
+
+        explicit operator bool() const { return static_cast<bool>(m_memory); }
+        decltype(auto) operator*() const { return *m_memory; }
+        auto operator->() const { return &*m_memory; }
+
+        // the requested size and the size of the class, which may all be used
+        size_t GetSize() const { return m_size; }
+        size_t GetCapacity() const { return m_capacity; }
+
+        void reset() {
+            if (m_pool != nullptr) {
+                m_pool->Release(std::move(m_memory), m_size, m_capacity);
+                m_pool.reset();
+            }
+            m_memory.reset();
+            m_size = 0u;
+            m_capacity = 0u;
+        }
+
+    private:
+        friend class BasicGpuMemoryPool;
+
+        std::shared_ptr<BasicGpuMemoryPool> m_pool;
+        // like the members of the processor, without relying on a default constructible deleter
+        MemoryPointer m_memory {nullptr, typename MemoryPointer::deleter_type {}};
+        size_t m_size {0u};
+        size_t m_capacity {0u};
+    };
+
+    explicit BasicGpuMemoryPool(TMemoryManager& memory_manager, size_t free_budget = DEFAULT_GPU_POOL_FREE_BUDGET) :
+        m_memory_manager {memory_manager},
+        m_free_budget {free_budget} {}
+
+    BasicGpuMemoryPool(const BasicGpuMemoryPool&) = delete;
+    BasicGpuMemoryPool& operator=(const BasicGpuMemoryPool&) = delete;
+
+    // the pool of a memory manager, shared by every instance that uses it while any of them holds it
+    static std::shared_ptr<BasicGpuMemoryPool> GetShared(TMemoryManager& memory_manager) {
+        static std::mutex registry_mutex;
+        static std::map<TMemoryManager*, std::weak_ptr<BasicGpuMemoryPool>> registry;
+
+        std::unique_lock<std::mutex> lock(registry_mutex);
+        auto& entry = registry[&memory_manager];
+        auto pool = entry.lock();
+        if (pool == nullptr) {
+            pool = std::make_shared<BasicGpuMemoryPool>(memory_manager);
+            entry = pool;
+        }
+        return pool;
+    }
+
+    static size_t GetSizeClass(size_t size) {
+        size = Align(std::max(size, size_t {1u}), GPU_POOL_ALIGNMENT);
+        if (size <= GPU_POOL_FINE_LIMIT) {
+            return size;
+        }
+        size_t octave = GPU_POOL_FINE_LIMIT;
+        while (octave * 2u < size) {
+            octave *= 2u;
+        }
+        return Align(size, octave / 4u);
+    }
+
+    // a block of at least `size` bytes, from the free list of its class if there is one
+    Block Allocate(size_t size) {
+        Block block;
+        block.m_size = size;
+        block.m_capacity = GetSizeClass(size);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto free = m_free.find(block.m_capacity);
+        if (free != m_free.end() && !free->second.empty()) {
+            block.m_memory = std::move(free->second.back());
+            free->second.pop_back();
+            m_statistics.free_bytes -= block.m_capacity;
+            ++m_statistics.reuses;
+        }
+        else {
+            // the memory manager may take a while, other threads keep using the free lists meanwhile
+            lock.unlock();
+            block.m_memory = m_memory_manager.AllocateGpuMemory(block.m_capacity);
+            lock.lock();
+            m_statistics.allocated_bytes += block.m_capacity;
+            m_statistics.peak_allocated_bytes = std::max(m_statistics.peak_allocated_bytes, m_statistics.allocated_bytes);
+            ++m_statistics.allocations;
+        }
+        m_statistics.in_use_bytes += block.m_capacity;
+        m_statistics.requested_bytes += size;
+        m_statistics.peak_requested_bytes = std::max(m_statistics.peak_requested_bytes, m_statistics.requested_bytes);
+        // only now the block is accounted for and goes back to the pool
+        block.m_pool = this->shared_from_this();
+        return block;
+    }
+
+    // frees every free block
+    void Trim() {
+        std::map<size_t, std::vector<MemoryPointer>> free;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            free.swap(m_free);
+            for (const auto& list : free) {
+                m_statistics.releases += list.second.size();
+            }
+            m_statistics.allocated_bytes -= m_statistics.free_bytes;
+            m_statistics.free_bytes = 0u;
+        }
+    }
+
+    void SetFreeBudget(size_t free_budget) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_free_budget = free_budget;
+    }
+
+    Statistics GetStatistics() const {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_statistics;
+    }
+
+private:
+    static size_t Align(size_t size, size_t alignment) {
+        return (size + alignment - 1u) / alignment * alignment;
+    }
+
+    void Release(MemoryPointer memory, size_t size, size_t capacity) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_statistics.in_use_bytes -= capacity;
+        m_statistics.requested_bytes -= size;
+        if (!memory) {
+            m_statistics.allocated_bytes -= capacity;
+            return;
+        }
+        if (m_statistics.free_bytes + capacity > m_free_budget) {
+            m_statistics.allocated_bytes -= capacity;
+            ++m_statistics.releases;
+            lock.unlock();
+            // freed outside the lock, like it is allocated
+            memory.reset();
+            return;
+        }
+        m_free[capacity].push_back(std::move(memory));
+        m_statistics.free_bytes += capacity;
+    }
+
+    TMemoryManager& m_memory_manager;
+    mutable std::mutex m_mutex;
+    // free blocks by size class
+    std::map<size_t, std::vector<MemoryPointer>> m_free;
+    size_t m_free_budget;
+    Statistics m_statistics;
+};
+
+using GpuMemoryPool = BasicGpuMemoryPool<GPUA::processor::v2::MemoryManager>;
+
+#endif // FIR_GPU_MEMORY_POOL_H
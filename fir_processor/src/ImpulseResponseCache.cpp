@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "ImpulseResponseCache.h"
+
+#include <utility>
+
+ImpulseResponseCache::ImpulseResponseCache(uint32_t slot_count, size_t memory_budget) :
+    m_slots {new Slot[slot_count]},
+    m_slot_count {slot_count},
+    m_memory_budget {memory_budget} {}
+
+void ImpulseResponseCache::SetMemoryBudget(size_t memory_budget) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_memory_budget = memory_budget;
+
+    // the most recently used slot stays, like after a load
+    uint32_t newest = m_slot_count;
+    uint64_t newest_use = 0u;
+    for (uint32_t key = 0; key < m_slot_count; ++key) {
+        const uint64_t last_use = m_slots[key].last_use.load(std::memory_order_relaxed);
+        if (m_slots[key].cached && (newest == m_slot_count || last_use > newest_use)) {
+            newest = key;
+            newest_use = last_use;
+        }
+    }
+    Evict(newest);
+}
+
+size_t ImpulseResponseCache::GetMemoryBudget() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_memory_budget;
+}
+
+std::shared_ptr<const ImpulseResponse> ImpulseResponseCache::Get(uint32_t key, const Loader& loader) {
+    if (key >= m_slot_count) {
+        return nullptr;
+    }
+    Slot& slot = m_slots[key];
+
+    auto impulse_response = std::atomic_load(&slot.impulse_response);
+    if (impulse_response == nullptr) {
+        std::unique_lock<std::mutex> load_lock(slot.load_mutex);
+        // another thread may have loaded it while this one waited
+        impulse_response = std::atomic_load(&slot.impulse_response);
+        if (impulse_response == nullptr) {
+            m_misses.fetch_add(1u, std::memory_order_relaxed);
+            auto loaded = std::make_shared<ImpulseResponse>();
+            if (!loader(*loaded)) {
+                return nullptr;
+            }
+            impulse_response = std::move(loaded);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            slot.last_use.store(m_use_clock.fetch_add(1u, std::memory_order_relaxed) + 1u, std::memory_order_relaxed);
+            std::atomic_store(&slot.impulse_response, impulse_response);
+            slot.size = GetSize(*impulse_response);
+            slot.cached = true;
+            m_cached_bytes += slot.size;
+            ++m_cached_count;
+            Evict(key);
+            return impulse_response;
+        }
+    }
+
+    m_hits.fetch_add(1u, std::memory_order_relaxed);
+    slot.last_use.store(m_use_clock.fetch_add(1u, std::memory_order_relaxed) + 1u, std::memory_order_relaxed);
+    return impulse_response;
+}
+
+void ImpulseResponseCache::Pin(uint32_t key, std::shared_ptr<const ImpulseResponse> impulse_response) {
+    if (key >= m_slot_count) {
+        return;
+    }
+    Slot& slot = m_slots[key];
+    std::unique_lock<std::mutex> load_lock(slot.load_mutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (slot.cached) {
+        m_cached_bytes -= slot.size;
+        --m_cached_count;
+        slot.cached = false;
+    }
+    slot.pinned = true;
+    std::atomic_store(&slot.impulse_response, std::shared_ptr<const ImpulseResponse> {std::move(impulse_response)});
+}
+
+bool ImpulseResponseCache::Contains(uint32_t key) const {
+    return key < m_slot_count && std::atomic_load(&m_slots[key].impulse_response) != nullptr;
+}
+
+ImpulseResponseCache::Statistics ImpulseResponseCache::GetStatistics() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Statistics statistics;
+    statistics.hits = m_hits.load(std::memory_order_relaxed);
+    statistics.misses = m_misses.load(std::memory_order_relaxed);
+    statistics.evictions = m_evictions;
+    statistics.cached_bytes = m_cached_bytes;
+    statistics.cached_count = m_cached_count;
+    return statistics;
+}
+
+size_t ImpulseResponseCache::GetSize(const ImpulseResponse& impulse_response) {
+    return (impulse_response.samples.size() + impulse_response.gains.size()) * sizeof(float);
+}
+
+void ImpulseResponseCache::Evict(uint32_t keep) {
+    // eviction only happens on a load or a budget change, so scanning the slots for the oldest one is fine
+    while (m_cached_bytes > m_memory_budget) {
+        uint32_t oldest = m_slot_count;
+        uint64_t oldest_use = 0u;
+        for (uint32_t key = 0; key < m_slot_count; ++key) {
+            const uint64_t last_use = m_slots[key].last_use.load(std::memory_order_relaxed);
+            if (key != keep && m_slots[key].cached && (oldest == m_slot_count || last_use < oldest_use)) {
+                oldest = key;
+                oldest_use = last_use;
+            }
+        }
+        if (oldest == m_slot_count) {
+            return;
+        }
+
+        Slot& slot = m_slots[oldest];
+        std::atomic_store(&slot.impulse_response, std::shared_ptr<const ImpulseResponse> {});
+        m_cached_bytes -= slot.size;
+        --m_cached_count;
+        ++m_evictions;
+        slot.cached = false;
+        slot.size = 0u;
+    }
+}
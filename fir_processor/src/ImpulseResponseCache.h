@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_IMPULSE_RESPONSE_CACHE_H
+#define FIR_IMPULSE_RESPONSE_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// non-owning view of the samples of one channel
+struct SampleSpan {
+    const float* data {nullptr};
+    size_t size {0u};
+
+    const float* begin() const { return data; }
+    const float* end() const { return data + size; }
+    const float& operator[](size_t index) const { return data[index]; }
+};
+
+// The samples of an impulse response, held once: every channel stores `length` samples one after the other and is
+// gain compensated in place when it is loaded (`gains` keeps the factor that was applied to each channel).
+struct ImpulseResponse {
+    uint32_t channel_count {0u};
+    uint32_t length {0u};
+    uint32_t sample_rate {0u};
+    std::vector<float> samples;
+    std::vector<float> gains;
+
+    SampleSpan GetChannel(uint32_t channel) const { return {samples.data() + static_cast<size_t>(channel) * length, length}; }
+};
+
+// host memory the decoded impulse responses of the store may occupy by default
+constexpr size_t DEFAULT_IR_MEMORY_BUDGET = size_t {512u} << 20;
+
+// Decoded impulse responses by catalog index (0..slot_count - 1), loaded on first use and evicted least recently used
+// first once their samples exceed the memory budget. Users hold shared pointers, so an evicted impulse response stays
+// valid for them and only stops counting against the budget. Pinned impulse responses (generated ones that cannot be
+// reloaded) are neither counted nor evicted.
+//
+// Safe to use from any number of threads: a loaded impulse response is published once and never modified, hits only
+// read the published pointer and bump the use tick of the slot. A miss loads under the lock of its slot, so every
+// impulse response is decoded once no matter how many threads ask for it, and different slots load in parallel. Only
+// the budget accounting and the eviction take the cache-wide lock.
+class ImpulseResponseCache {
+public:
+    struct Statistics {
+        uint64_t hits {0u};
+        uint64_t misses {0u};
+        uint64_t evictions {0u};
+        // samples of the cached, not pinned impulse responses
+        size_t cached_bytes {0u};
+        size_t cached_count {0u};
+    };
+
+    // fills the impulse response of a key, false if it cannot be loaded
+    using Loader = std::function<bool(ImpulseResponse&)>;
+
+    explicit ImpulseResponseCache(uint32_t slot_count, size_t memory_budget = DEFAULT_IR_MEMORY_BUDGET);
+
+    // evicts right away if the cached impulse responses exceed the new budget
+    void SetMemoryBudget(size_t memory_budget);
+    size_t GetMemoryBudget() const;
+
+    // the impulse response of `key`, loaded through `loader` on a miss. nullptr if loading fails or the key is out of
+    // range. the most recently loaded impulse response is kept even if it exceeds the budget on its own.
+    std::shared_ptr<const ImpulseResponse> Get(uint32_t key, const Loader& loader);
+    void Pin(uint32_t key, std::shared_ptr<const ImpulseResponse> impulse_response);
+    bool Contains(uint32_t key) const;
+
+    Statistics GetStatistics() const;
+
+    // bytes of samples and gains held by an impulse response
+    static size_t GetSize(const ImpulseResponse& impulse_response);
+
+private:
+    struct Slot {
+        // read and written with std::atomic_load / std::atomic_store only
+        std::shared_ptr<const ImpulseResponse> impulse_response;
+        std::atomic<uint64_t> last_use {0u};
+        // serializes the loads of the slot
+        std::mutex load_mutex;
+        // accounting, guarded by m_mutex
+        size_t size {0u};
+        bool cached {false};
+        bool pinned {false};
+    };
+
+    // drops the least recently used slots until the budget is met, keeping `keep`. requires m_mutex
+    void Evict(uint32_t keep);
+
+    std::unique_ptr<Slot[]> m_slots;
+    uint32_t m_slot_count;
+    std::atomic<uint64_t> m_use_clock {0u};
+    std::atomic<uint64_t> m_hits {0u};
+    std::atomic<uint64_t> m_misses {0u};
+
+    mutable std::mutex m_mutex;
+    size_t m_memory_budget;
+    uint64_t m_evictions {0u};
+    size_t m_cached_bytes {0u};
+    size_t m_cached_count {0u};
+};
+
+#endif // FIR_IMPULSE_RESPONSE_CACHE_H
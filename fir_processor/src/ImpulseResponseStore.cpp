@@ -1,40 +1,56 @@
 #include "ImpulseResponseStore.h"
 
+#include <AudioFile.h>
+
+#include "PartitionPlan.h"
+#include "SpectrumCache.h"
+#include "WavFile.h"
+
 #include <cassert>
 #include <cmath>
 #include <algorithm>
 #include <fstream>
 #include <future>
-#include <numeric>
+#include <memory>
 #include <thread>
-#include <execution>
 #include <utility>
 
 #if defined(__GNUC__)
 #define powf pow
 #endif
 
+namespace {
+constexpr char TEST_IR_PATH[] = ":memory:";
+}
+
+// TODO: Use getenv and COMMONW64 for win
 ImpulseResponseStore::ImpulseResponseStore(uint32_t filter_length, uint32_t filter_index) :
-    m_audio_file_path(R"(C:\)") {
-    m_loaded_audio_files = std::vector<AudioFile<T>>();
-    m_loaded_audio_filenames = std::vector<std::filesystem::path>();
-
-    // TODO: Use getenv and COMMONW64 for win
-    m_audio_file_path = m_audio_file_path / "Program Files" / "Common Files" / "VST3" / "GpuAudio" / "EAP" / "Impulse Responses";
-    for (const auto& file_path : FindAllWavFiles()) {
-        AudioFile<T> a;
-        InitializeAudioFileSlot(file_path, a);
-        if (m_loaded_audio_files.size() >= MAX_IR_COUNT) {
-            break;
-        }
+    ImpulseResponseStore(std::filesystem::path(R"(C:\)") / "Program Files" / "Common Files" / "VST3" / "GpuAudio" / "EAP" / "Impulse Responses", filter_length,
+        filter_index) {}
+
+ImpulseResponseStore::ImpulseResponseStore(const std::filesystem::path& audio_file_path, uint32_t filter_length, uint32_t filter_index) :
+    m_audio_file_path(audio_file_path),
+    m_catalog(CreateCatalog(FindAllWavFiles())),
+    m_cache(static_cast<uint32_t>(m_catalog.size())) {
+    // only the catalog is built here, the files are decoded when they are used. the generated impulse response cannot
+    // be read again, so it is pinned instead of cached.
+    if (m_catalog.front().path == TEST_IR_PATH) {
+        auto impulse_response = std::make_shared<const ImpulseResponse>(CreateTestImpulseResponse(filter_length, filter_index));
+        auto& entry = m_catalog.front();
+        std::call_once(entry.analyzed, [&impulse_response, &entry] { Analyze(*impulse_response, entry); });
+        m_cache.Pin(0u, std::move(impulse_response));
     }
+}
 
-    if (GetLoadedAudioFileCount() == 0) {
-        AudioFile<T> a = CreateTestImpulseResponse(filter_length, filter_index);
-        InitializeAudioFileSlot(":memory:", a, true, true);
+std::deque<ImpulseResponseStore::CatalogEntry> ImpulseResponseStore::CreateCatalog(const std::vector<std::filesystem::path>& file_paths) {
+    std::deque<CatalogEntry> catalog;
+    for (const auto& file_path : file_paths) {
+        catalog.emplace_back().path = file_path;
     }
-
-    PreloadAudioFiles();
+    if (catalog.empty()) {
+        catalog.emplace_back().path = TEST_IR_PATH;
+    }
+    return catalog;
 }
 
 std::filesystem::path ImpulseResponseStore::GetIRRootPath() const {
@@ -57,96 +73,194 @@ std::vector<std::filesystem::path> ImpulseResponseStore::FindAllWavFiles() const
     return paths;
 }
 
-void ImpulseResponseStore::PreloadAudioFiles() {
-    std::vector<int> a(GetLoadedAudioFileCount());
-    std::iota(std::begin(a), std::end(a), 0);
-#if !defined(GPU_AUDIO_MAC)
-    std::for_each(std::execution::par, std::begin(a), std::end(a), [&](int i) {
-#else
-    std::for_each(std::begin(a), std::end(a), [&](int i) {
-#endif
-        this->GetGainCompensatedIr(i);
-    });
-    m_preloaded = true;
+int ImpulseResponseStore::ClampIndex(int audio_file_index) const {
+    return std::max(0, std::min(audio_file_index, static_cast<int>(m_catalog.size()) - 1));
 }
 
 bool ImpulseResponseStore::IsFileLoaded(int audio_file_index) const {
-    audio_file_index = std::max(0, std::min(audio_file_index, MAX_IR_COUNT));
-    if (m_preloaded) {
-        return true;
+    return m_cache.Contains(static_cast<uint32_t>(ClampIndex(audio_file_index)));
+}
+
+std::shared_ptr<const ImpulseResponse> ImpulseResponseStore::GetImpulseResponse(int audio_file_index) {
+    // an unreadable file behaves like a silent impulse response
+    static const auto silence = std::make_shared<const ImpulseResponse>(ImpulseResponse {1u, 1u, 48000u, {0.f}, {1.f}});
+
+    audio_file_index = ClampIndex(audio_file_index);
+    auto& entry = m_catalog[audio_file_index];
+    if (entry.unreadable.load(std::memory_order_acquire)) {
+        return silence;
     }
-    return m_per_file_data[audio_file_index].first;
+    // runs once per load of the entry, the result is immutable once the cache publishes it. a file that fails is not
+    // read again, the loads of the entry are serialized by the cache
+    auto impulse_response = m_cache.Get(static_cast<uint32_t>(audio_file_index), [&entry](ImpulseResponse& loaded) {
+        if (entry.unreadable.load(std::memory_order_acquire) || !LoadImpulseResponse(entry.path, loaded)) {
+            entry.unreadable.store(true, std::memory_order_release);
+            return false;
+        }
+        CompensateIrGain(loaded);
+        return true;
+    });
+    return impulse_response != nullptr ? impulse_response : silence;
 }
 
-bool ImpulseResponseStore::IsFileGainCompensated(int audio_file_index) const {
-    audio_file_index = std::max(0, std::min(audio_file_index, MAX_IR_COUNT));
-    if (m_preloaded) {
+const ImpulseResponseStore::CatalogEntry& ImpulseResponseStore::GetAnalyzedEntry(int audio_file_index) {
+    audio_file_index = ClampIndex(audio_file_index);
+    auto& entry = m_catalog[audio_file_index];
+    // concurrent callers wait for the first one, which decodes the file unless the cache holds it
+    std::call_once(entry.analyzed, [this, audio_file_index, &entry] { Analyze(*GetImpulseResponse(audio_file_index), entry); });
+    return entry;
+}
+
+void ImpulseResponseStore::Analyze(const ImpulseResponse& impulse_response, CatalogEntry& entry) {
+    entry.leading_zero_count = FindLeadingZeroCount(impulse_response);
+    entry.sparse_tap_count = CountSparseTaps(impulse_response);
+    entry.content_key = HashSamples(impulse_response);
+}
+
+void ImpulseResponseStore::SetMemoryBudget(size_t memory_budget) {
+    m_cache.SetMemoryBudget(memory_budget);
+}
+
+ImpulseResponseCache::Statistics ImpulseResponseStore::GetCacheStatistics() const {
+    return m_cache.GetStatistics();
+}
+
+bool ImpulseResponseStore::LoadImpulseResponse(const std::filesystem::path& file_path, ImpulseResponse& impulse_response) {
+    // the samples are converted straight from the mapping into the channel storage
+    const WavFile wav_file {file_path};
+    if (wav_file.IsValid()) {
+        impulse_response.channel_count = wav_file.GetChannelCount();
+        impulse_response.length = static_cast<uint32_t>(wav_file.GetFrameCount());
+        impulse_response.sample_rate = wav_file.GetSampleRate();
+        impulse_response.samples.resize(static_cast<size_t>(impulse_response.channel_count) * impulse_response.length);
+        for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
+            wav_file.ReadChannel(channel, impulse_response.samples.data() + static_cast<size_t>(channel) * impulse_response.length, 0u, impulse_response.length);
+        }
+        impulse_response.gains.assign(impulse_response.channel_count, static_cast<T>(1));
         return true;
     }
-    return m_per_file_data[audio_file_index].second;
-}
 
-const AudioFile<T>& ImpulseResponseStore::GetAudioFile(int audio_file_index) {
-    audio_file_index = std::max(0, std::min(audio_file_index, MAX_IR_COUNT));
-    if (IsFileLoaded(audio_file_index)) {
-        return m_loaded_audio_files[audio_file_index];
+    // the decoded file only lives until its channels are copied
+    AudioFile<T> audio_file;
+    if (!audio_file.load(file_path.string())) {
+        return false;
+    }
+    impulse_response.channel_count = static_cast<uint32_t>(audio_file.getNumChannels());
+    impulse_response.length = static_cast<uint32_t>(audio_file.getNumSamplesPerChannel());
+    impulse_response.sample_rate = audio_file.getSampleRate();
+    impulse_response.samples.assign(static_cast<size_t>(impulse_response.channel_count) * impulse_response.length, static_cast<T>(0));
+    for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
+        const auto& samples = audio_file.samples[channel];
+        std::copy_n(samples.begin(), std::min<size_t>(samples.size(), impulse_response.length), impulse_response.samples.begin() + static_cast<size_t>(channel) * impulse_response.length);
     }
-    auto& a = m_loaded_audio_files[audio_file_index];
-    bool loaded = a.load(m_loaded_audio_filenames[audio_file_index].string());
-    assert(loaded);
-    // m_loaded_audio_files[audio_file_index] = a;
-    m_per_file_data[audio_file_index].first = loaded;
-    return a;
+    impulse_response.gains.assign(impulse_response.channel_count, static_cast<T>(1));
+    return true;
 }
 
-AudioFile<T> ImpulseResponseStore::CompensateIrGain(const AudioFile<T>& impulse_response) {
-    auto to_be_returned = impulse_response;
-    for (auto& sample : to_be_returned.samples) {
+void ImpulseResponseStore::CompensateIrGain(ImpulseResponse& impulse_response) {
+    impulse_response.gains.resize(impulse_response.channel_count);
+    for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
         T sum = static_cast<T>(0);
-        auto* ir = sample.data();
-        const auto length = sample.size();
+        auto* ir = impulse_response.samples.data() + static_cast<size_t>(channel) * impulse_response.length;
+        const auto length = impulse_response.length;
 
         // TODO: Is it ok to normalize channels separately?
-        for (int s = 0; s < length; ++s) {
+        for (uint32_t s = 0; s < length; ++s) {
             sum += std::powf(ir[s], 2);
         }
 
         const T ir_gain_correction = std::min(1.f, 1.f / (2.0f * std::sqrt(sum)));
 
-        for (int s = 0; s < length; ++s) {
+        for (uint32_t s = 0; s < length; ++s) {
             ir[s] *= ir_gain_correction;
         }
+        impulse_response.gains[channel] *= ir_gain_correction;
     }
-    return to_be_returned;
 }
 
-const AudioFile<T>& ImpulseResponseStore::GetGainCompensatedIr(int audio_file_index) {
-    audio_file_index = std::max(0, std::min(audio_file_index, MAX_IR_COUNT));
-    if (IsFileGainCompensated(audio_file_index)) {
-        return m_gain_compensated_irs[audio_file_index];
+uint32_t ImpulseResponseStore::FindLeadingZeroCount(const ImpulseResponse& impulse_response) {
+    if (impulse_response.channel_count == 0 || impulse_response.length == 0) {
+        return 0u;
     }
+    size_t leading_zeros = impulse_response.length - 1;
+    for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
+        const auto samples = impulse_response.GetChannel(channel);
+        const auto first_sample = std::find_if(samples.begin(), samples.end(), [](T sample) { return sample != static_cast<T>(0); });
+        leading_zeros = std::min(leading_zeros, static_cast<size_t>(first_sample - samples.begin()));
+    }
+    return static_cast<uint32_t>(leading_zeros);
+}
 
-    auto& a = GetAudioFile(audio_file_index);
-    m_gain_compensated_irs[audio_file_index] = CompensateIrGain(a);
-    m_per_file_data[audio_file_index].second = true;
-    return m_gain_compensated_irs[audio_file_index];
+uint32_t ImpulseResponseStore::GetLeadingZeroCount(int audio_file_index) {
+    return GetAnalyzedEntry(audio_file_index).leading_zero_count;
 }
 
-std::string ImpulseResponseStore::GetAudioFileNameByIndex(int audio_file_index) const {
-    audio_file_index = std::max(0, std::min(audio_file_index, MAX_IR_COUNT));
-    return m_loaded_audio_filenames[audio_file_index].filename().string();
+bool ImpulseResponseStore::FindSparseTaps(const T* samples, size_t length, fir::SparseTaps& taps) {
+    taps.count = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (samples[i] != static_cast<T>(0)) {
+            if (taps.count == SPARSE_MAX_TAPS) {
+                return false;
+            }
+            taps.offsets[taps.count] = static_cast<int>(i);
+            taps.gains[taps.count] = samples[i];
+            ++taps.count;
+        }
+    }
+    return true;
 }
 
-std::wstring ImpulseResponseStore::GetWideAudioFileNameByIndex(int audio_file_index) const {
-    audio_file_index = std::max(0, std::min(audio_file_index, MAX_IR_COUNT));
-    return m_loaded_audio_filenames[audio_file_index].filename().replace_extension().wstring();
+uint32_t ImpulseResponseStore::CountSparseTaps(const ImpulseResponse& impulse_response) {
+    fir::SparseTaps taps;
+    uint32_t tap_count = 0;
+    for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
+        const auto samples = impulse_response.GetChannel(channel);
+        if (!FindSparseTaps(samples.data, samples.size, taps)) {
+            return 0u;
+        }
+        tap_count = std::max(tap_count, static_cast<uint32_t>(taps.count));
+    }
+    return tap_count;
 }
 
-void ImpulseResponseStore::InitializeAudioFileSlot(const std::filesystem::path& key, const AudioFile<T>& audio_file, bool loaded, bool gain_compensated) {
-    m_loaded_audio_files.push_back(audio_file);
-    m_gain_compensated_irs.push_back(audio_file);
-    m_loaded_audio_filenames.push_back(key);
-    m_per_file_data.emplace_back(loaded, gain_compensated);
+uint32_t ImpulseResponseStore::FindTailLength(const ImpulseResponse& impulse_response, float threshold_db) {
+    uint32_t length = 1;
+    for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
+        const auto samples = impulse_response.GetChannel(channel);
+        length = std::max(length, ::FindTailLength(samples.data, static_cast<uint32_t>(samples.size), threshold_db));
+    }
+    return length;
+}
+
+SpectrumCache::ContentKey ImpulseResponseStore::HashSamples(const ImpulseResponse& impulse_response) {
+    SpectrumCache::ContentKey key;
+    const auto channel_count = static_cast<uint64_t>(impulse_response.channel_count);
+    key.Append(&channel_count, sizeof(channel_count));
+    for (uint32_t channel = 0; channel < impulse_response.channel_count; ++channel) {
+        const auto samples = impulse_response.GetChannel(channel);
+        const auto length = static_cast<uint64_t>(samples.size);
+        key.Append(&length, sizeof(length));
+        key.Append(samples.data, samples.size * sizeof(T));
+    }
+    key.filter_length = impulse_response.length;
+    key.channel_count = impulse_response.channel_count;
+    return key;
+}
+
+SpectrumCache::ContentKey ImpulseResponseStore::GetContentKey(int audio_file_index) {
+    return GetAnalyzedEntry(audio_file_index).content_key;
+}
+
+uint32_t ImpulseResponseStore::GetSparseTapCount(int audio_file_index) {
+    return GetAnalyzedEntry(audio_file_index).sparse_tap_count;
+}
+
+std::string ImpulseResponseStore::GetAudioFileNameByIndex(int audio_file_index) const {
+    return m_catalog[ClampIndex(audio_file_index)].path.filename().string();
+}
+
+std::wstring ImpulseResponseStore::GetWideAudioFileNameByIndex(int audio_file_index) const {
+    return m_catalog[ClampIndex(audio_file_index)].path.filename().replace_extension().wstring();
 }
 
 std::vector<uint8_t> ImpulseResponseStore::OpenFileAsRawData(const std::filesystem::path& file_path) {
@@ -172,17 +286,17 @@ std::vector<uint8_t> ImpulseResponseStore::OpenFileAsRawData(const std::filesyst
 }
 
 size_t ImpulseResponseStore::GetLoadedAudioFileCount() const {
-    return m_loaded_audio_files.size();
+    return m_catalog.size();
 }
 
-AudioFile<T> ImpulseResponseStore::CreateTestImpulseResponse(uint32_t filter_length, uint32_t filter_index) const {
-    std::vector<std::vector<T>> filter(1, std::vector<T>(filter_length, 0));
-    filter[0][filter_index] = 1;
-
-    AudioFile<T> ir;
-    ir.setSampleRate(96000);
-    ir.setAudioBufferSize(1, filter_length);
-    ir.setAudioBuffer(filter);
+ImpulseResponse ImpulseResponseStore::CreateTestImpulseResponse(uint32_t filter_length, uint32_t filter_index) const {
+    ImpulseResponse ir;
+    ir.channel_count = 1;
+    ir.length = filter_length;
+    ir.sample_rate = 96000;
+    ir.samples.assign(filter_length, 0);
+    ir.samples[filter_index] = 1;
+    ir.gains.assign(1, 1);
 
     return ir;
 }
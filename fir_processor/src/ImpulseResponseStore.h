@@ -5,15 +5,22 @@
 #ifndef EAP_IMPULSERESPONSESTORE_H
 #define EAP_IMPULSERESPONSESTORE_H
 
+#include <atomic>
+#include <deque>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
 
-#include <AudioFile.h>
-
-constexpr auto MAX_IR_COUNT = 10;
-#define LAZY_LOAD_IR_STORE false
+#include "ImpulseResponseCache.h"
+#include "SpectrumCache.h"
+#include "device/Properties.h"
 
 typedef float T;
 
+// The catalog of impulse response files, built once when the instance is created and immutable afterwards. Every
+// method may be called from any thread: the samples come from the thread-safe ImpulseResponseCache and the analysis
+// of each entry runs exactly once, by whichever thread needs it first.
 class ImpulseResponseStore {
 public:
     static ImpulseResponseStore& GetInstance(uint32_t filter_length, uint32_t filter_index) {
@@ -21,6 +28,8 @@ public:
         return instance;
     }
 
+    // a catalog of the WAV files below `audio_file_path` apart from the shared instance, for tests and tools
+    ImpulseResponseStore(const std::filesystem::path& audio_file_path, uint32_t filter_length, uint32_t filter_index);
     ~ImpulseResponseStore() = default;
 
     ImpulseResponseStore() = delete;
@@ -29,36 +38,73 @@ public:
     ImpulseResponseStore& operator=(const ImpulseResponseStore& other) = delete;
     ImpulseResponseStore& operator=(ImpulseResponseStore&& other) noexcept = delete;
 
-    static AudioFile<T> CompensateIrGain(const AudioFile<T>& impulse_response);
-
+    // reads a WAV file (see WavFile, other formats through AudioFile) into `impulse_response`, false if it cannot be read
+    static bool LoadImpulseResponse(const std::filesystem::path& file_path, ImpulseResponse& impulse_response);
+    // scales every channel to at most -6 dB of energy and records the factors in `gains`
+    static void CompensateIrGain(ImpulseResponse& impulse_response);
+    // number of leading samples that are zero in every channel, at least one sample is kept
+    static uint32_t FindLeadingZeroCount(const ImpulseResponse& impulse_response);
+    // collects the non-zero samples of a channel as taps, false if there are more than SPARSE_MAX_TAPS
+    static bool FindSparseTaps(const T* samples, size_t length, fir::SparseTaps& taps);
+    // largest number of non-zero samples of a channel, 0 if a channel has more than SPARSE_MAX_TAPS (not sparse)
+    static uint32_t CountSparseTaps(const ImpulseResponse& impulse_response);
+    // shortest length such that the energy behind it stays `threshold_db` (< 0) below the energy of each channel
+    static uint32_t FindTailLength(const ImpulseResponse& impulse_response, float threshold_db);
+    // both hashes of the channel count and the samples of every channel (see SpectrumCache::ContentKey)
+    static SpectrumCache::ContentKey HashSamples(const ImpulseResponse& impulse_response);
+
+    // whether the impulse response is decoded and held by the cache
     bool IsFileLoaded(int audio_file_index) const;
-    bool IsFileGainCompensated(int audio_file_index) const;
-    const AudioFile<T>& GetAudioFile(int audio_file_index);
-    const AudioFile<T>& GetGainCompensatedIr(int audio_file_index);
+    // the gain compensated impulse response, decoded on first use and kept in the cache within the memory budget.
+    // the pointer keeps it valid after it is evicted. a file that cannot be read yields a silent impulse response.
+    std::shared_ptr<const ImpulseResponse> GetImpulseResponse(int audio_file_index);
+    // leading zeros of the gain compensated impulse response, detected on first use
+    uint32_t GetLeadingZeroCount(int audio_file_index);
+    // classification of the gain compensated impulse response as a tap delay (see CountSparseTaps), analyzed on first use
+    uint32_t GetSparseTapCount(int audio_file_index);
+    // content key of the gain compensated impulse response, keys its spectra in the SpectrumCache
+    SpectrumCache::ContentKey GetContentKey(int audio_file_index);
     std::string GetAudioFileNameByIndex(int audio_file_index) const;
     std::wstring GetWideAudioFileNameByIndex(int audio_file_index) const;
 
-    void InitializeAudioFileSlot(const std::filesystem::path& key, const AudioFile<T>& audio_file, bool loaded = false, bool gain_compensated = false);
     static std::vector<uint8_t> OpenFileAsRawData(const std::filesystem::path&);
 
+    // number of catalog entries, loaded or not
     size_t GetLoadedAudioFileCount() const;
 
+    // host memory the decoded impulse responses may occupy, least recently used ones are evicted beyond it
+    void SetMemoryBudget(size_t memory_budget);
+    ImpulseResponseCache::Statistics GetCacheStatistics() const;
+
     [[nodiscard]] std::filesystem::path GetIRRootPath() const;
 
 private:
+    // catalog entry of a file, the analysis results stay when the samples are evicted
+    struct CatalogEntry {
+        std::filesystem::path path;
+        // guards the fields below, which are written once by Analyze
+        std::once_flag analyzed;
+        uint32_t leading_zero_count {0u};
+        uint32_t sparse_tap_count {0u};
+        SpectrumCache::ContentKey content_key;
+        // set once the file failed to load, it is served as silence from then on without reading it again
+        std::atomic<bool> unreadable {false};
+    };
+
     ImpulseResponseStore(uint32_t filter_length, uint32_t filter_index);
     [[nodiscard]] std::vector<std::filesystem::path> FindAllWavFiles() const;
-    void PreloadAudioFiles();
-    AudioFile<T> CreateTestImpulseResponse(uint32_t filter_length, uint32_t filter_index) const;
-
-    bool m_preloaded {false};
+    // one entry per file, or the generated TEST_IR_PATH entry if there are none
+    static std::deque<CatalogEntry> CreateCatalog(const std::vector<std::filesystem::path>& file_paths);
+    ImpulseResponse CreateTestImpulseResponse(uint32_t filter_length, uint32_t filter_index) const;
+    int ClampIndex(int audio_file_index) const;
+    // the catalog entry with the analysis of the impulse response, decoding it if it has never been analyzed
+    const CatalogEntry& GetAnalyzedEntry(int audio_file_index);
+    static void Analyze(const ImpulseResponse& impulse_response, CatalogEntry& entry);
 
-    std::vector<AudioFile<T>> m_loaded_audio_files;
-    std::vector<AudioFile<T>> m_gain_compensated_irs;
-    std::vector<std::filesystem::path> m_loaded_audio_filenames;
-    // First is whether the file has been loaded. Second is whether it has been gain compensated.
-    std::vector<std::pair<bool, bool>> m_per_file_data;
     std::filesystem::path m_audio_file_path;
+    // entries do not move, their once_flag cannot
+    std::deque<CatalogEntry> m_catalog;
+    ImpulseResponseCache m_cache;
 };
 
 #endif // EAP_IMPULSERESPONSESTORE_H
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "MappedFile.h"
+
+#include <utility>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return;
+    }
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return;
+    }
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return;
+    }
+    struct stat status {};
+    if (fstat(file, &status) != 0 || status.st_size <= 0) {
+        close(file);
+        return;
+    }
+    void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    // the mapping keeps its own reference to the file
+    close(file);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(status.st_size);
+#endif
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        Close();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0u);
+#if defined(_WIN32)
+        m_file = std::exchange(other.m_file, nullptr);
+        m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+    }
+    return *this;
+}
+
+bool MappedFile::IsOpen() const {
+    return m_data != nullptr;
+}
+
+const uint8_t* MappedFile::GetData() const {
+    return m_data;
+}
+
+size_t MappedFile::GetSize() const {
+    return m_size;
+}
+
+void MappedFile::Close() {
+    if (m_data == nullptr) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+    m_file = nullptr;
+    m_mapping = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0u;
+}
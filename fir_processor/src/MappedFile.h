@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_MAPPED_FILE_H
+#define FIR_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until the object is destroyed or moved from.
+class MappedFile {
+public:
+    MappedFile() = default;
+    // IsOpen() is false if the file does not exist, is empty or cannot be mapped
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool IsOpen() const;
+    const uint8_t* GetData() const;
+    size_t GetSize() const;
+
+private:
+    void Close();
+
+    const uint8_t* m_data {nullptr};
+    size_t m_size {0u};
+#if defined(_WIN32)
+    void* m_file {nullptr};
+    void* m_mapping {nullptr};
+#endif
+};
+
+#endif // FIR_MAPPED_FILE_H
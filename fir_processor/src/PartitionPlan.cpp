@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "PartitionPlan.h"
+
+#include "device/SM_FFT_parameters.cuh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+template <class T, class U>
+constexpr T divup(T a, U b) {
+    return (a + b - 1) / b;
+}
+
+// appends a stage covering [filter_offset, filter_length) with blocks of `block_length` samples. the stages are
+// transformed with the FFT of the task, whose thread count only fits blocks of the task FFT size (see FirProcessor.cuh)
+void AppendTailStage(PartitionPlan& plan, uint32_t filter_length, uint32_t filter_offset, uint32_t block_length) {
+    auto& stage = plan.tail_stages[plan.tail_stage_count++];
+    stage.block_length = static_cast<int>(block_length);
+    stage.segments_count = static_cast<int>(divup(filter_length - filter_offset, block_length));
+    stage.filter_offset = static_cast<int>(filter_offset);
+    stage.spectrum_offset = static_cast<int>(plan.spectrum_length);
+
+    plan.spectrum_length += stage.segments_count * block_length;
+    plan.max_block_length = std::max(plan.max_block_length, block_length);
+}
+
+// the history has to hold the largest block plus one grain (which is at most `grain_length`),
+// the output ring every result that has not been consumed yet
+void SetTailBufferLengths(PartitionPlan& plan, uint32_t grain_length) {
+    const auto& last = plan.tail_stages[plan.tail_stage_count - 1u];
+    plan.tail_history_length = 2u * plan.max_block_length;
+    plan.tail_output_length = divup(grain_length + static_cast<uint32_t>(last.filter_offset + last.block_length), plan.tail_history_length) * plan.tail_history_length;
+}
+} // namespace
+
+PartitionPlan CreateUniformPartitionPlan(uint32_t filter_length, uint32_t segment_length, uint32_t spectrum_block_length) {
+    PartitionPlan plan {};
+    plan.head_segment_count = divup(filter_length, segment_length);
+    plan.head_segment_length = segment_length;
+    plan.head_block_length = spectrum_block_length;
+    plan.spectrum_length = plan.head_segment_count * spectrum_block_length;
+    plan.max_block_length = spectrum_block_length;
+    return plan;
+}
+
+PartitionPlan CreateNonUniformPartitionPlan(uint32_t filter_length, uint32_t block_length, uint32_t head_segment_count) {
+    // a stage with block length B may only start at filter offset >= B, otherwise its result would be
+    // required before its input block is complete. the head covers at least two blocks, which keeps this true.
+    head_segment_count = std::max(head_segment_count, 2u);
+
+    PartitionPlan plan = CreateUniformPartitionPlan(std::min(filter_length, head_segment_count * block_length), block_length, block_length);
+    if (filter_length <= head_segment_count * block_length) {
+        // the filter fits into the head
+        return plan;
+    }
+
+    AppendTailStage(plan, filter_length, plan.head_segment_count * block_length, block_length);
+    SetTailBufferLengths(plan, block_length);
+    return plan;
+}
+
+PartitionPlan CreateHybridPartitionPlan(uint32_t filter_length, uint32_t direct_length, uint32_t block_length) {
+    // the stage may only start once its first block is complete, i.e., at filter offset >= block_length
+    direct_length = std::max(direct_length, block_length);
+
+    PartitionPlan plan {};
+    plan.direct_length = std::min(filter_length, direct_length);
+    plan.max_block_length = block_length;
+    if (filter_length <= direct_length) {
+        return plan;
+    }
+
+    AppendTailStage(plan, filter_length, direct_length, block_length);
+    SetTailBufferLengths(plan, block_length);
+    return plan;
+}
+
+uint32_t GetTransformSharedMemorySize(uint32_t block_length) {
+    switch (block_length) {
+    case 64:
+        return FFTParameters<64>::config::fft_sm_required * sizeof(float) * 2;
+    case 128:
+        return FFTParameters<128>::config::fft_sm_required * sizeof(float) * 2;
+    case 256:
+        return FFTParameters<256>::config::fft_sm_required * sizeof(float) * 2;
+    case 512:
+        return FFTParameters<512>::config::fft_sm_required * sizeof(float) * 2;
+    case 1024:
+        return FFTParameters<1024>::config::fft_sm_required * sizeof(float) * 2;
+    case 2048:
+        return FFTParameters<2048>::config::fft_sm_required * sizeof(float) * 2;
+    case 4096:
+        return FFTParameters<4096>::config::fft_sm_required * sizeof(float) * 2;
+    default:
+        throw std::runtime_error("Error GetTransformSharedMemorySize: unsupported block length\n");
+    }
+}
+
+uint32_t SelectFftLength(uint32_t buffer_length, uint32_t filter_length) {
+    const uint32_t samples = std::max(buffer_length, 1u);
+    uint32_t best_length = MIN_FFT_WIDTH;
+    double best_cost = 0.0;
+    for (uint32_t fft_length = MIN_FFT_WIDTH; fft_length <= MAX_FFT_WIDTH; fft_length *= 2u) {
+        // forward and backward transform of 2 * fft_length samples plus a complex multiply-add per segment and bin
+        const double transform_cost = 2.0 * fft_length * std::log2(2.0 * fft_length);
+        const double multiply_cost = 4.0 * divup(std::max(filter_length, 1u), fft_length) * fft_length;
+        const double cost = (transform_cost + multiply_cost) / std::min(samples, fft_length);
+        if (fft_length == MIN_FFT_WIDTH || cost < best_cost) {
+            best_cost = cost;
+            best_length = fft_length;
+        }
+    }
+    return best_length;
+}
+
+uint32_t SelectHybridBlockLength(uint32_t direct_length) {
+    // the largest block that is complete once the time-domain part has been consumed
+    uint32_t block_length = MIN_FFT_WIDTH;
+    while (2u * block_length <= std::min<uint32_t>(direct_length, MAX_FFT_WIDTH)) {
+        block_length *= 2u;
+    }
+    return block_length;
+}
+
+uint32_t GetFftTaskIndex(uint32_t fft_length) {
+    uint32_t index = 0u;
+    for (uint32_t length = MIN_FFT_WIDTH; length < fft_length; length *= 2u) {
+        ++index;
+    }
+    return index;
+}
+
+uint32_t GetStereoTaskIndex(uint32_t fft_length) {
+    return STEREO_TASK_INDEX + GetFftTaskIndex(fft_length);
+}
+
+uint32_t GetSliceTaskIndex(uint32_t fft_length) {
+    return SLICE_TASK_INDEX + GetFftTaskIndex(fft_length);
+}
+
+uint32_t SelectSegmentSliceCount(uint32_t segment_count, uint32_t segments_per_slice) {
+    if (segments_per_slice == 0u || segment_count <= 2u) {
+        return 0u;
+    }
+    // segments 0 and 1 are accumulated by the FFT task, a single slice would only move the rest to another launch
+    const uint32_t slice_count = std::min<uint32_t>(divup(segment_count - 2u, segments_per_slice), MAX_SEGMENT_SLICES);
+    return slice_count > 1u ? slice_count : 0u;
+}
+
+namespace {
+Partitioning CreatePartitioning(uint32_t filter_length, uint32_t buffer_length, uint32_t fft_length, const PartitioningOptions& options) {
+    Partitioning partitioning;
+    partitioning.fft_length = fft_length;
+    partitioning.grain = std::min<uint32_t>(buffer_length, partitioning.fft_length);
+
+    if (filter_length < partitioning.fft_length) {
+        // use as many samples of the input as possible
+        partitioning.fir_samples_per_segment = filter_length;
+        partitioning.input_size_per_iteration = std::max(partitioning.grain, 2 * partitioning.fft_length - filter_length);
+    }
+    else {
+        // simply use half split
+        partitioning.input_size_per_iteration = partitioning.fft_length;
+        partitioning.fir_samples_per_segment = partitioning.fft_length;
+    }
+
+    // the hybrid mode transforms blocks of the tail that fit behind the time-domain part
+    if (!options.matrix && options.hybrid_direct_length != 0) {
+        partitioning.plan = CreateHybridPartitionPlan(filter_length, options.hybrid_direct_length, partitioning.fft_length);
+    }
+    else if (!options.matrix && options.non_uniform && partitioning.fir_samples_per_segment == partitioning.fft_length) {
+        partitioning.plan = CreateNonUniformPartitionPlan(filter_length, partitioning.fft_length);
+    }
+    else {
+        partitioning.plan = CreateUniformPartitionPlan(filter_length, partitioning.fir_samples_per_segment, partitioning.fft_length);
+    }
+    return partitioning;
+}
+} // namespace
+
+Partitioning SelectPartitioning(uint32_t filter_length, uint32_t buffer_length, const PartitioningOptions& options) {
+    const bool hybrid = !options.matrix && options.hybrid_direct_length != 0;
+    const uint32_t fft_length = hybrid ? SelectHybridBlockLength(options.hybrid_direct_length) : SelectFftLength(buffer_length, filter_length);
+    return CreatePartitioning(filter_length, buffer_length, fft_length, options);
+}
+
+uint32_t SelectPartitioningSliceCount(const Partitioning& partitioning, const PartitioningOptions& options) {
+    if (options.matrix || partitioning.grain > partitioning.input_size_per_iteration) {
+        return 0u;
+    }
+    return SelectSegmentSliceCount(partitioning.plan.head_segment_count, options.segments_per_slice);
+}
+
+PartitionBufferLengths GetPartitionBufferLengths(const Partitioning& partitioning, uint32_t filter_length, const PartitioningOptions& options) {
+    const PartitionPlan& plan = partitioning.plan;
+    PartitionBufferLengths lengths;
+    lengths.spectrum_length = plan.spectrum_length;
+    lengths.tail_history_length = plan.tail_history_length;
+    lengths.tail_output_length = plan.tail_output_length;
+    lengths.history_length = std::max(plan.direct_length, 1u) - 1;
+    lengths.overlap_length = std::min<uint32_t>(std::min(filter_length, plan.head_segment_count * partitioning.fir_samples_per_segment), 2 * partitioning.fft_length);
+    lengths.slice_spectra_length = SelectPartitioningSliceCount(partitioning, options) * partitioning.fft_length;
+    lengths.head_segment_count = plan.head_segment_count;
+    return lengths;
+}
+
+std::vector<Partitioning> GetPossiblePartitionings(uint32_t filter_length, const PartitioningOptions& options) {
+    const bool hybrid = !options.matrix && options.hybrid_direct_length != 0;
+    const uint32_t first_fft_length = hybrid ? SelectHybridBlockLength(options.hybrid_direct_length) : MIN_FFT_WIDTH;
+    const uint32_t last_fft_length = hybrid ? first_fft_length : MAX_FFT_WIDTH;
+
+    std::vector<Partitioning> partitionings;
+    for (uint32_t fft_length = first_fft_length; fft_length <= last_fft_length; fft_length *= 2u) {
+        partitionings.push_back(CreatePartitioning(filter_length, fft_length, fft_length, options));
+    }
+    return partitionings;
+}
+
+PartitionBufferLengths GetMaxPartitionBufferLengths(uint32_t max_filter_length, const PartitioningOptions& options) {
+    // the lengths grow with the filter for a given FFT size, the FFT size itself may be any the buffer length selects.
+    // the grain does not change the lengths: it never exceeds the input per iteration, see CreatePartitioning
+    PartitionBufferLengths max_lengths;
+    for (const Partitioning& partitioning : GetPossiblePartitionings(max_filter_length, options)) {
+        const PartitionBufferLengths lengths = GetPartitionBufferLengths(partitioning, max_filter_length, options);
+        max_lengths.spectrum_length = std::max(max_lengths.spectrum_length, lengths.spectrum_length);
+        max_lengths.tail_history_length = std::max(max_lengths.tail_history_length, lengths.tail_history_length);
+        max_lengths.tail_output_length = std::max(max_lengths.tail_output_length, lengths.tail_output_length);
+        max_lengths.history_length = std::max(max_lengths.history_length, lengths.history_length);
+        max_lengths.overlap_length = std::max(max_lengths.overlap_length, lengths.overlap_length);
+        max_lengths.slice_spectra_length = std::max(max_lengths.slice_spectra_length, lengths.slice_spectra_length);
+        max_lengths.head_segment_count = std::max(max_lengths.head_segment_count, lengths.head_segment_count);
+    }
+    return max_lengths;
+}
+
+std::vector<int> FindActiveSegments(const float* filter, uint32_t filter_length, uint32_t segment_length, uint32_t segment_count, float relative_threshold) {
+    std::vector<double> energies(segment_count, 0.0);
+    double max_energy = 0.0;
+    for (uint32_t segment = 0; segment < segment_count; ++segment) {
+        const uint32_t begin = std::min(segment * segment_length, filter_length);
+        const uint32_t end = std::min(begin + segment_length, filter_length);
+        for (uint32_t i = begin; i < end; ++i) {
+            energies[segment] += static_cast<double>(filter[i]) * filter[i];
+        }
+        max_energy = std::max(max_energy, energies[segment]);
+    }
+
+    std::vector<int> active;
+    for (uint32_t segment = 1; segment < segment_count; ++segment) {
+        if (energies[segment] > relative_threshold * max_energy) {
+            active.push_back(static_cast<int>(segment));
+        }
+    }
+    return active;
+}
+
+uint32_t FindTailLength(const float* filter, uint32_t filter_length, float threshold_db) {
+    double energy = 0.0;
+    for (uint32_t i = 0; i < filter_length; ++i) {
+        energy += static_cast<double>(filter[i]) * filter[i];
+    }
+
+    // walk back from the end while the energy behind the cut stays below the threshold
+    const double limit = energy * std::pow(10.0, static_cast<double>(threshold_db) / 10.0);
+    double remaining = 0.0;
+    uint32_t length = filter_length;
+    while (length > 1) {
+        const double next = remaining + static_cast<double>(filter[length - 1]) * filter[length - 1];
+        if (next > limit) {
+            break;
+        }
+        remaining = next;
+        --length;
+    }
+    return std::max(length, 1u);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_PARTITION_PLAN_H
+#define FIR_PARTITION_PLAN_H
+
+#include "device/Properties.h"
+
+#include <cstdint>
+#include <vector>
+
+// Describes how a filter is split into frequency-domain segments.
+// The head partition is processed with the processor FFT size on every grain, the tail stages
+// use blocks of the same size and are only processed once per block (see FirProcessor.cuh).
+struct PartitionPlan {
+    // leading filter samples convolved in the time domain (hybrid plans only)
+    uint32_t direct_length {0u};
+    uint32_t head_segment_count {0u};
+    // filter samples per head segment and bins of its spectrum (transformed with a 2 * head_block_length real FFT)
+    uint32_t head_segment_length {0u};
+    uint32_t head_block_length {0u};
+    uint32_t tail_stage_count {0u};
+    fir::PartitionStage tail_stages[MAX_TAIL_STAGES] {};
+
+    // per-channel storage of the spectra of all partitions (in float2)
+    uint32_t spectrum_length {0u};
+    // per-channel ring buffer lengths of the tail stages (in samples)
+    uint32_t tail_history_length {0u};
+    uint32_t tail_output_length {0u};
+    // largest block length used by any partition
+    uint32_t max_block_length {0u};
+};
+
+// all segments use the same length; `spectrum_block_length` is the number of bins stored per segment
+PartitionPlan CreateUniformPartitionPlan(uint32_t filter_length, uint32_t segment_length, uint32_t spectrum_block_length);
+
+// the head uses `head_segment_count` segments of `block_length` samples, a tail stage with blocks of the same length
+// covers the rest. the tail stage runs the transform of the task, so its blocks never exceed block_length, but it is
+// only evaluated once per completed block instead of once per grain.
+PartitionPlan CreateNonUniformPartitionPlan(uint32_t filter_length, uint32_t block_length, uint32_t head_segment_count = 2u);
+
+// the first `direct_length` samples are convolved in the time domain without any FFT, the rest is covered by tail stages
+// starting with blocks of `block_length` samples. the blocks are transformed only once they are complete, which the
+// direct part hides as long as direct_length >= block_length (shorter direct parts are extended).
+PartitionPlan CreateHybridPartitionPlan(uint32_t filter_length, uint32_t direct_length, uint32_t block_length);
+
+// shared memory in bytes required to transform a block of `block_length` samples
+uint32_t GetTransformSharedMemorySize(uint32_t block_length);
+
+// picks the FFT size (MIN_FFT_WIDTH..MAX_FFT_WIDTH) with the lowest estimated cost per sample for the given
+// port buffer length and filter length. every call transforms a full segment and multiplies all segments,
+// so small buffers prefer small transforms while large buffers amortize larger ones.
+uint32_t SelectFftLength(uint32_t buffer_length, uint32_t filter_length);
+
+// block length of the tail stages behind a time-domain part of `direct_length` samples
+uint32_t SelectHybridBlockLength(uint32_t direct_length);
+
+// index of the device task for the given FFT size (see FirProcessor.cu)
+uint32_t GetFftTaskIndex(uint32_t fft_length);
+
+// index of the stereo device task for the given FFT size (MIN_FFT_WIDTH..MAX_FFT_WIDTH / 2, see FirProcessor.cu)
+uint32_t GetStereoTaskIndex(uint32_t fft_length);
+
+// index of the slice device task for the given FFT size (see FirProcessor.cu)
+uint32_t GetSliceTaskIndex(uint32_t fft_length);
+
+// number of blocks per channel accumulating the head segments from 2 on with at most `segments_per_slice` segments
+// each (up to MAX_SEGMENT_SLICES). 0 if splitting does not pay off or `segments_per_slice` is 0.
+uint32_t SelectSegmentSliceCount(uint32_t segment_count, uint32_t segments_per_slice);
+
+// options of the partitioned convolution of a processor (see FirConfig::Specification)
+struct PartitioningOptions {
+    // matrix mode: uniform partitions only, without slices
+    bool matrix {false};
+    bool non_uniform {false};
+    // time-domain part of the hybrid mode, 0 disables it
+    uint32_t hybrid_direct_length {0u};
+    // requested head segments per slice, 0 disables the slices
+    uint32_t segments_per_slice {0u};
+};
+
+// FFT size, grain, segment lengths and partition plan of the FFT path for a filter and port buffer length
+struct Partitioning {
+    uint32_t fft_length {0u};
+    uint32_t grain {0u};
+    uint32_t fir_samples_per_segment {0u};
+    uint32_t input_size_per_iteration {0u};
+    PartitionPlan plan {};
+};
+
+Partitioning SelectPartitioning(uint32_t filter_length, uint32_t buffer_length, const PartitioningOptions& options);
+
+// slices per channel of a partitioning (see SelectSegmentSliceCount). a grain longer than a segment would start several
+// segments per call, which the slices do not support
+uint32_t SelectPartitioningSliceCount(const Partitioning& partitioning, const PartitioningOptions& options);
+
+// every partitioning SelectPartitioning may choose for a filter of `filter_length` samples, whatever the buffer length:
+// one per FFT size, each with the grain of a buffer of one segment. the plan only depends on the FFT size
+std::vector<Partitioning> GetPossiblePartitionings(uint32_t filter_length, const PartitioningOptions& options);
+
+// per-channel lengths of the device buffers of the FFT path, the spectra in bins and the rest in samples
+struct PartitionBufferLengths {
+    uint32_t spectrum_length {0u};
+    uint32_t tail_history_length {0u};
+    uint32_t tail_output_length {0u};
+    uint32_t history_length {0u};
+    uint32_t overlap_length {0u};
+    uint32_t slice_spectra_length {0u};
+    uint32_t head_segment_count {0u};
+};
+
+PartitionBufferLengths GetPartitionBufferLengths(const Partitioning& partitioning, uint32_t filter_length, const PartitioningOptions& options);
+
+// element-wise maximum of GetPartitionBufferLengths over every partitioning SelectPartitioning may choose for filters
+// of at most `max_filter_length` samples, whatever the buffer length
+PartitionBufferLengths GetMaxPartitionBufferLengths(uint32_t max_filter_length, const PartitioningOptions& options);
+
+// energy of a head segment relative to the loudest one below which the segment is skipped (-120 dB)
+constexpr float SILENT_SEGMENT_THRESHOLD = 1e-12f;
+
+// ascending indices of the head segments 1..segment_count - 1 of `filter` whose energy exceeds `relative_threshold`
+// times the energy of the loudest segment. segment i covers the samples [i * segment_length, (i + 1) * segment_length),
+// segment 0 is always processed and not part of the list.
+std::vector<int> FindActiveSegments(const float* filter, uint32_t filter_length, uint32_t segment_length, uint32_t segment_count,
+    float relative_threshold = SILENT_SEGMENT_THRESHOLD);
+
+// shortest length of `filter` such that the energy of the samples behind it is at most `threshold_db` (< 0) relative
+// to the energy of the whole filter, at least one sample
+uint32_t FindTailLength(const float* filter, uint32_t filter_length, float threshold_db);
+
+#endif // FIR_PARTITION_PLAN_H
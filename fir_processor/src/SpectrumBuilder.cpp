@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "SpectrumBuilder.h"
+
+#include "device/SpectrumStorage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SPECTRUM_BUILDER_AVX2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// the build need not target AVX2: the AVX2 butterflies are compiled for it on their own and only called when the cpu
+// supports it (MSVC compiles the intrinsics for any target)
+#if defined(SPECTRUM_BUILDER_AVX2) && (defined(__GNUC__) || defined(__clang__))
+#define SPECTRUM_BUILDER_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define SPECTRUM_BUILDER_AVX2_TARGET
+#endif
+
+namespace {
+#if defined(SPECTRUM_BUILDER_AVX2)
+bool SupportsAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    // the os has to save the ymm registers as well
+    __cpuid(info, 1);
+    const bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+    if (!avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// the first count - count % 4 butterflies of Butterflies, returns how many were computed
+SPECTRUM_BUILDER_AVX2_TARGET uint32_t ButterfliesAvx2(float* a, float* b, const float* w, uint32_t count) {
+    uint32_t j = 0;
+    for (; j + 4 <= count; j += 4) {
+        const __m256 av = _mm256_loadu_ps(a + 2 * j);
+        const __m256 bv = _mm256_loadu_ps(b + 2 * j);
+        const __m256 wv = _mm256_loadu_ps(w + 2 * j);
+        // (b.re * w.re - b.im * w.im, b.im * w.re + b.re * w.im)
+        const __m256 t = _mm256_addsub_ps(_mm256_mul_ps(bv, _mm256_moveldup_ps(wv)), _mm256_mul_ps(_mm256_permute_ps(bv, 0xB1), _mm256_movehdup_ps(wv)));
+        _mm256_storeu_ps(a + 2 * j, _mm256_add_ps(av, t));
+        _mm256_storeu_ps(b + 2 * j, _mm256_sub_ps(av, t));
+    }
+    return j;
+}
+#endif
+
+// a[j] += b[j] * w[j], b[j] = a[j] - b[j] * w[j] for `count` interleaved complex values
+void Butterflies(float* a, float* b, const float* w, uint32_t count) {
+    uint32_t j = 0;
+#if defined(SPECTRUM_BUILDER_AVX2)
+    static const bool avx2 = SupportsAvx2();
+    if (avx2) {
+        j = ButterfliesAvx2(a, b, w, count);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; j + 4 <= count; j += 4) {
+        const float32x4x2_t av = vld2q_f32(a + 2 * j);
+        const float32x4x2_t bv = vld2q_f32(b + 2 * j);
+        const float32x4x2_t wv = vld2q_f32(w + 2 * j);
+        const float32x4_t re = vmlsq_f32(vmulq_f32(bv.val[0], wv.val[0]), bv.val[1], wv.val[1]);
+        const float32x4_t im = vmlaq_f32(vmulq_f32(bv.val[0], wv.val[1]), bv.val[1], wv.val[0]);
+        float32x4x2_t sum;
+        sum.val[0] = vaddq_f32(av.val[0], re);
+        sum.val[1] = vaddq_f32(av.val[1], im);
+        float32x4x2_t difference;
+        difference.val[0] = vsubq_f32(av.val[0], re);
+        difference.val[1] = vsubq_f32(av.val[1], im);
+        vst2q_f32(a + 2 * j, sum);
+        vst2q_f32(b + 2 * j, difference);
+    }
+#endif
+    for (; j < count; ++j) {
+        const float re = b[2 * j] * w[2 * j] - b[2 * j + 1] * w[2 * j + 1];
+        const float im = b[2 * j + 1] * w[2 * j] + b[2 * j] * w[2 * j + 1];
+        const float are = a[2 * j];
+        const float aim = a[2 * j + 1];
+        a[2 * j] = are + re;
+        a[2 * j + 1] = aim + im;
+        b[2 * j] = are - re;
+        b[2 * j + 1] = aim - im;
+    }
+}
+
+uint32_t GetBinSize(uint32_t spectrum_precision) {
+    switch (spectrum_precision) {
+    case SPECTRUM_FLOAT32:
+        return sizeof(float2);
+    case SPECTRUM_FLOAT16:
+        return sizeof(fir::Half2Spectrum);
+    case SPECTRUM_BFLOAT16:
+        return sizeof(fir::BFloat2Spectrum);
+    default:
+        throw std::runtime_error("Error in SpectrumBuilder::SpectrumBuilder: unknown spectrum precision\n");
+    }
+}
+} // namespace
+
+RealFft::RealFft(uint32_t bins) :
+    m_bins {bins},
+    m_bit_reverse(bins),
+    m_twiddles(2 * std::max(bins, 1u)),
+    m_real_twiddles(bins),
+    m_work(2 * bins) {
+    if (bins == 0 || (bins & (bins - 1)) != 0) {
+        throw std::runtime_error("Error in RealFft::RealFft: the bin count has to be a power of two\n");
+    }
+
+    uint32_t bits = 0;
+    while ((1u << bits) < bins) {
+        ++bits;
+    }
+    for (uint32_t i = 0; i < bins; ++i) {
+        uint32_t reversed = 0;
+        for (uint32_t bit = 0; bit < bits; ++bit) {
+            reversed |= ((i >> bit) & 1u) << (bits - 1 - bit);
+        }
+        m_bit_reverse[i] = reversed;
+    }
+
+    const double pi = 3.14159265358979323846;
+    for (uint32_t h = 1; h < bins; h *= 2) {
+        for (uint32_t j = 0; j < h; ++j) {
+            m_twiddles[2 * (h - 1 + j)] = static_cast<float>(std::cos(pi * j / h));
+            m_twiddles[2 * (h - 1 + j) + 1] = static_cast<float>(-std::sin(pi * j / h));
+        }
+    }
+    for (uint32_t k = 0; k < bins; ++k) {
+        m_real_twiddles[k] = make_float2(static_cast<float>(std::cos(pi * k / bins)), static_cast<float>(-std::sin(pi * k / bins)));
+    }
+}
+
+uint32_t RealFft::GetBinCount() const {
+    return m_bins;
+}
+
+void RealFft::TransformComplex() {
+    float* data = m_work.data();
+    for (uint32_t h = 1; h < m_bins; h *= 2) {
+        const float* w = m_twiddles.data() + 2 * (h - 1);
+        for (uint32_t base = 0; base < m_bins; base += 2 * h) {
+            Butterflies(data + 2 * base, data + 2 * (base + h), w, h);
+        }
+    }
+}
+
+void RealFft::Transform(const float* input, uint32_t length, float2* output) {
+    length = std::min(length, 2 * m_bins);
+
+    // z[n] = x[2n] + i x[2n + 1], loaded in bit-reversed order
+    for (uint32_t n = 0; n < m_bins; ++n) {
+        const uint32_t target = 2 * m_bit_reverse[n];
+        m_work[target] = 2 * n < length ? input[2 * n] : 0.f;
+        m_work[target + 1] = 2 * n + 1 < length ? input[2 * n + 1] : 0.f;
+    }
+    TransformComplex();
+
+    // X[k] = (Z[k] + conj(Z[bins - k])) / 2 - i exp(-i pi k / bins) (Z[k] - conj(Z[bins - k])) / 2
+    output[0] = make_float2(m_work[0] + m_work[1], m_work[0] - m_work[1]);
+    for (uint32_t k = 1; k < m_bins; ++k) {
+        const float are = m_work[2 * k];
+        const float aim = m_work[2 * k + 1];
+        const float bre = m_work[2 * (m_bins - k)];
+        const float bim = -m_work[2 * (m_bins - k) + 1];
+        const float2 even = make_float2(0.5f * (are + bre), 0.5f * (aim + bim));
+        // -i (a - b) / 2
+        const float2 odd = make_float2(0.5f * (aim - bim), -0.5f * (are - bre));
+        const float2 w = m_real_twiddles[k];
+        output[k] = make_float2(even.x + odd.x * w.x - odd.y * w.y, even.y + odd.x * w.y + odd.y * w.x);
+    }
+}
+
+SpectrumBuilder::SpectrumBuilder(const PartitionPlan& plan, uint32_t spectrum_precision) :
+    m_plan {plan},
+    m_spectrum_precision {spectrum_precision},
+    m_bin_size {GetBinSize(spectrum_precision)} {
+    m_transforms.reserve(1 + MAX_TAIL_STAGES);
+}
+
+size_t SpectrumBuilder::GetSpectrumSize() const {
+    return static_cast<size_t>(m_plan.spectrum_length) * m_bin_size;
+}
+
+RealFft& SpectrumBuilder::GetTransform(uint32_t bins) {
+    for (auto& transform : m_transforms) {
+        if (transform.GetBinCount() == bins) {
+            return transform;
+        }
+    }
+    m_transforms.emplace_back(bins);
+    return m_transforms.back();
+}
+
+void SpectrumBuilder::Store(const float2* bins, uint32_t count, uint8_t* spectrum) const {
+    for (uint32_t i = 0; i < count; ++i) {
+        if (m_spectrum_precision == SPECTRUM_FLOAT16) {
+            const auto value = fir::SpectrumStorage<fir::Half2Spectrum>::store(bins[i]);
+            std::memcpy(spectrum + i * m_bin_size, &value, sizeof(value));
+        }
+        else if (m_spectrum_precision == SPECTRUM_BFLOAT16) {
+            const auto value = fir::SpectrumStorage<fir::BFloat2Spectrum>::store(bins[i]);
+            std::memcpy(spectrum + i * m_bin_size, &value, sizeof(value));
+        }
+        else {
+            std::memcpy(spectrum + i * m_bin_size, &bins[i], sizeof(float2));
+        }
+    }
+}
+
+void SpectrumBuilder::Build(const float* filter, uint32_t filter_length, void* spectrum) {
+    auto* out = static_cast<uint8_t*>(spectrum);
+
+    // the head partition only covers the first head_segment_count segments, the rest belongs to the tail stages
+    if (m_plan.head_segment_count != 0) {
+        RealFft& transform = GetTransform(m_plan.head_block_length);
+        m_bins.resize(m_plan.head_block_length);
+        const uint32_t head_length = std::min(filter_length, m_plan.head_segment_count * m_plan.head_segment_length);
+        for (uint32_t segment = 0; segment < m_plan.head_segment_count; ++segment) {
+            const uint32_t offset = std::min(segment * m_plan.head_segment_length, head_length);
+            transform.Transform(filter + offset, std::min(m_plan.head_segment_length, head_length - offset), m_bins.data());
+            Store(m_bins.data(), m_plan.head_block_length, out + static_cast<size_t>(segment) * m_plan.head_block_length * m_bin_size);
+        }
+    }
+
+    // the segments of a tail stage hold block_length samples zero padded to 2 * block_length
+    for (uint32_t stage = 0; stage < m_plan.tail_stage_count; ++stage) {
+        const auto& tail_stage = m_plan.tail_stages[stage];
+        const auto block_length = static_cast<uint32_t>(tail_stage.block_length);
+        RealFft& transform = GetTransform(block_length);
+        m_bins.resize(block_length);
+        for (uint32_t segment = 0; segment < static_cast<uint32_t>(tail_stage.segments_count); ++segment) {
+            const uint32_t offset = std::min(static_cast<uint32_t>(tail_stage.filter_offset) + segment * block_length, filter_length);
+            transform.Transform(filter + offset, std::min(block_length, filter_length - offset), m_bins.data());
+            Store(m_bins.data(), block_length, out + (static_cast<size_t>(tail_stage.spectrum_offset) + static_cast<size_t>(segment) * block_length) * m_bin_size);
+        }
+    }
+}
+
+void SpectrumBuilder::Build(const float* filter, uint32_t filter_length, std::vector<uint8_t>& spectrum) {
+    spectrum.resize(GetSpectrumSize());
+    Build(filter, filter_length, spectrum.data());
+}
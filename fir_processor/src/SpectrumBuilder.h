@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_SPECTRUM_BUILDER_H
+#define FIR_SPECTRUM_BUILDER_H
+
+#include "PartitionPlan.h"
+
+#include <cstdint>
+#include <vector>
+
+// Real FFT on the host with the bin layout of dsp::FftCalculator::processR2C: 2 * bins real samples are transformed
+// into `bins` complex bins in natural order, bin 0 packs (DC, Nyquist). The transform is not normalized.
+// The butterflies use AVX2 on x86 cpus supporting it, NEON when the compiler targets it and scalar code otherwise.
+class RealFft {
+public:
+    // bins has to be a power of two
+    explicit RealFft(uint32_t bins);
+
+    uint32_t GetBinCount() const;
+
+    // transforms the first `length` (<= 2 * bins) samples of `input`, zero padded to 2 * bins samples
+    void Transform(const float* input, uint32_t length, float2* output);
+
+private:
+    // in-place complex FFT of m_work (bins values, interleaved real and imaginary parts)
+    void TransformComplex();
+
+    uint32_t m_bins;
+    std::vector<uint32_t> m_bit_reverse;
+    // exp(-i pi j / h) for j < h of every butterfly stage with half length h, stored at offset 2 * (h - 1)
+    std::vector<float> m_twiddles;
+    // exp(-i pi k / bins), separates the spectrum of the real input from the complex transform
+    std::vector<float2> m_real_twiddles;
+    std::vector<float> m_work;
+};
+
+// Transforms filters into the partitioned spectra the device tasks read (see FirProcessor.cuh): head segment i holds
+// the spectrum of the samples [i * head_segment_length, (i + 1) * head_segment_length) with head_block_length bins,
+// every tail stage its segments at spectrum_offset. The bins are stored in the format `spectrum_precision`
+// (SPECTRUM_FLOAT32, ..., see SpectrumStorage.h).
+class SpectrumBuilder {
+public:
+    SpectrumBuilder(const PartitionPlan& plan, uint32_t spectrum_precision);
+
+    // bytes of the spectrum of one filter
+    size_t GetSpectrumSize() const;
+
+    // writes GetSpectrumSize() bytes to `spectrum`
+    void Build(const float* filter, uint32_t filter_length, void* spectrum);
+    void Build(const float* filter, uint32_t filter_length, std::vector<uint8_t>& spectrum);
+
+private:
+    RealFft& GetTransform(uint32_t bins);
+    void Store(const float2* bins, uint32_t count, uint8_t* spectrum) const;
+
+    PartitionPlan m_plan;
+    uint32_t m_spectrum_precision;
+    uint32_t m_bin_size;
+    // one transform per block length of the plan (head and up to MAX_TAIL_STAGES stages)
+    std::vector<RealFft> m_transforms;
+    std::vector<float2> m_bins;
+};
+
+#endif // FIR_SPECTRUM_BUILDER_H
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "SpectrumCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr char SPECTRUM_CACHE_MAGIC[8] = {'F', 'I', 'R', 'S', 'P', 'E', 'C', '\0'};
+constexpr char SPECTRUM_FILE_EXTENSION[] = ".spectra";
+constexpr char TEMP_FILE_EXTENSION[] = ".tmp";
+// temporary files of writers that did not finish, older ones are left over from a crash
+constexpr std::chrono::hours ORPHAN_TEMP_FILE_AGE {1};
+
+struct SpectrumCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t channel_count;
+    uint64_t content_hash;
+    uint64_t check_hash;
+    uint32_t filter_length;
+    // keeps the header free of padding, it is compared as a whole
+    uint32_t reserved;
+    uint64_t plan_hash;
+    uint32_t head_segment_length;
+    uint32_t head_block_length;
+    uint32_t spectrum_precision;
+    uint32_t spectrum_length;
+    uint64_t spectrum_size;
+};
+
+uint64_t HashPlan(const PartitionPlan& plan) {
+    return SpectrumCache::Hash(&plan, sizeof(plan));
+}
+
+SpectrumCacheHeader CreateHeader(const SpectrumCache::ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision, size_t spectrum_size) {
+    SpectrumCacheHeader header {};
+    std::memcpy(header.magic, SPECTRUM_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SpectrumCache::SPECTRUM_CACHE_VERSION;
+    header.channel_count = content.channel_count;
+    header.content_hash = content.hash;
+    header.check_hash = content.check_hash;
+    header.filter_length = content.filter_length;
+    header.plan_hash = HashPlan(plan);
+    header.head_segment_length = plan.head_segment_length;
+    header.head_block_length = plan.head_block_length;
+    header.spectrum_precision = spectrum_precision;
+    header.spectrum_length = plan.spectrum_length;
+    header.spectrum_size = spectrum_size;
+    return header;
+}
+} // namespace
+
+void SpectrumCache::ContentKey::Append(const void* data, size_t size) {
+    hash = Hash(data, size, hash);
+    check_hash = CheckHash(data, size, check_hash);
+}
+
+const uint8_t* SpectrumCache::Entry::GetSpectrum(uint32_t channel, size_t spectrum_size) const {
+    return spectra + static_cast<size_t>(channel) * spectrum_size;
+}
+
+SpectrumCache::SpectrumCache(std::filesystem::path directory, uint64_t budget) :
+    m_directory {std::move(directory)},
+    m_budget {budget} {}
+
+std::filesystem::path SpectrumCache::GetDefaultDirectory() {
+    std::error_code error;
+    const auto temp = std::filesystem::temp_directory_path(error);
+    return (error ? std::filesystem::path {"."} : temp) / "GpuAudio" / "FirSpectrumCache";
+}
+
+uint64_t SpectrumCache::GetDefaultBudget() {
+    const char* budget = std::getenv("GPUA_FIR_SPECTRUM_CACHE_BUDGET");
+    if (budget == nullptr || *budget == '\0') {
+        return DEFAULT_SPECTRUM_CACHE_BUDGET;
+    }
+    char* end = nullptr;
+    const unsigned long long value = std::strtoull(budget, &end, 10);
+    return *end == '\0' ? static_cast<uint64_t>(value) : DEFAULT_SPECTRUM_CACHE_BUDGET;
+}
+
+uint64_t SpectrumCache::Hash(const void* data, size_t size, uint64_t hash) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t SpectrumCache::CheckHash(const void* data, size_t size, uint64_t hash) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash + bytes[i]) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+const std::filesystem::path& SpectrumCache::GetDirectory() const {
+    return m_directory;
+}
+
+void SpectrumCache::SetBudget(uint64_t budget) {
+    m_budget.store(budget, std::memory_order_relaxed);
+}
+
+uint64_t SpectrumCache::GetBudget() const {
+    return m_budget.load(std::memory_order_relaxed);
+}
+
+std::filesystem::path SpectrumCache::GetFilePath(const ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision) const {
+    char name[96];
+    std::snprintf(name, sizeof(name), "%016llx_%u_%u_%u_%016llx%s", static_cast<unsigned long long>(content.hash), plan.head_block_length,
+        plan.head_segment_length, spectrum_precision, static_cast<unsigned long long>(HashPlan(plan)), SPECTRUM_FILE_EXTENSION);
+    return m_directory / name;
+}
+
+SpectrumCache::Entry SpectrumCache::Find(const ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision, size_t spectrum_size) const {
+    if (GetBudget() == 0u) {
+        return {};
+    }
+    const auto path = GetFilePath(content, plan, spectrum_precision);
+    Entry entry;
+    entry.file = MappedFile {path};
+    if (!entry.file.IsOpen() || entry.file.GetSize() != sizeof(SpectrumCacheHeader) + static_cast<size_t>(content.channel_count) * spectrum_size) {
+        return {};
+    }
+
+    // the name could collide, the header has to match the whole key
+    const auto expected = CreateHeader(content, plan, spectrum_precision, spectrum_size);
+    if (std::memcmp(entry.file.GetData(), &expected, sizeof(expected)) != 0) {
+        return {};
+    }
+    entry.spectra = entry.file.GetData() + sizeof(SpectrumCacheHeader);
+
+    // the modification time orders the eviction, a hit makes the file the most recently used one
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    return entry;
+}
+
+bool SpectrumCache::Store(const ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision, size_t spectrum_size, const uint8_t* spectra) const {
+    const uint64_t file_size = sizeof(SpectrumCacheHeader) + static_cast<uint64_t>(content.channel_count) * spectrum_size;
+    if (file_size > GetBudget()) {
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    if (error) {
+        return false;
+    }
+
+    // other processes may read or write the same key, the complete file is renamed into place
+    const auto path = GetFilePath(content, plan, spectrum_precision);
+    auto temp_path = path;
+    temp_path += "." + std::to_string(std::hash<std::thread::id> {}(std::this_thread::get_id()) ^ static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count())) + TEMP_FILE_EXTENSION;
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        const auto header = CreateHeader(content, plan, spectrum_precision, spectrum_size);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(spectra), static_cast<std::streamsize>(static_cast<size_t>(content.channel_count) * spectrum_size));
+        if (!file.good()) {
+            file.close();
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    Evict(path);
+    return true;
+}
+
+void SpectrumCache::Evict(const std::filesystem::path& keep) const {
+    struct CacheFile {
+        std::filesystem::path path;
+        uint64_t size;
+        std::filesystem::file_time_type last_use;
+    };
+
+    // files another process removes meanwhile are skipped, every step is best effort
+    std::error_code error;
+    const auto now = std::filesystem::file_time_type::clock::now();
+    std::vector<CacheFile> files;
+    uint64_t total_size = 0u;
+    for (std::filesystem::directory_iterator it {m_directory, error}, end; !error && it != end; it.increment(error)) {
+        std::error_code file_error;
+        const auto& path = it->path();
+        const auto last_use = std::filesystem::last_write_time(path, file_error);
+        if (file_error) {
+            continue;
+        }
+        if (path.extension() == TEMP_FILE_EXTENSION) {
+            if (now - last_use > ORPHAN_TEMP_FILE_AGE) {
+                std::filesystem::remove(path, file_error);
+            }
+            continue;
+        }
+        const uint64_t size = std::filesystem::file_size(path, file_error);
+        if (path.extension() != SPECTRUM_FILE_EXTENSION || file_error) {
+            continue;
+        }
+        files.push_back({path, size, last_use});
+        total_size += size;
+    }
+
+    const uint64_t budget = GetBudget();
+    if (total_size <= budget) {
+        return;
+    }
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.last_use < b.last_use; });
+    for (const auto& file : files) {
+        if (total_size <= budget) {
+            break;
+        }
+        if (file.path != keep && std::filesystem::remove(file.path, error)) {
+            total_size -= file.size;
+        }
+    }
+}
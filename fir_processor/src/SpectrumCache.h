@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_SPECTRUM_CACHE_H
+#define FIR_SPECTRUM_CACHE_H
+
+#include "MappedFile.h"
+#include "PartitionPlan.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+// On-disk cache of the partitioned filter spectra built by SpectrumBuilder. Every file holds the spectra of all channels
+// of one impulse response for one layout and is named after its key: the content hash of the (gain compensated and
+// trimmed) impulse response, the head block and segment lengths, the storage precision and a hash of the rest of the
+// partition plan. The header repeats the key and SPECTRUM_CACHE_VERSION, which has to be increased whenever the
+// spectrum layout changes, so stale or foreign files are rebuilt. Besides the content hash the header holds a second,
+// independent hash of the samples, their length and channel count, so a file is only used if all of them match. Writing is best effort, a failure only costs the
+// transform at the next start.
+//
+// The files of the directory are limited to a byte budget: every store evicts the least recently used files (by their
+// modification time, which a hit refreshes) beyond it, so processes sharing the directory keep it bounded together.
+// A budget of 0 disables the cache, nothing is read or written.
+class SpectrumCache {
+public:
+    static constexpr uint32_t SPECTRUM_CACHE_VERSION = 2u;
+    static constexpr uint64_t HASH_SEED = 0xCBF29CE484222325ull;
+    static constexpr uint64_t CHECK_HASH_SEED = 0x9E3779B97F4A7C15ull;
+    static constexpr uint64_t DEFAULT_SPECTRUM_CACHE_BUDGET = uint64_t {1u} << 30;
+
+    // the samples a spectrum is built from: two hashes computed differently over the same bytes, so a file is only
+    // taken for other samples if both collide, and the trimmed length and channel count
+    struct ContentKey {
+        uint64_t hash {HASH_SEED};
+        uint64_t check_hash {CHECK_HASH_SEED};
+        uint32_t filter_length {0u};
+        uint32_t channel_count {0u};
+
+        // continues both hashes over `size` bytes
+        void Append(const void* data, size_t size);
+    };
+
+    // the spectra of a cache file, valid as long as the entry lives
+    struct Entry {
+        MappedFile file;
+        const uint8_t* spectra {nullptr};
+
+        // `spectrum_size` bytes of every channel one after the other
+        const uint8_t* GetSpectrum(uint32_t channel, size_t spectrum_size) const;
+    };
+
+    explicit SpectrumCache(std::filesystem::path directory = GetDefaultDirectory(), uint64_t budget = GetDefaultBudget());
+
+    // <temp directory>/GpuAudio/FirSpectrumCache
+    static std::filesystem::path GetDefaultDirectory();
+    // bytes in the environment variable GPUA_FIR_SPECTRUM_CACHE_BUDGET (0 disables the cache), otherwise
+    // DEFAULT_SPECTRUM_CACHE_BUDGET
+    static uint64_t GetDefaultBudget();
+    // FNV-1a over `size` bytes, continuing from `hash`
+    static uint64_t Hash(const void* data, size_t size, uint64_t hash = HASH_SEED);
+    // multiply-xorshift over `size` bytes, continuing from `hash`. its collisions are unrelated to the ones of Hash
+    static uint64_t CheckHash(const void* data, size_t size, uint64_t hash = CHECK_HASH_SEED);
+
+    const std::filesystem::path& GetDirectory() const;
+    // a smaller budget takes effect with the next store
+    void SetBudget(uint64_t budget);
+    uint64_t GetBudget() const;
+
+    // the entry of the key, entry.spectra is nullptr if there is no valid file
+    Entry Find(const ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision, size_t spectrum_size) const;
+    // writes content.channel_count * spectrum_size bytes of `spectra` and evicts beyond the budget, false if the file
+    // could not be written or does not fit in the budget
+    bool Store(const ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision, size_t spectrum_size, const uint8_t* spectra) const;
+
+private:
+    std::filesystem::path GetFilePath(const ContentKey& content, const PartitionPlan& plan, uint32_t spectrum_precision) const;
+    // removes the least recently used files until the directory fits the budget, except `keep`
+    void Evict(const std::filesystem::path& keep) const;
+
+    std::filesystem::path m_directory;
+    std::atomic<uint64_t> m_budget;
+};
+
+#endif // FIR_SPECTRUM_CACHE_H
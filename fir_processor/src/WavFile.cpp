@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "WavFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+constexpr uint16_t WAVE_FORMAT_PCM = 0x0001u;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003u;
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFEu;
+
+// the fields are little endian like every supported host
+template <typename TValue>
+TValue Read(const uint8_t* data) {
+    TValue value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+bool IsChunk(const uint8_t* data, const char* id) {
+    return std::memcmp(data, id, 4) == 0;
+}
+
+WavSampleFormat GetSampleFormat(uint16_t format_tag, uint16_t bit_depth) {
+    if (format_tag == WAVE_FORMAT_IEEE_FLOAT) {
+        return bit_depth == 32 ? WavSampleFormat::Float32 : WavSampleFormat::Unsupported;
+    }
+    if (format_tag != WAVE_FORMAT_PCM) {
+        return WavSampleFormat::Unsupported;
+    }
+    switch (bit_depth) {
+    case 8:
+        return WavSampleFormat::Pcm8;
+    case 16:
+        return WavSampleFormat::Pcm16;
+    case 24:
+        return WavSampleFormat::Pcm24;
+    case 32:
+        return WavSampleFormat::Pcm32;
+    default:
+        return WavSampleFormat::Unsupported;
+    }
+}
+} // namespace
+
+WavFile::WavFile(const std::filesystem::path& path) :
+    m_file {path} {
+    if (!Parse()) {
+        m_file = MappedFile {};
+        m_frame_count = 0u;
+        m_format = WavSampleFormat::Unsupported;
+    }
+}
+
+bool WavFile::Parse() {
+    const uint8_t* file = m_file.GetData();
+    const size_t size = m_file.GetSize();
+    if (!m_file.IsOpen() || size < 12 || !IsChunk(file, "RIFF") || !IsChunk(file + 8, "WAVE")) {
+        return false;
+    }
+
+    bool has_format = false;
+    size_t offset = 12;
+    while (offset + 8 <= size) {
+        const uint8_t* chunk = file + offset;
+        const size_t chunk_size = Read<uint32_t>(chunk + 4);
+        const size_t available = std::min(chunk_size, size - offset - 8);
+
+        if (IsChunk(chunk, "fmt ") && available >= 16) {
+            uint16_t format_tag = Read<uint16_t>(chunk + 8);
+            m_channel_count = Read<uint16_t>(chunk + 10);
+            m_sample_rate = Read<uint32_t>(chunk + 12);
+            m_block_align = Read<uint16_t>(chunk + 20);
+            m_bit_depth = Read<uint16_t>(chunk + 22);
+            // the first two bytes of the sub format GUID hold the actual format tag
+            if (format_tag == WAVE_FORMAT_EXTENSIBLE && available >= 40) {
+                format_tag = Read<uint16_t>(chunk + 32);
+            }
+            m_format = GetSampleFormat(format_tag, static_cast<uint16_t>(m_bit_depth));
+            has_format = true;
+        }
+        else if (IsChunk(chunk, "data") && has_format) {
+            if (m_format == WavSampleFormat::Unsupported || m_channel_count == 0 || m_block_align != m_channel_count * (m_bit_depth / 8)) {
+                return false;
+            }
+            // a truncated data chunk is read up to the end of the file
+            m_data_offset = offset + 8;
+            m_frame_count = available / m_block_align;
+            return true;
+        }
+
+        // chunks are padded to an even size
+        offset += 8 + chunk_size + (chunk_size & 1u);
+    }
+    return false;
+}
+
+bool WavFile::IsValid() const {
+    return m_file.IsOpen();
+}
+
+const uint8_t* WavFile::GetSampleData() const {
+    return m_file.GetData() + m_data_offset;
+}
+
+WavSampleFormat WavFile::GetFormat() const {
+    return m_format;
+}
+
+uint32_t WavFile::GetChannelCount() const {
+    return m_channel_count;
+}
+
+uint32_t WavFile::GetSampleRate() const {
+    return m_sample_rate;
+}
+
+uint32_t WavFile::GetBitDepth() const {
+    return m_bit_depth;
+}
+
+size_t WavFile::GetFrameCount() const {
+    return m_frame_count;
+}
+
+WavChannelSpan WavFile::GetChannelSpan(uint32_t channel) const {
+    if (!IsValid() || m_format != WavSampleFormat::Float32 || channel >= m_channel_count || m_data_offset % alignof(float) != 0) {
+        return {};
+    }
+    return {reinterpret_cast<const float*>(GetSampleData()) + channel, m_frame_count, m_channel_count};
+}
+
+size_t WavFile::ReadChannel(uint32_t channel, float* output, size_t offset, size_t count) const {
+    if (!IsValid() || channel >= m_channel_count || offset >= m_frame_count) {
+        return 0u;
+    }
+    count = std::min(count, m_frame_count - offset);
+
+    const uint8_t* sample = GetSampleData() + offset * m_block_align + channel * (m_bit_depth / 8);
+    for (size_t i = 0; i < count; ++i, sample += m_block_align) {
+        switch (m_format) {
+        case WavSampleFormat::Pcm8:
+            output[i] = (static_cast<float>(sample[0]) - 128.f) / 128.f;
+            break;
+        case WavSampleFormat::Pcm16:
+            output[i] = static_cast<float>(Read<int16_t>(sample)) / 32768.f;
+            break;
+        case WavSampleFormat::Pcm24: {
+            // sign extend through the top byte of a 32 bit word
+            const int32_t value = static_cast<int32_t>((static_cast<uint32_t>(sample[0]) << 8) | (static_cast<uint32_t>(sample[1]) << 16) | (static_cast<uint32_t>(sample[2]) << 24)) >> 8;
+            output[i] = static_cast<float>(value) / 8388608.f;
+            break;
+        }
+        case WavSampleFormat::Pcm32:
+            output[i] = static_cast<float>(static_cast<double>(Read<int32_t>(sample)) / 2147483648.0);
+            break;
+        case WavSampleFormat::Float32:
+            output[i] = Read<float>(sample);
+            break;
+        default:
+            return 0u;
+        }
+    }
+    return count;
+}
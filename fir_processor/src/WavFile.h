@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_WAV_FILE_H
+#define FIR_WAV_FILE_H
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// sample encodings of the data chunk a WavFile can read
+enum class WavSampleFormat {
+    Unsupported,
+    Pcm8,
+    Pcm16,
+    Pcm24,
+    Pcm32,
+    Float32
+};
+
+// samples of one channel of an interleaved float32 data chunk, read in place from the mapping
+struct WavChannelSpan {
+    const float* data {nullptr};
+    size_t length {0u};
+    // distance between two samples of the channel (the channel count)
+    uint32_t stride {1u};
+
+    bool empty() const { return data == nullptr; }
+    float operator[](size_t index) const { return data[index * stride]; }
+};
+
+// Memory mapped RIFF/WAVE file (PCM 8/16/24/32 bit, float32, also as WAVE_FORMAT_EXTENSIBLE). Nothing is read or
+// converted up front: float32 channels are exposed as spans into the mapping, integer formats are converted by
+// ReadChannel while copying into the caller's buffer.
+class WavFile {
+public:
+    WavFile() = default;
+    // IsValid() is false if the file cannot be mapped or is not a WAV file in one of the supported formats
+    explicit WavFile(const std::filesystem::path& path);
+
+    bool IsValid() const;
+    WavSampleFormat GetFormat() const;
+    uint32_t GetChannelCount() const;
+    uint32_t GetSampleRate() const;
+    uint32_t GetBitDepth() const;
+    size_t GetFrameCount() const;
+
+    // zero-copy view of a channel, empty unless the data is float32 and suitably aligned within the file
+    WavChannelSpan GetChannelSpan(uint32_t channel) const;
+    // converts `count` samples of a channel from frame `offset` on to float in [-1, 1), returns the number of samples written
+    size_t ReadChannel(uint32_t channel, float* output, size_t offset, size_t count) const;
+
+private:
+    bool Parse();
+    const uint8_t* GetSampleData() const;
+
+    MappedFile m_file;
+    // offset of the samples in the mapping, the mapping moves along with the object
+    size_t m_data_offset {0u};
+    size_t m_frame_count {0u};
+    WavSampleFormat m_format {WavSampleFormat::Unsupported};
+    uint32_t m_channel_count {0u};
+    uint32_t m_sample_rate {0u};
+    uint32_t m_bit_depth {0u};
+    // bytes per frame (all channels)
+    uint32_t m_block_align {0u};
+};
+
+#endif // FIR_WAV_FILE_H
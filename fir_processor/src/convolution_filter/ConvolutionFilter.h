@@ -1,6 +1,8 @@
 #ifndef EARLYACCESSPRODUCT_CONVOLUTIONFILTER_H
 #define EARLYACCESSPRODUCT_CONVOLUTIONFILTER_H
 
+#include "../ImpulseResponseStore.h"
+
 class ConvolutionFilter {
 public:
     virtual ~ConvolutionFilter() = default;
@@ -10,13 +12,14 @@ public:
     ConvolutionFilter& operator=(const ConvolutionFilter& other) = default;
     ConvolutionFilter& operator=(ConvolutionFilter&& other) noexcept = default;
 
-    virtual std::vector<float>& operator[](int index) {
+    virtual SampleSpan operator[](int index) {
         return GetChannelAt(index);
     };
 
-    virtual std::vector<float>& GetChannelAt(int channel_index) = 0;
+    // the samples stay owned by the ImpulseResponseStore
+    virtual SampleSpan GetChannelAt(int channel_index) = 0;
 
-    virtual float& GetValueAt(int channel_index, int index) = 0;
+    virtual const float& GetValueAt(int channel_index, int index) = 0;
 
     virtual double GetSampleRate() = 0;
 
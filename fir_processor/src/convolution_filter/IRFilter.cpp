@@ -1,14 +1,17 @@
 #include "IRFilter.h"
 
+#include <algorithm>
+
 // TODO: Might need to add locks on this for thread safety.
 //  If the m_active_ir gets updated while it is getting accessed, shit might happen.
 
-std::vector<float>& IRFilter::GetChannelAt(int channel_index) {
-    return m_active_ir[channel_index];
+SampleSpan IRFilter::GetChannelAt(int channel_index) {
+    // the leading zeros and the truncated tail are skipped by the view
+    return {m_active_ir->GetChannel(channel_index).data + m_leading_zeros, m_filter_length};
 }
 
-float& IRFilter::GetValueAt(int channel_index, int index) {
-    return m_active_ir[channel_index][index];
+const float& IRFilter::GetValueAt(int channel_index, int index) {
+    return GetChannelAt(channel_index)[index];
 }
 
 void IRFilter::ResampleTo(double sample_rate) {
@@ -22,7 +25,7 @@ void IRFilter::ResampleTo(double sample_rate) {
 }
 
 unsigned int IRFilter::GetChannelCount() {
-    return m_active_ir.size();
+    return m_active_ir != nullptr ? m_active_ir->channel_count : 0u;
 }
 
 double IRFilter::GetSampleRate() {
@@ -33,6 +36,18 @@ unsigned int IRFilter::GetFilterLength() {
     return m_filter_length;
 }
 
+unsigned int IRFilter::GetLeadingDelay() {
+    return m_leading_zeros;
+}
+
+unsigned int IRFilter::GetSparseTapCount() {
+    return m_sparse_tap_count;
+}
+
+void IRFilter::SetTailThreshold(float threshold_db) {
+    m_tail_threshold_db = threshold_db;
+}
+
 void IRFilter::LoadImpulseResponse(int index) {
     if (index >= static_cast<int>(m_ir_store.GetLoadedAudioFileCount())) {
         return;
@@ -43,16 +58,20 @@ void IRFilter::LoadImpulseResponse(int index) {
     }
 
     m_active_ir_index = index;
-    m_source_audio_file = m_ir_store.GetGainCompensatedIr(index);
+    m_active_ir = m_ir_store.GetImpulseResponse(index);
     RefreshDataFromSourceAudioFile();
 }
 
 void IRFilter::RefreshDataFromSourceAudioFile() {
-    m_active_ir = m_source_audio_file.samples;
-    m_sample_rate = m_source_audio_file.getSampleRate();
+    m_sample_rate = m_active_ir->sample_rate;
 
-    // TODO: There's no guarantee that the size of each channel is the same, unfortunately. Fix this accordingly.
-    m_filter_length = m_active_ir[0].size();
+    m_leading_zeros = m_ir_store.GetLeadingZeroCount(m_active_ir_index);
+    m_sparse_tap_count = m_ir_store.GetSparseTapCount(m_active_ir_index);
+    uint32_t length = m_active_ir->length;
+    if (m_tail_threshold_db != 0.f) {
+        length = std::min(length, std::max(ImpulseResponseStore::FindTailLength(*m_active_ir, m_tail_threshold_db), m_leading_zeros + 1));
+    }
+    m_filter_length = length - m_leading_zeros;
 }
 
 bool IRFilter::ResampleSourceAudioFile(double sample_rate) {
@@ -61,7 +80,5 @@ bool IRFilter::ResampleSourceAudioFile(double sample_rate) {
     //  an in memory file, something will probably break because of it. Ultimately seems clumsy,
     //  is not platform independent and frankly I'm not certain the resampling would even work.
     //  Might as well just use a library specifically for resampling a raw buffer.
-    // m_source_audio_file.setSampleRate(static_cast<unsigned int>(sample_rate));
-    // return m_source_audio_file.save(m_ir_store.GetAudioFileNameByIndex(m_active_ir_index));
     return false;
 }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <cstdint>
+#include <memory>
 
 #include "../ImpulseResponseStore.h"
 #include "ConvolutionFilter.h"
@@ -12,16 +13,22 @@ public:
     IRFilter(uint32_t filter_length, uint32_t filter_index) :
         m_ir_store(ImpulseResponseStore::GetInstance(filter_length, filter_index)) {}
 
-    std::vector<float>& GetChannelAt(int channel_index) override;
-    float& GetValueAt(int channel_index, int index) override;
+    SampleSpan GetChannelAt(int channel_index) override;
+    const float& GetValueAt(int channel_index, int index) override;
 
     void ResampleTo(double sample_rate) override;
     double GetSampleRate() override;
 
+    // length without the leading zeros, which are applied as an output delay instead
     unsigned int GetFilterLength() override;
+    unsigned int GetLeadingDelay();
+    // taps per channel of sparse impulse responses, 0 if not sparse (see ImpulseResponseStore::CountSparseTaps)
+    unsigned int GetSparseTapCount();
 
     unsigned int GetChannelCount() override;
 
+    // truncates the tails of impulse responses loaded afterwards at `threshold_db`, 0 keeps the whole impulse response
+    void SetTailThreshold(float threshold_db);
     void LoadImpulseResponse(int index);
 
 private:
@@ -29,13 +36,15 @@ private:
     bool ResampleSourceAudioFile(double sample_rate);
 
     ImpulseResponseStore& m_ir_store;
-    std::vector<std::vector<float>> m_active_ir;
-
-    AudioFile<float> m_source_audio_file;
+    // the active impulse response is shared with the store, which may evict it in the meantime
+    std::shared_ptr<const ImpulseResponse> m_active_ir;
 
     int m_active_ir_index = -420;
     double m_sample_rate = 0;
     uint32_t m_filter_length = 0;
+    uint32_t m_leading_zeros = 0;
+    uint32_t m_sparse_tap_count = 0;
+    float m_tail_threshold_db = 0.f;
 };
 
 #endif // EARLYACCESSPRODUCT_IRSTOREFILTER_H
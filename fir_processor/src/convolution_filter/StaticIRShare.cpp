@@ -1,7 +1,14 @@
 #include "StaticIRShare.h"
 
-std::unordered_map<StaticIRShare::IRInfo, StaticIRShare::Data, StaticIRShare::IRInfo::Hasher> StaticIRShare::m_shared_irs;
-std::mutex StaticIRShare::m_shared_ir_mutex;
+#include "../PartitionPlan.h"
+#include "../SpectrumBuilder.h"
+#include "../SpectrumCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+StaticIRShare::Shard StaticIRShare::m_shards[StaticIRShare::SHARD_COUNT];
+SpectrumCache StaticIRShare::m_spectrum_cache;
 
 namespace {
 template <typename T>
@@ -17,8 +24,8 @@ T align(T a, T b) {
 StaticIRShare::StaticIRShare(GPUA::processor::v2::MemoryManager& memory_manager, uint32_t filter_length, uint32_t filter_index) :
     m_ir_store(ImpulseResponseStore::GetInstance(filter_length, filter_index)),
     m_memory_manager(memory_manager),
-    m_filter_length {filter_length},
-    m_single_location {filter_index} {
+    m_memory_pool(GpuMemoryPool::GetShared(memory_manager)) {
+    GenerateIR(filter_length, filter_index);
 }
 
 StaticIRShare::~StaticIRShare() {
@@ -33,6 +40,18 @@ unsigned int StaticIRShare::GetChannelCount() {
     return m_channel_count;
 }
 
+unsigned int StaticIRShare::GetLeadingDelay() {
+    return m_leading_zeros;
+}
+
+unsigned int StaticIRShare::GetSparseTapCount() {
+    return m_sparse_tap_count;
+}
+
+void StaticIRShare::SetTailThreshold(float threshold_db) {
+    m_tail_threshold_db = threshold_db;
+}
+
 void StaticIRShare::LoadImpulseResponse(int index) {
     if (m_filter_load_index == index) {
         return;
@@ -44,68 +63,167 @@ void StaticIRShare::LoadImpulseResponse(int index) {
     }
 
     m_filter_load_index = index;
-    m_channel_count = m_ir_store.GetGainCompensatedIr(index).getNumChannels();
+    m_impulse_response = m_ir_store.GetImpulseResponse(index);
+    m_channel_count = m_impulse_response->channel_count;
+
+    m_leading_zeros = m_ir_store.GetLeadingZeroCount(index);
+    m_sparse_tap_count = m_ir_store.GetSparseTapCount(index);
+    m_filter_length = m_impulse_response->length - m_leading_zeros;
+    if (m_tail_threshold_db != 0.f) {
+        m_filter_length = std::min(m_filter_length, std::max(ImpulseResponseStore::FindTailLength(*m_impulse_response, m_tail_threshold_db), m_leading_zeros + 1) - m_leading_zeros);
+    }
 
-    // TODO: There's no guarantee that the size of each channel is the same, unfortunately. Fix this accordingly.
-    m_filter_length = static_cast<uint32_t>(m_ir_store.GetGainCompensatedIr(index).samples[0].size());
+    // the trimmed leading zeros and the truncated tail select the samples that are uploaded
+    m_content_key = m_ir_store.GetContentKey(index);
+    m_content_key.Append(&m_leading_zeros, sizeof(m_leading_zeros));
+    m_content_key.Append(&m_filter_length, sizeof(m_filter_length));
+    m_content_key.filter_length = m_filter_length;
+    m_content_key.channel_count = m_channel_count;
 }
 
 void StaticIRShare::GenerateIR(uint32_t filter_length, uint32_t filter_index) {
-    if (m_filter_load_index == 0xFFFFFFFF && filter_length == m_filter_length && filter_index == m_single_location) {
+    if (m_filter_load_index == 0xFFFFFFFF && filter_length == m_filter_length + m_leading_zeros && filter_index == m_single_location) {
         return;
     }
     unload();
-    m_filter_length = filter_length;
+    // everything before the single impulse is trimmed
+    m_leading_zeros = std::min(filter_index, filter_length - 1);
+    m_filter_length = filter_length - m_leading_zeros;
     m_single_location = filter_index;
+    m_sparse_tap_count = 1;
+    // a single impulse is described by its position, the hash seeds differ from the ones of loaded impulse responses
+    const uint32_t generated[] = {m_leading_zeros, m_filter_length, m_single_location};
+    m_content_key = {~SpectrumCache::HASH_SEED, ~SpectrumCache::CHECK_HASH_SEED, m_filter_length, m_channel_count};
+    m_content_key.Append(generated, sizeof(generated));
 }
 
-void StaticIRShare::unload() {
-    if (m_is_allocated) {
-        std::unique_lock<std::mutex> m_lock(m_shared_ir_mutex);
-        auto found = m_shared_irs.find({m_filter_load_index, m_filter_length, m_single_location});
-        if (found != end(m_shared_irs)) {
-            if (--found->second.m_refcounting == 0) {
-                m_shared_irs.erase(found);
+void StaticIRShare::SetSegmentsLength(uint32_t segments_length, uint32_t spectrum_precision, const PartitionPlan& plan) {
+    if (m_segments_length == segments_length && m_spectrum_precision == spectrum_precision && m_partition_plan.head_segment_length == plan.head_segment_length &&
+        m_partition_plan.head_block_length == plan.head_block_length && m_partition_plan.direct_length == plan.direct_length &&
+        m_partition_plan.tail_stage_count == plan.tail_stage_count) {
+        return;
+    }
+    // the entry and its time-domain filter stay, only the spectra of the new layout are looked up
+    m_segments = 0;
+    m_active_segments = 0;
+    m_active_segment_counts = nullptr;
+    m_segments_length = segments_length;
+    m_spectrum_precision = spectrum_precision;
+    m_partition_plan = plan;
+}
+
+StaticIRShare::IRInfo StaticIRShare::key() const {
+    return {m_content_key.hash, m_channel_count, m_filter_length};
+}
+
+StaticIRShare::Shard& StaticIRShare::shard(const IRInfo& info) {
+    return m_shards[IRInfo::Hasher {}(info) % SHARD_COUNT];
+}
+
+void StaticIRShare::release() {
+    // only the last user takes the lock of the shard. another instance may acquire the entry again before that, or
+    // release and remove it, so it is only removed if it is still the same unused entry
+    if (m_data != nullptr && m_data->m_refcounting.fetch_sub(1u, std::memory_order_acq_rel) == 1u) {
+        const IRInfo info = key();
+        Shard& owner = shard(info);
+        std::unique_lock<std::mutex> lock(owner.m_mutex);
+        auto found = owner.m_entries.find(info);
+        if (found != end(owner.m_entries)) {
+            // m_data may already be deleted, it is only dereferenced once it is found among the entries
+            auto& entries = found->second;
+            auto entry = std::find_if(begin(entries), end(entries), [this](const std::unique_ptr<Data>& other) { return other.get() == m_data; });
+            if (entry != end(entries) && m_data->m_refcounting.load(std::memory_order_acquire) == 0u) {
+                entries.erase(entry);
+                if (entries.empty()) {
+                    owner.m_entries.erase(found);
+                }
             }
         }
     }
+    m_data = nullptr;
+    m_raw = 0;
+    m_segments = 0;
+    m_active_segments = 0;
+    m_active_segment_counts = nullptr;
+    m_sparse_taps = 0;
+}
+
+void StaticIRShare::unload() {
+    release();
     m_filter_load_index = 0xFFFFFFFF;
     m_filter_length = 0xFFFFFFFF;
     m_single_location = 0xFFFFFFFF;
+    m_content_key = {};
+    m_leading_zeros = 0;
+    m_sparse_tap_count = 0;
     m_channel_count = 1;
-    m_is_allocated = false;
-    m_raw = 0;
-    m_segments = 0;
+    m_impulse_response.reset();
+}
+
+const float* StaticIRShare::trimmedSamples(unsigned int channel, std::vector<float>& temp) {
+    if (m_filter_load_index == 0xFFFFFFFF) {
+        temp.assign(m_filter_length, 0.0f);
+        temp[m_single_location - m_leading_zeros] = 1.0f;
+        return temp.data();
+    }
+    // a view into the store, the samples are uploaded from there without another copy
+    return m_impulse_response->GetChannel(channel).data + m_leading_zeros;
+}
+
+bool StaticIRShare::holdsSamples(const Data& data) const {
+    if (data.m_leading_zeros != m_leading_zeros || data.m_single_location != m_single_location || (data.m_impulse_response == nullptr) != (m_impulse_response == nullptr)) {
+        return false;
+    }
+    // the key holds the length and channel count, a generated impulse response is described by its position
+    if (m_impulse_response == nullptr || data.m_impulse_response == m_impulse_response) {
+        return true;
+    }
+    for (unsigned channel = 0; channel < m_channel_count; ++channel) {
+        const float* samples = m_impulse_response->GetChannel(channel).data + m_leading_zeros;
+        const float* other = data.m_impulse_response->GetChannel(channel).data + m_leading_zeros;
+        if (std::memcmp(samples, other, m_filter_length * sizeof(float)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the shared entry of the current key and samples, counting this instance as a user
+StaticIRShare::Data& StaticIRShare::acquire() {
+    if (m_data == nullptr) {
+        const IRInfo info = key();
+        Shard& owner = shard(info);
+        std::unique_lock<std::mutex> lock(owner.m_mutex);
+        auto& entries = owner.m_entries[info];
+        auto found = std::find_if(begin(entries), end(entries), [this](const std::unique_ptr<Data>& entry) { return holdsSamples(*entry); });
+        if (found == end(entries)) {
+            auto entry = std::make_unique<Data>();
+            entry->m_impulse_response = m_impulse_response;
+            entry->m_leading_zeros = m_leading_zeros;
+            entry->m_single_location = m_single_location;
+            found = entries.insert(end(entries), std::move(entry));
+        }
+        (*found)->m_refcounting.fetch_add(1u, std::memory_order_relaxed);
+        m_data = found->get();
+    }
+    return *m_data;
 }
 
 GPUA::processor::v2::GpuPointer StaticIRShare::getRawIR(unsigned int channel) {
     if (!m_raw) {
-        std::unique_lock<std::mutex> m_lock(m_shared_ir_mutex);
-        auto found = m_shared_irs.find({m_filter_load_index, m_filter_length, m_single_location});
+        Data& data = acquire();
+        std::unique_lock<std::mutex> m_lock(data.m_mutex);
         m_raw_step = align<size_t>(m_filter_length * sizeof(float), 128U);
 
-        if (found == end(m_shared_irs)) {
-            found = m_shared_irs.insert(std::make_pair(IRInfo {m_filter_load_index, m_filter_length, m_single_location}, Data {})).first;
-        }
-        if (!found->second.m_gpu_raw) {
-            found->second.m_gpu_raw = m_memory_manager.AllocateGpuMemory(m_raw_step * m_channel_count);
+        if (!data.m_gpu_raw) {
+            data.m_gpu_raw = m_memory_pool->Allocate(m_raw_step * m_channel_count);
 
-            if (m_filter_load_index == 0xFFFFFFFF) {
-                std::vector<float> temp(m_filter_length, 0.0f);
-                temp[m_single_location] = 1.0f;
-                m_memory_manager.MemCpyCpuToGpu(*found->second.m_gpu_raw, 0, temp.data(), m_filter_length * sizeof(float));
-            }
-            else {
-                for (unsigned channel = 0; channel < m_channel_count; ++channel) {
-                    m_memory_manager.MemCpyCpuToGpu(*found->second.m_gpu_raw, channel * m_raw_step, m_ir_store.GetGainCompensatedIr(m_filter_load_index).samples[channel].data(), m_filter_length * sizeof(float));
-                }
+            std::vector<float> temp;
+            for (unsigned channel = 0; channel < m_channel_count; ++channel) {
+                m_memory_manager.MemCpyCpuToGpu(*data.m_gpu_raw, channel * m_raw_step, trimmedSamples(channel, temp), m_filter_length * sizeof(float));
             }
         }
-        m_raw = found->second.m_gpu_raw->GetGpuPointer();
-        if (!m_is_allocated) {
-            ++found->second.m_refcounting;
-            m_is_allocated = true;
-        }
+        m_raw = data.m_gpu_raw->GetGpuPointer();
     }
 
     if (channel >= m_channel_count) {
@@ -115,30 +233,174 @@ GPUA::processor::v2::GpuPointer StaticIRShare::getRawIR(unsigned int channel) {
     return m_raw + m_raw_step * channel;
 }
 
+StaticIRShare::Segments* StaticIRShare::findSegments(const Data& data, uint32_t segments_length, uint32_t spectrum_precision, const PartitionPlan& plan) {
+    for (Segments* segments = data.m_first_segments.load(std::memory_order_acquire); segments != nullptr; segments = segments->m_next) {
+        if (segments->segmentsLength == segments_length && segments->spectrumPrecision == spectrum_precision && segments->headSegmentLength == plan.head_segment_length &&
+            segments->headBlockLength == plan.head_block_length && segments->directLength == plan.direct_length && segments->tailStageCount == plan.tail_stage_count) {
+            return segments;
+        }
+    }
+    return nullptr;
+}
+
 GPUA::processor::v2::GpuPointer StaticIRShare::getSegments(unsigned int channel, unsigned int segmentlength) {
     if (!m_segments) {
-        std::unique_lock<std::mutex> m_lock(m_shared_ir_mutex);
-        auto found = m_shared_irs.find({m_filter_load_index, m_filter_length, m_single_location});
+        Data& data = acquire();
         m_segement_step = align<size_t>(segmentlength, 128U);
 
-        if (found == end(m_shared_irs)) {
-            found = m_shared_irs.insert(std::make_pair(IRInfo {m_filter_load_index, m_filter_length, m_single_location}, Data {})).first;
+        // only the first user of a layout builds the spectra, the others wait for it once and then find them built
+        Segments* segments = findSegments(data, m_segments_length, m_spectrum_precision, m_partition_plan);
+        if (segments == nullptr) {
+            std::unique_lock<std::mutex> m_lock(data.m_mutex);
+            segments = findSegments(data, m_segments_length, m_spectrum_precision, m_partition_plan);
+            if (segments == nullptr) {
+                auto built = std::make_unique<Segments>();
+                built->segmentsLength = m_segments_length;
+                built->spectrumPrecision = m_spectrum_precision;
+                built->headSegmentLength = m_partition_plan.head_segment_length;
+                built->headBlockLength = m_partition_plan.head_block_length;
+                built->directLength = m_partition_plan.direct_length;
+                built->tailStageCount = m_partition_plan.tail_stage_count;
+                built->m_gpu_segments = m_memory_pool->Allocate(m_segement_step * m_channel_count);
+                uploadSegments(*built->m_gpu_segments, segmentlength);
+                built->m_next = data.m_first_segments.load(std::memory_order_relaxed);
+                segments = built.get();
+                data.m_segments.push_back(std::move(built));
+                data.m_first_segments.store(segments, std::memory_order_release);
+            }
         }
 
-        if (!found->second.m_gpu_segments) {
-            found->second.m_gpu_segments = m_memory_manager.AllocateGpuMemory(m_segement_step * m_channel_count);
+        m_segments = segments->m_gpu_segments->GetGpuPointer();
+    }
+
+    if (channel >= m_channel_count) {
+        channel = 0;
+    }
+
+    return m_segments + m_segement_step * channel;
+}
+
+// the first user transforms the impulse response, the device only reads the segments and clears the state of each
+// instance on a filter change. the spectra of loaded impulse responses are kept in the spectrum cache, so later starts
+// map them instead of transforming them again
+void StaticIRShare::uploadSegments(GPUA::processor::v2::GpuMemory& segments, size_t segmentlength) {
+    SpectrumBuilder builder {m_partition_plan, m_spectrum_precision};
+    const size_t spectrum_size = std::min(builder.GetSpectrumSize(), segmentlength);
+
+    if (m_filter_load_index != 0xFFFFFFFF) {
+        const auto entry = m_spectrum_cache.Find(m_content_key, m_partition_plan, m_spectrum_precision, builder.GetSpectrumSize());
+        if (entry.spectra != nullptr) {
+            for (unsigned channel = 0; channel < m_channel_count; ++channel) {
+                m_memory_manager.MemCpyCpuToGpu(segments, channel * m_segement_step, entry.GetSpectrum(channel, builder.GetSpectrumSize()), spectrum_size);
+            }
+            return;
+        }
+    }
+
+    std::vector<uint8_t> spectra(builder.GetSpectrumSize() * m_channel_count);
+    std::vector<float> temp;
+    for (unsigned channel = 0; channel < m_channel_count; ++channel) {
+        uint8_t* spectrum = spectra.data() + channel * builder.GetSpectrumSize();
+        builder.Build(trimmedSamples(channel, temp), m_filter_length, spectrum);
+        m_memory_manager.MemCpyCpuToGpu(segments, channel * m_segement_step, spectrum, spectrum_size);
+    }
+    if (m_filter_load_index != 0xFFFFFFFF) {
+        m_spectrum_cache.Store(m_content_key, m_partition_plan, m_spectrum_precision, builder.GetSpectrumSize(), spectra.data());
+    }
+}
+
+bool StaticIRShare::IsLayoutBuilt(uint32_t segments_length, uint32_t spectrum_precision, const PartitionPlan& plan, unsigned int segmentsamples) {
+    return m_data != nullptr && findSegments(*m_data, segments_length, spectrum_precision, plan) != nullptr &&
+        findActiveSegments(*m_data, segmentsamples, plan.head_segment_count) != nullptr;
+}
+
+StaticIRShare::ActiveSegments* StaticIRShare::findActiveSegments(const Data& data, unsigned int segmentsamples, unsigned int segmentcount) {
+    for (ActiveSegments* active = data.m_first_active_segments.load(std::memory_order_acquire); active != nullptr; active = active->m_next) {
+        if (active->segmentSamples == segmentsamples && active->segmentCount == segmentcount) {
+            return active;
+        }
+    }
+    return nullptr;
+}
+
+GPUA::processor::v2::GpuPointer StaticIRShare::getActiveSegments(unsigned int channel, unsigned int segmentsamples, unsigned int segmentcount) {
+    if (!m_active_segments) {
+        Data& data = acquire();
+        m_active_segments_step = align<size_t>(std::max(segmentcount, 1u) * sizeof(int), 128U);
+
+        ActiveSegments* active_segments = findActiveSegments(data, segmentsamples, segmentcount);
+        if (active_segments == nullptr) {
+            std::unique_lock<std::mutex> m_lock(data.m_mutex);
+            active_segments = findActiveSegments(data, segmentsamples, segmentcount);
+            if (active_segments == nullptr) {
+                auto built = std::make_unique<ActiveSegments>();
+                built->segmentSamples = segmentsamples;
+                built->segmentCount = segmentcount;
+                built->m_gpu_active_segments = m_memory_pool->Allocate(m_active_segments_step * m_channel_count);
+                built->m_counts.assign(m_channel_count, 0u);
+
+                std::vector<float> temp;
+                for (unsigned channel = 0; channel < m_channel_count; ++channel) {
+                    const std::vector<int> active = FindActiveSegments(trimmedSamples(channel, temp), m_filter_length, segmentsamples, segmentcount);
+                    built->m_counts[channel] = static_cast<uint32_t>(active.size());
+                    if (!active.empty()) {
+                        m_memory_manager.MemCpyCpuToGpu(*built->m_gpu_active_segments, channel * m_active_segments_step, active.data(), active.size() * sizeof(int));
+                    }
+                }
+                built->m_next = data.m_first_active_segments.load(std::memory_order_relaxed);
+                active_segments = built.get();
+                data.m_active_segments.push_back(std::move(built));
+                data.m_first_active_segments.store(active_segments, std::memory_order_release);
+            }
         }
 
-        m_segments = found->second.m_gpu_segments->GetGpuPointer();
-        if (!m_is_allocated) {
-            ++found->second.m_refcounting;
-            m_is_allocated = true;
+        m_active_segments = active_segments->m_gpu_active_segments->GetGpuPointer();
+        m_active_segment_counts = &active_segments->m_counts;
+    }
+
+    if (channel >= m_channel_count) {
+        channel = 0;
+    }
+
+    return m_active_segments + m_active_segments_step * channel;
+}
+
+unsigned int StaticIRShare::getActiveSegmentCount(unsigned int channel) {
+    if (m_active_segment_counts == nullptr) {
+        return 0u;
+    }
+    if (channel >= m_channel_count) {
+        channel = 0;
+    }
+    return (*m_active_segment_counts)[channel];
+}
+
+GPUA::processor::v2::GpuPointer StaticIRShare::getSparseTaps(unsigned int channel) {
+    if (!m_sparse_taps) {
+        Data& data = acquire();
+        std::unique_lock<std::mutex> m_lock(data.m_mutex);
+
+        if (!data.m_gpu_sparse_taps) {
+            data.m_gpu_sparse_taps = m_memory_pool->Allocate(sizeof(fir::SparseTaps) * m_channel_count);
+
+            std::vector<fir::SparseTaps> taps(m_channel_count);
+            std::vector<float> temp;
+            for (unsigned channel = 0; channel < m_channel_count; ++channel) {
+                ImpulseResponseStore::FindSparseTaps(trimmedSamples(channel, temp), m_filter_length, taps[channel]);
+            }
+            m_memory_manager.MemCpyCpuToGpu(*data.m_gpu_sparse_taps, 0, taps.data(), sizeof(fir::SparseTaps) * m_channel_count);
         }
+
+        m_sparse_taps = data.m_gpu_sparse_taps->GetGpuPointer();
     }
 
     if (channel >= m_channel_count) {
         channel = 0;
     }
 
-    return m_segments + m_segement_step * channel;
+    return m_sparse_taps + sizeof(fir::SparseTaps) * channel;
+}
+
+SpectrumCache& StaticIRShare::GetSpectrumCache() {
+    return m_spectrum_cache;
 }
@@ -7,12 +7,18 @@
 #ifndef EARLYACCESSPRODUCT_STATIC_IR_SHARE_H
 #define EARLYACCESSPRODUCT_STATIC_IR_SHARE_H
 
+#include "../GpuMemoryPool.h"
 #include "../ImpulseResponseStore.h"
+#include "../PartitionPlan.h"
+#include "../SpectrumCache.h"
 
 #include <processor_api/MemoryManager.h>
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include <atomic>
 #include <mutex>
 
@@ -23,58 +29,158 @@ public:
     StaticIRShare(const StaticIRShare&) = delete;
     StaticIRShare& operator=(const StaticIRShare&) = delete;
 
+    // length of the impulse response without its leading zeros, which are applied as an output delay instead
     unsigned int GetFilterLength();
     unsigned int GetChannelCount();
+    unsigned int GetLeadingDelay();
+    // taps per channel of sparse impulse responses, 0 if not sparse (see ImpulseResponseStore::CountSparseTaps)
+    unsigned int GetSparseTapCount();
 
+    // truncates the tails of impulse responses loaded afterwards at `threshold_db` (see ImpulseResponseStore::FindTailLength),
+    // 0 keeps the whole impulse response. the generated test impulse response is never truncated.
+    void SetTailThreshold(float threshold_db);
     void LoadImpulseResponse(int index);
     void GenerateIR(uint32_t filter_length, uint32_t filter_index);
+    // the spectrum layout depends on the partition plan and the storage format (see SpectrumStorage.h), every layout
+    // gets spectra of its own. the segments are built on the host for `plan` (see SpectrumBuilder.h). switching the
+    // layout keeps the time-domain filter and the spectra of the other layouts built so far.
+    void SetSegmentsLength(uint32_t segments_length, uint32_t spectrum_precision = 0u, const PartitionPlan& plan = {});
+
+    // whether the spectra and active segments of a layout are built, so switching to it only looks them up. false
+    // until the instance has looked up one of its buffers
+    bool IsLayoutBuilt(uint32_t segments_length, uint32_t spectrum_precision, const PartitionPlan& plan, unsigned int segmentsamples);
 
     GPUA::processor::v2::GpuPointer getRawIR(unsigned int channel);
     GPUA::processor::v2::GpuPointer getSegments(unsigned int channel, unsigned int segmentlength);
+    // indices of the non-silent head segments of a channel (see FindActiveSegments), computed once per shared IR when
+    // the segments are built. every channel stores `segmentcount` ints.
+    GPUA::processor::v2::GpuPointer getActiveSegments(unsigned int channel, unsigned int segmentsamples, unsigned int segmentcount);
+    unsigned int getActiveSegmentCount(unsigned int channel);
+    // one fir::SparseTaps per channel, only valid for sparse impulse responses
+    GPUA::processor::v2::GpuPointer getSparseTaps(unsigned int channel);
+
+    // the on-disk cache of the spectra of loaded impulse responses shared by every instance, e.g. to change its budget
+    static SpectrumCache& GetSpectrumCache();
 
 private:
     ImpulseResponseStore& m_ir_store;
     GPUA::processor::v2::MemoryManager& m_memory_manager;
+    // the shared buffers go back to the pool when the last user of an entry leaves
+    std::shared_ptr<GpuMemoryPool> m_memory_pool;
 
+    // shared entries are keyed by what is uploaded, so the same samples loaded from different files or slots share
+    // their device buffers. the key only holds a hash of the samples, the entries of a key are told apart by comparing
+    // the samples themselves (see holdsSamples). the layouts of the spectra are not part of the key, they are kept
+    // per entry (see Segments)
     struct IRInfo {
-        uint32_t filterLoadIndex {0xFFFFFFFFu};
+        uint64_t contentHash {0u};
+        uint32_t channelCount {0u};
         uint32_t filterLength {0xFFFFFFFFu};
-        uint32_t singleLocation {0xFFFFFFFFu};
 
         bool operator==(const IRInfo& other) const {
-            return filterLoadIndex == other.filterLoadIndex && filterLength == other.filterLength && singleLocation == other.singleLocation;
+            return contentHash == other.contentHash && channelCount == other.channelCount && filterLength == other.filterLength;
         }
 
         struct Hasher {
             std::size_t operator()(const StaticIRShare::IRInfo& k) const {
-                using std::hash;
-
-                return ((hash<uint32_t>()(k.filterLoadIndex) ^ (hash<uint32_t>()(k.filterLength) << 1)) >> 1) ^ (hash<uint32_t>()(k.singleLocation) << 1);
+                return static_cast<std::size_t>(SpectrumCache::Hash(&k.channelCount, sizeof(uint32_t) * 2u, k.contentHash));
             }
         };
     };
 
+    // the spectra of every channel for one layout (see SetSegmentsLength)
+    struct Segments {
+        uint32_t segmentsLength {0u};
+        uint32_t spectrumPrecision {0u};
+        uint32_t headSegmentLength {0u};
+        uint32_t headBlockLength {0u};
+        uint32_t directLength {0u};
+        uint32_t tailStageCount {0u};
+        GpuMemoryPool::Block m_gpu_segments;
+        Segments* m_next {nullptr};
+    };
+
+    // the non-silent head segments of every channel for one segment length and count (see FindActiveSegments)
+    struct ActiveSegments {
+        uint32_t segmentSamples {0u};
+        uint32_t segmentCount {0u};
+        GpuMemoryPool::Block m_gpu_active_segments;
+        std::vector<uint32_t> m_counts;
+        ActiveSegments* m_next {nullptr};
+    };
+
     struct Data {
-        GPUA::processor::v2::GpuMemoryPointer m_gpu_raw {0, 0};
-        GPUA::processor::v2::GpuMemoryPointer m_gpu_segments {0, 0};
-        uint32_t m_refcounting {0u};
+        // what the buffers are built from, compared on every hit so a hash collision never shares them
+        std::shared_ptr<const ImpulseResponse> m_impulse_response;
+        uint32_t m_leading_zeros {0u};
+        uint32_t m_single_location {0xFFFFFFFFu};
+        GpuMemoryPool::Block m_gpu_raw;
+        GpuMemoryPool::Block m_gpu_sparse_taps;
+        // the layouts built so far. they are only added, fully built and under the lock of the entry, and published
+        // at the front of the lists, so users look them up without the lock
+        std::atomic<Segments*> m_first_segments {nullptr};
+        std::atomic<ActiveSegments*> m_first_active_segments {nullptr};
+        std::vector<std::unique_ptr<Segments>> m_segments;
+        std::vector<std::unique_ptr<ActiveSegments>> m_active_segments;
+        // users of the entry, the last one to leave removes it from its shard
+        std::atomic<uint32_t> m_refcounting {0u};
+        // guards building the buffers above, so users of other entries are not held up by the upload
+        std::mutex m_mutex;
         Data() {}
     };
 
-    static std::unordered_map<IRInfo, Data, IRInfo::Hasher> m_shared_irs;
-    static std::mutex m_shared_ir_mutex;
+    // the entries are spread over shards by key, each with its own lock, so instances creating or switching different
+    // impulse responses do not wait for each other. the lock is only taken to find an entry and to remove it.
+    struct Shard {
+        std::unordered_map<IRInfo, std::vector<std::unique_ptr<Data>>, IRInfo::Hasher> m_entries;
+        std::mutex m_mutex;
+    };
+    static constexpr size_t SHARD_COUNT = 16u;
+
+    static Shard m_shards[SHARD_COUNT];
+    // spectra of loaded impulse responses kept across process starts
+    static SpectrumCache m_spectrum_cache;
 
-    bool m_is_allocated {false};
+    // the shared entry of the current key, set once this instance counts as one of its users
+    Data* m_data {nullptr};
 
     uint32_t m_filter_load_index {0xFFFFFFFFu};
     uint32_t m_filter_length {0xFFFFFFFFu};
     uint32_t m_single_location {0xFFFFFFFFu};
+    // hashes of the trimmed, truncated samples (see ImpulseResponseStore::HashSamples)
+    SpectrumCache::ContentKey m_content_key {};
+    uint32_t m_segments_length {0u};
+    uint32_t m_spectrum_precision {0u};
+    PartitionPlan m_partition_plan {};
+    uint32_t m_leading_zeros {0u};
+    uint32_t m_sparse_tap_count {0u};
+    float m_tail_threshold_db {0.f};
     uint32_t m_channel_count {1u};
+    // keeps the samples of the loaded impulse response while they may still be uploaded, even if the store evicts them
+    std::shared_ptr<const ImpulseResponse> m_impulse_response;
     GPUA::processor::v2::GpuPointer m_raw {0};
     GPUA::processor::v2::GpuPointer m_segments {0};
+    GPUA::processor::v2::GpuPointer m_active_segments {0};
+    GPUA::processor::v2::GpuPointer m_sparse_taps {0};
+    // counts of the active segments of the current layout, owned by the shared entry
+    const std::vector<uint32_t>* m_active_segment_counts {nullptr};
+    uint32_t m_active_segments_step {0u};
     uint32_t m_raw_step;
     uint32_t m_segement_step;
 
+    IRInfo key() const;
+    static Shard& shard(const IRInfo& info);
+    // samples of a channel starting behind the leading zeros, `temp` holds the generated test impulse response
+    const float* trimmedSamples(unsigned int channel, std::vector<float>& temp);
+    // whether the buffers of the entry are built from the same samples as the ones of this instance
+    bool holdsSamples(const Data& data) const;
+    Data& acquire();
+    // a layout among the ones of the entry, nullptr if it is not built yet
+    static Segments* findSegments(const Data& data, uint32_t segments_length, uint32_t spectrum_precision, const PartitionPlan& plan);
+    static ActiveSegments* findActiveSegments(const Data& data, unsigned int segmentsamples, unsigned int segmentcount);
+    // builds the segments of every channel or maps them from the spectrum cache. requires the lock of the entry
+    void uploadSegments(GPUA::processor::v2::GpuMemory& segments, size_t segmentlength);
+    void release();
     void unload();
 };
 
@@ -19,5 +19,35 @@
 //    - full processor name (with namespace and template parameters)
 //    - the number of tasks (must match the increasing integer from DeclareProcessorStep)
 
-DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 0, process, float, fir::ProcessorParameter, void);
-DeclareProcessor(FirProcessor::FirProcessorDevice<float>, 1);
+// The fir processor declares one task per FFT size followed by the direct form task, the stereo tasks, the slice tasks
+// and the sparse task. The task index has to match GetFftTaskIndex, GetStereoTaskIndex, GetSliceTaskIndex
+// (see PartitionPlan.h), DIRECT_FORM_TASK_INDEX and SPARSE_TASK_INDEX (see Properties.h).
+
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 0, process256, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 1, process512, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 2, process1024, float, fir::ProcessorParameter, void);
+#if !defined(GPU_AUDIO_MAC)
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 3, process2048, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 4, process4096, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 5, processDirect, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 6, processStereo256, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 7, processStereo512, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 8, processStereo1024, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 9, processStereo2048, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 10, accumulateSlices256, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 11, accumulateSlices512, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 12, accumulateSlices1024, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 13, accumulateSlices2048, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 14, accumulateSlices4096, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 15, processSparse, float, fir::ProcessorParameter, void);
+DeclareProcessor(FirProcessor::FirProcessorDevice<float>, 16);
+#else
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 3, processDirect, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 4, processStereo256, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 5, processStereo512, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 6, accumulateSlices256, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 7, accumulateSlices512, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 8, accumulateSlices1024, float, fir::ProcessorParameter, void);
+DeclareProcessorStep(FirProcessor::FirProcessorDevice<float>, 9, processSparse, float, fir::ProcessorParameter, void);
+DeclareProcessor(FirProcessor::FirProcessorDevice<float>, 10);
+#endif
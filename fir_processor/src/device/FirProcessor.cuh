@@ -8,6 +8,7 @@
 #define FIR_FIR_PROCESSOR_CUH
 
 #include "Properties.h"
+#include "SpectrumStorage.h"
 
 #include <gpu_primitives/FftCalculator.h>
 #include <platform/Abstraction.h>
@@ -23,11 +24,8 @@ namespace FirProcessor {
 
 template <typename T>
 class FirProcessorDevice {
-    int _segmentOffset[MAX_CHANNELS];      // points to the last input segment
-    int _segmentZeroSamples[MAX_CHANNELS]; // samples as overlaps from last iteration
-
-    static __program_scope constexpr int SymSize = FftParameters::config::fft_length;
-    static __program_scope constexpr int BlockSize = FftParameters::config::fft_length_quarter;
+    // the per-channel state lives in params->channel_states (see fir::ChannelState), so the processor
+    // object does not limit the channel count
 
 public:
     // mandatory explicitly defined constructor
@@ -39,10 +37,6 @@ public:
     // mandatory init function; can be used to initialize processor data members
     template <class TContext>
     __device_fct void init(TContext context, unsigned int maxBufferLength) __device_addr {
-        for (int i = 0; i < MAX_CHANNELS; ++i) {
-            _segmentOffset[i] = 0;
-            _segmentZeroSamples[i] = 0;
-        }
     }
 
     // Every task of the processor must match the following interface:
@@ -85,21 +79,228 @@ public:
     //    when parts of its input, i.e., the current processors output, are available. It will guarantee that, within a processor, a grain-sized portion of the input
     //    will only be processed when the previous portion has been processed.
 
+    //
+    // ================================
+    // There is one task per supported FFT size (see FFT_TASK_COUNT in Properties.h), FirProcessor selects the
+    // task with m_gpu_task::entry_idx and launches FFT size / 4 threads per block.
+
     template <class TContext>
-    __device_fct void process(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+    __device_fct void process256(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        process<FFTParameters<256>::config>(context, params, task_param, input, output);
+    }
+
+    template <class TContext>
+    __device_fct void process512(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        process<FFTParameters<512>::config>(context, params, task_param, input, output);
+    }
+
+    template <class TContext>
+    __device_fct void process1024(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        process<FFTParameters<1024>::config>(context, params, task_param, input, output);
+    }
+
+#if !defined(GPU_AUDIO_MAC)
+    template <class TContext>
+    __device_fct void process2048(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        process<FFTParameters<2048>::config>(context, params, task_param, input, output);
+    }
+
+    template <class TContext>
+    __device_fct void process4096(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        process<FFTParameters<4096>::config>(context, params, task_param, input, output);
+    }
+#endif
+
+    // time-domain convolution for short filters (see DIRECT_FORM_MAX_FILTER_LENGTH in Properties.h).
+    // launched with DIRECT_FORM_THREAD_COUNT threads per block, each thread computes every blockDim-th output sample.
+    template <class TContext>
+    __device_fct void processDirect(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        const int channel = context.blockId();
+        __device_addr float* history = params->history + params->history_length * channel;
+        if (params->filter_length_to_translate_init && context.call() == 0) [[unlikely]] {
+            for (int i = context.threadId(); i < params->history_length; i += context.blockDim())
+                history[i] = 0;
+            context.synchronize();
+        }
+
+        int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+        int dataOffset = channel * params->input_length + context.call() * params->grain;
+        convolveDirect(context, input[0] + dataOffset, output[0] + dataOffset, params->channels[channel].real_filter, params->filter_length, history, processSamples);
+        delayOutput(context, params, output[0] + dataOffset, channel, processSamples);
+    }
+
+    // tap delay for sparse filters (see SPARSE_MAX_TAPS in Properties.h), launched with SPARSE_THREAD_COUNT threads per
+    // block. history keeps the last history_length input samples of each channel as a ring, every output sample only
+    // reads the input at the offsets of the taps.
+    template <class TContext>
+    __device_fct void processSparse(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        const int channel = context.blockId();
+        const int historyLength = params->history_length;
+        __device_addr float* history = params->history + historyLength * channel;
+        __device_addr fir::ChannelState* state = params->channel_states + channel;
+        if (params->filter_length_to_translate_init && context.call() == 0) [[unlikely]] {
+            for (int i = context.threadId(); i < historyLength; i += context.blockDim())
+                history[i] = 0;
+            if (context.threadId() == 0)
+                state->history_position = 0;
+            context.synchronize();
+        }
+
+        int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+        int dataOffset = channel * params->input_length + context.call() * params->grain;
+        const __device_addr T* channelInput = input[0] + dataOffset;
+        __device_addr T* channelOutput = output[0] + dataOffset;
+        const __device_addr fir::SparseTaps* taps = params->channels[channel].sparse_taps;
+
+        // the ring holds the input sample preceding the call by historyLength - k at (position + k) % historyLength
+        const int position = state->history_position;
+        for (int n = context.threadId(); n < processSamples; n += context.blockDim()) {
+            float acc = 0;
+            for (int t = 0; t < taps->count; ++t) {
+                const int k = n - taps->offsets[t];
+                acc += taps->gains[t] * (k >= 0 ? channelInput[k] : history[(position + historyLength + k) % historyLength]);
+            }
+            channelOutput[n] = acc;
+        }
+        context.synchronize();
+
+        if (historyLength != 0) {
+            for (int k = max(0, processSamples - historyLength) + context.threadId(); k < processSamples; k += context.blockDim())
+                history[(position + k) % historyLength] = channelInput[k];
+            if (context.threadId() == 0)
+                state->history_position = (position + processSamples) % historyLength;
+        }
+        delayOutput(context, params, channelOutput, channel, processSamples);
+    }
+
+    // stereo fast path for the uniform partitioned convolution (see STEREO_TASK_INDEX in Properties.h). a single block
+    // convolves both channels and transforms them together with one real FFT of twice the size, i.e., it is launched with
+    // FFT size / 2 threads.
+    template <class TContext>
+    __device_fct void processStereo256(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        processStereo<FFTParameters<256>::config, FFTParameters<512>::config>(context, params, task_param, input, output);
+    }
+
+    template <class TContext>
+    __device_fct void processStereo512(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        processStereo<FFTParameters<512>::config, FFTParameters<1024>::config>(context, params, task_param, input, output);
+    }
+
+#if !defined(GPU_AUDIO_MAC)
+    template <class TContext>
+    __device_fct void processStereo1024(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        processStereo<FFTParameters<1024>::config, FFTParameters<2048>::config>(context, params, task_param, input, output);
+    }
+
+    template <class TContext>
+    __device_fct void processStereo2048(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        processStereo<FFTParameters<2048>::config, FFTParameters<4096>::config>(context, params, task_param, input, output);
+    }
+#endif
+
+    // segment slices for long filters (see SLICE_TASK_INDEX in Properties.h). runs before the FFT task of the same
+    // size in every call with slice_count blocks per channel, each accumulating a contiguous slice of the head segments.
+    template <class TContext>
+    __device_fct void accumulateSlices256(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        accumulateSlices<FFTParameters<256>::config>(context, params);
+    }
+
+    template <class TContext>
+    __device_fct void accumulateSlices512(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        accumulateSlices<FFTParameters<512>::config>(context, params);
+    }
+
+    template <class TContext>
+    __device_fct void accumulateSlices1024(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        accumulateSlices<FFTParameters<1024>::config>(context, params);
+    }
+
+#if !defined(GPU_AUDIO_MAC)
+    template <class TContext>
+    __device_fct void accumulateSlices2048(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        accumulateSlices<FFTParameters<2048>::config>(context, params);
+    }
+
+    template <class TContext>
+    __device_fct void accumulateSlices4096(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        accumulateSlices<FFTParameters<4096>::config>(context, params);
+    }
+#endif
+
+    // block b accumulates slice b % slice_count of channel b / slice_count for the segment starting in this call. the
+    // segments 0 (new input) and 1 (possibly completed in this call) are left to the FFT task, so the slices only read
+    // complete segments of the delay line. only the active segments of the channel are accumulated. the grain never exceeds input_samples_per_iteration, i.e., at most one
+    // segment starts per call.
+    template <class TFft, class TContext>
+    __device_fct void accumulateSlices(TContext context, __device_addr fir::ProcessorParameter* params) __device_addr {
+        if (params->ir_spectrum_precision == SPECTRUM_FLOAT16) {
+            if (params->input_spectrum_precision == SPECTRUM_FLOAT16)
+                accumulateSlicesInternal<TFft, fir::Half2Spectrum, fir::Half2Spectrum>(context, params);
+            else
+                accumulateSlicesInternal<TFft, fir::Half2Spectrum, float2>(context, params);
+        }
+        else if (params->ir_spectrum_precision == SPECTRUM_BFLOAT16) {
+            if (params->input_spectrum_precision == SPECTRUM_BFLOAT16)
+                accumulateSlicesInternal<TFft, fir::BFloat2Spectrum, fir::BFloat2Spectrum>(context, params);
+            else
+                accumulateSlicesInternal<TFft, fir::BFloat2Spectrum, float2>(context, params);
+        }
+        else
+            accumulateSlicesInternal<TFft, float2, float2>(context, params);
+    }
+
+    template <class TFft, class TIrSpectrum, class TInputSpectrum, class TContext>
+    __device_fct void accumulateSlicesInternal(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params) __device_addr {
+        constexpr int SymSize = TFft::fft_length;
+        constexpr int BlockSize = TFft::fft_length_quarter;
+        const int sliceCount = params->slice_count;
+        const int channel = context.blockId() / sliceCount;
+        const int slice = context.blockId() % sliceCount;
+
+        ComplexAccumulator<SymSize, BlockSize> accumulator {};
+        // the FFT task clears the delay line in the first call after a filter change. the
+        // slices of an idle channel only cover silent segments (see processInternal) and stay zero
+        if (!(params->filter_length_to_translate_init && context.call() == 0) && params->channel_states[channel].idle == 0) {
+            const int segmentsCount = params->segments_count;
+            const int segmentZeroSamples = params->channel_states[channel].segment_zero_samples;
+            const int callSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+            if (callSamples <= 0 || (segmentZeroSamples != 0 && params->input_samples_per_iteration - segmentZeroSamples >= callSamples))
+                return;
+
+            // a running segment completes before the new one starts and moves the segment offset
+            int segmentOffset = params->channel_states[channel].segment_offset;
+            if (segmentZeroSamples != 0)
+                segmentOffset = (segmentOffset - 1 + segmentsCount) % segmentsCount;
+
+            // the slices split the active segments from 2 on evenly
+            const __device_addr int* activeSegments = params->channels[channel].active_segments;
+            const int activeCount = params->channels[channel].active_segment_count;
+            const int firstActive = (activeCount > 0 && activeSegments[0] == 1) ? 1 : 0;
+            const int perSlice = (activeCount - firstActive + sliceCount - 1) / sliceCount;
+            const int first = firstActive + slice * perSlice;
+            const int last = min(activeCount, first + perSlice);
+            const __device_addr TInputSpectrum* fourierInputSegments = inputSpectra<TInputSpectrum>(params) + params->spectrum_length * channel;
+            const __device_addr TIrSpectrum* fourierImpulseResponseSegments = filterSpectra<TIrSpectrum>(params, channel);
+            for (int n = first; n < last; ++n) {
+                const int i = activeSegments[n];
+                accumulator.multiplyAddFourierSym(context, fourierInputSegments + ((segmentOffset + i) % segmentsCount) * SymSize, fourierImpulseResponseSegments + i * SymSize);
+            }
+        }
+        accumulator.store(context, params->slice_spectra + (channel * sliceCount + slice) * SymSize);
+    }
+
+    template <class TFft, class TStereoFft, class TContext>
+    __device_fct void processStereo(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
         if (params->filter_length_to_translate_init && context.call() == 0) [[unlikely]] {
-            init(context, params);
+            initStereo(context, params);
         }
 
+        // both channels share the segment state, the state of channel 0 is used
         int cursor;
-        if (_segmentZeroSamples[context.blockId()] != 0) {
-            int processSamples = min(params->input_length - (int)context.call() * params->grain, min(params->grain, params->input_samples_per_iteration - _segmentZeroSamples[context.blockId()]));
-            int dataOffset = context.blockId() * params->input_length + context.call() * params->grain;
-            processInternal(context, input[0] + dataOffset, output[0] + dataOffset,
-                params->fourier_input_segments + params->segments_count * SymSize * context.blockId(),
-                params->overlap + params->overlap_length * context.blockId(),
-                params->fourier_impulse_response_segments[context.blockId()], processSamples, context.blockId(),
-                params->segments_count, params->input_samples_per_iteration, params->overlap_length);
+        if (params->channel_states[0].segment_zero_samples != 0) {
+            int processSamples = min(params->input_length - (int)context.call() * params->grain, min(params->grain, params->input_samples_per_iteration - params->channel_states[0].segment_zero_samples));
+            int dataOffset = context.call() * params->grain;
+            processStereoInternal<TFft, TStereoFft>(context, params, input[0] + dataOffset, output[0] + dataOffset, processSamples);
             cursor = processSamples;
         }
         else
@@ -107,32 +308,131 @@ public:
 
         for (; cursor < params->grain; cursor += params->input_samples_per_iteration) {
             int processSamples = min(min(params->input_length - (int)context.call() * params->grain, params->grain) - cursor, params->input_samples_per_iteration);
-            int dataOffset = context.blockId() * params->input_length + cursor + context.call() * params->grain;
-            processInternal(context, input[0] + dataOffset, output[0] + dataOffset,
-                params->fourier_input_segments + params->segments_count * SymSize * context.blockId(),
-                params->overlap + params->overlap_length * context.blockId(),
-                params->fourier_impulse_response_segments[context.blockId()], processSamples, context.blockId(),
-                params->segments_count, params->input_samples_per_iteration, params->overlap_length);
+            int dataOffset = cursor + context.call() * params->grain;
+            processStereoInternal<TFft, TStereoFft>(context, params, input[0] + dataOffset, output[0] + dataOffset, processSamples);
         }
+
+        int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+        int dataOffset = context.call() * params->grain;
+        for (int channel = 0; channel < 2; ++channel)
+            delayOutput(context, params, output[0] + channel * params->input_length + dataOffset, channel, processSamples);
+    }
+
+    template <class TFft, class TContext>
+    __device_fct void process(TContext context, __device_addr fir::ProcessorParameter* params, __device_addr fir::TaskParameter* task_param, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        if (params->matrix_outputs != 0) {
+            processMatrix<TFft>(context, params, input, output);
+            return;
+        }
+
+        // the input spectra use fp32 or the storage format of the filter spectra (see SpectrumStorage.h)
+        if (params->ir_spectrum_precision == SPECTRUM_FLOAT16) {
+            if (params->input_spectrum_precision == SPECTRUM_FLOAT16)
+                processChannel<TFft, fir::Half2Spectrum, fir::Half2Spectrum>(context, params, input, output);
+            else
+                processChannel<TFft, fir::Half2Spectrum, float2>(context, params, input, output);
+        }
+        else if (params->ir_spectrum_precision == SPECTRUM_BFLOAT16) {
+            if (params->input_spectrum_precision == SPECTRUM_BFLOAT16)
+                processChannel<TFft, fir::BFloat2Spectrum, fir::BFloat2Spectrum>(context, params, input, output);
+            else
+                processChannel<TFft, fir::BFloat2Spectrum, float2>(context, params, input, output);
+        }
+        else
+            processChannel<TFft, float2, float2>(context, params, input, output);
     }
 
 private:
+    template <class TSpectrum>
+    __device_fct static __device_addr TSpectrum* inputSpectra(__device_addr fir::ProcessorParameter* params) {
+        return reinterpret_cast<__device_addr TSpectrum*>(params->fourier_input_segments);
+    }
+
+    template <class TSpectrum>
+    __device_fct static __device_addr TSpectrum* filterSpectra(__device_addr fir::ProcessorParameter* params, int path) {
+        return reinterpret_cast<__device_addr TSpectrum*>(const_cast<__device_addr float2*>(params->channels[path].fourier_impulse_response_segments));
+    }
+
+    template <class TFft, class TIrSpectrum, class TInputSpectrum, class TContext>
+    __device_fct void processChannel(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        if (params->filter_length_to_translate_init && context.call() == 0) [[unlikely]] {
+            init<TInputSpectrum>(context, params);
+        }
+
+        if (params->segments_count == 0) {
+            // hybrid plan: the leading filter samples are convolved in the time domain, the tail stages add the rest
+            int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+            int dataOffset = context.blockId() * params->input_length + context.call() * params->grain;
+            convolveDirect(context, input[0] + dataOffset, output[0] + dataOffset, params->channels[context.blockId()].real_filter, params->filter_length,
+                params->history + params->history_length * context.blockId(), processSamples);
+        }
+        else {
+            int cursor;
+            if (params->channel_states[context.blockId()].segment_zero_samples != 0) {
+                int processSamples = min(params->input_length - (int)context.call() * params->grain, min(params->grain, params->input_samples_per_iteration - params->channel_states[context.blockId()].segment_zero_samples));
+                int dataOffset = context.blockId() * params->input_length + context.call() * params->grain;
+                processInternal<TFft>(context, input[0] + dataOffset, output[0] + dataOffset,
+                    inputSpectra<TInputSpectrum>(params) + params->spectrum_length * context.blockId(),
+                    params->overlap + params->overlap_length * context.blockId(),
+                    filterSpectra<TIrSpectrum>(params, context.blockId()), processSamples, params->channel_states + context.blockId(),
+                    params->segments_count, params->input_samples_per_iteration, params->overlap_length,
+                    params->slice_spectra + params->slice_count * TFft::fft_length * context.blockId(), params->slice_count,
+                    params->channels[context.blockId()].active_segments, params->channels[context.blockId()].active_segment_count);
+                cursor = processSamples;
+            }
+            else
+                cursor = 0;
+
+            for (; cursor < params->grain; cursor += params->input_samples_per_iteration) {
+                int processSamples = min(min(params->input_length - (int)context.call() * params->grain, params->grain) - cursor, params->input_samples_per_iteration);
+                int dataOffset = context.blockId() * params->input_length + cursor + context.call() * params->grain;
+                processInternal<TFft>(context, input[0] + dataOffset, output[0] + dataOffset,
+                    inputSpectra<TInputSpectrum>(params) + params->spectrum_length * context.blockId(),
+                    params->overlap + params->overlap_length * context.blockId(),
+                    filterSpectra<TIrSpectrum>(params, context.blockId()), processSamples, params->channel_states + context.blockId(),
+                    params->segments_count, params->input_samples_per_iteration, params->overlap_length,
+                    params->slice_spectra + params->slice_count * TFft::fft_length * context.blockId(), params->slice_count,
+                    params->channels[context.blockId()].active_segments, params->channels[context.blockId()].active_segment_count);
+            }
+        }
+
+        if (params->tail_stage_count != 0) {
+            int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+            int dataOffset = context.blockId() * params->input_length + context.call() * params->grain;
+            processTail<TFft, TIrSpectrum, TInputSpectrum>(context, params, input[0] + dataOffset, output[0] + dataOffset, processSamples, context.blockId());
+        }
+
+        int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+        int dataOffset = context.blockId() * params->input_length + context.call() * params->grain;
+        delayOutput(context, params, output[0] + dataOffset, context.blockId(), processSamples);
+    }
+
     ////////////////////////////////////////////////////////
 
+    // accumulates Length complex bins in registers, BlockSize threads hold Length / BlockSize bins each
+    template <int Length, int BlockSize>
     class ComplexAccumulator {
-        float2 _v[4] = {{0, 0}, {0, 0}, {0, 0}, {0, 0}};
+        static __program_scope constexpr int Count = Length / BlockSize;
+
+        float2 _v[Count];
         __device_fct __forceinline_fct float2 mul(const __thread_addr float2& a, const __thread_addr float2& b) __thread_addr {
             return make_float2(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
         }
 
     public:
-        template <class TContext>
-        __device_fct void multiplyAddFourierSym(__thread_addr TContext& context, const __threadgroup_addr float2* a, const __device_addr float2* b) __thread_addr {
+        __device_fct ComplexAccumulator() __thread_addr {
 #pragma unroll
-            for (int i = 0; i < 4; ++i) {
-                int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
+            for (int i = 0; i < Count; ++i)
+                _v[i] = make_float2(0, 0);
+        }
+
+        template <class TContext, class TSpectrum>
+        __device_fct void multiplyAddFourierSym(__thread_addr TContext& context, const __threadgroup_addr float2* a, const __device_addr TSpectrum* b) __thread_addr {
+#pragma unroll
+            for (int i = 0; i < Count; ++i) {
+                int idx = i * BlockSize + context.threadId();
                 float2 ai = a[idx];
-                float2 bi = b[idx];
+                float2 bi = fir::SpectrumStorage<TSpectrum>::load(b[idx]);
                 float2 res = mul(ai, bi);
 
                 if (i == 0)
@@ -142,14 +442,14 @@ private:
                 _v[i].y += res.y;
             }
         }
-#if defined(__METAL_DEVICE_COMPILE__)
-        template <class TContext>
-        __device_fct void multiplyAddFourierSym(__thread_addr TContext& context, const __device_addr float2* a, const __device_addr float2* b) __thread_addr {
+        // spectra in device memory, e.g., the input segments
+        template <class TContext, class TInput, class TSpectrum>
+        __device_fct void multiplyAddFourierSym(__thread_addr TContext& context, const __device_addr TInput* a, const __device_addr TSpectrum* b) __thread_addr {
 #pragma unroll
-            for (int i = 0; i < 4; ++i) {
-                int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
-                float2 ai = a[idx];
-                float2 bi = b[idx];
+            for (int i = 0; i < Count; ++i) {
+                int idx = i * BlockSize + context.threadId();
+                float2 ai = fir::SpectrumStorage<TInput>::load(a[idx]);
+                float2 bi = fir::SpectrumStorage<TSpectrum>::load(b[idx]);
                 float2 res = mul(ai, bi);
 
                 if (i == 0)
@@ -159,13 +459,32 @@ private:
                 _v[i].y += res.y;
             }
         }
-#endif
+
+        template <class TContext>
+        __device_fct void add(__thread_addr TContext& context, const __device_addr float2* a) __thread_addr {
+#pragma unroll
+            for (int i = 0; i < Count; ++i) {
+                int idx = i * BlockSize + context.threadId();
+                float2 ai = a[idx];
+                _v[i].x += ai.x;
+                _v[i].y += ai.y;
+            }
+        }
+
+        template <class TContext>
+        __device_fct void store(__thread_addr TContext& context, __device_addr float2* a) __thread_addr {
+#pragma unroll
+            for (int i = 0; i < Count; ++i) {
+                int idx = i * BlockSize + context.threadId();
+                a[idx] = _v[i];
+            }
+        }
 
         template <class TContext>
         __device_fct void expandToShared(__thread_addr TContext& context, __threadgroup_addr float2* s_input) __thread_addr {
 #pragma unroll
-            for (int i = 0; i < 4; ++i) {
-                int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
+            for (int i = 0; i < Count; ++i) {
+                int idx = i * BlockSize + context.threadId();
                 s_input[idx] = _v[i];
             }
         }
@@ -174,16 +493,17 @@ private:
     __device_fct static float2 checkedLoad(const __device_addr T* input, int id, int length, int offset = 0) {
         if (id >= offset && id < offset + length - 1)
             return make_float2(input[id - offset], input[id - offset + 1]);
-        else
-            return make_float2(0, 0);
+        // odd lengths or offsets leave a single sample in the pair
+        return make_float2(id >= offset && id < offset + length ? input[id - offset] : 0,
+            id + 1 >= offset && id + 1 < offset + length ? input[id + 1 - offset] : 0);
     }
 
-    template <class TContext>
+    template <class TFft, class TContext>
     __device_fct static __threadgroup_addr float2* loadInputToSharedChecked(__thread_addr TContext& context, const __device_addr T* input, int length, int offset = 0) {
         __threadgroup_addr float2* s_input = context.template smem_offset<float2>(0);
 #pragma unroll
         for (int i = 0; i < 4; ++i) {
-            int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
+            int idx = i * TFft::fft_length_quarter + context.threadId();
             s_input[idx] = checkedLoad(input, idx * 2, length, offset);
         }
         return s_input;
@@ -191,26 +511,120 @@ private:
 
     ////////////////////////////////////////////////////////
 
+    // output[n] = sum_k filter[k] * input[n - k], the filterLength - 1 samples preceding input are read from history,
+    // which is updated with the last filterLength - 1 samples of input afterwards.
+    // requires (2 * filterLength + inputSize) floats of shared memory
     template <class TContext>
-    __device_fct void processInternal(__thread_addr TContext& context, const __device_addr T* input, __device_addr T* output, __device_addr float2* fourierInputSegments,
-        __device_addr T* overlap, const __device_addr float2* fourierImpulseResponseSegments, int inputSize, int channel,
-        int segmentsCount, int inputSamplesPerIteration, int overlapLength) __device_addr {
-        static_assert(FftParameters::config::fft_length >= 128, "Only Supporting for now");
+    __device_fct static void convolveDirect(__thread_addr TContext& context, const __device_addr T* input, __device_addr T* output, const __device_addr float* filter,
+        int filterLength, __device_addr float* history, int inputSize) {
+        const int historyLength = filterLength - 1;
+        __threadgroup_addr float* s_filter = context.template smem_offset<float>(0);
+        __threadgroup_addr float* s_signal = s_filter + filterLength;
+
+        for (int i = context.threadId(); i < filterLength; i += context.blockDim())
+            s_filter[i] = filter[i];
+        for (int i = context.threadId(); i < historyLength; i += context.blockDim())
+            s_signal[i] = history[i];
+        for (int i = context.threadId(); i < inputSize; i += context.blockDim())
+            s_signal[historyLength + i] = input[i];
+        context.synchronize();
+
+        // neighboring threads read neighboring samples, the filter tap is the same for all threads
+        for (int n = context.threadId(); n < inputSize; n += context.blockDim()) {
+            const __threadgroup_addr float* x = s_signal + historyLength + n;
+            float acc = 0;
+            for (int k = 0; k < filterLength; ++k)
+                acc += s_filter[k] * x[-k];
+            output[n] = acc;
+        }
+
+        for (int i = context.threadId(); i < historyLength; i += context.blockDim())
+            history[i] = s_signal[inputSize + i];
+        context.synchronize();
+    }
+
+    // delays the `samples` output samples of a channel by output_delay samples, which restores the leading zeros trimmed
+    // from the filter. the ring is exchanged in chunks of at most output_delay samples, so no slot is touched twice
+    // between two barriers. the ring is cleared whenever the filter changes.
+    template <class TContext>
+    __device_fct static void delayOutput(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, __device_addr T* output, int channel, int samples) {
+        const int delay = params->output_delay;
+        if (delay == 0)
+            return;
+        __device_addr float* delayLine = params->output_delay_line + delay * channel;
+        __device_addr fir::ChannelState* state = params->channel_states + channel;
+        if (params->filter_length_to_translate_init && context.call() == 0) [[unlikely]] {
+            for (int i = context.threadId(); i < delay; i += context.blockDim())
+                delayLine[i] = 0;
+            if (context.threadId() == 0)
+                state->delay_position = 0;
+        }
+        context.synchronize();
+
+        const int position = state->delay_position;
+        for (int start = 0; start < samples; start += delay) {
+            for (int i = start + context.threadId(); i < min(samples, start + delay); i += context.blockDim()) {
+                const int slot = (position + i) % delay;
+                const float value = output[i];
+                output[i] = delayLine[slot];
+                delayLine[slot] = value;
+            }
+            context.synchronize();
+        }
+        if (context.threadId() == 0)
+            state->delay_position = (position + samples) % delay;
+    }
+
+    template <class TFft, class TContext, class TIrSpectrum, class TInputSpectrum>
+    __device_fct void processInternal(__thread_addr TContext& context, const __device_addr T* input, __device_addr T* output, __device_addr TInputSpectrum* fourierInputSegments,
+        __device_addr T* overlap, const __device_addr TIrSpectrum* fourierImpulseResponseSegments, int inputSize, __device_addr fir::ChannelState* state,
+        int segmentsCount, int inputSamplesPerIteration, int overlapLength, const __device_addr float2* sliceSpectra, int sliceCount,
+        const __device_addr int* activeSegments, int activeSegmentCount) __device_addr {
+        constexpr int SymSize = TFft::fft_length;
+        constexpr int BlockSize = TFft::fft_length_quarter;
+        static_assert(SymSize >= 128, "Only Supporting for now");
 
         // fft of new segment to shared
-        __threadgroup_addr float2* s_input = loadInputToSharedChecked(context, input, inputSize, _segmentZeroSamples[channel]);
+        __threadgroup_addr float2* s_input = loadInputToSharedChecked<TFft>(context, input, inputSize, state->segment_zero_samples);
         context.synchronize();
 
-        dsp::FftCalculator<float>::template processR2C<FftParameters::config::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+        // silence detection: threads only ever set the flag of the running segment, which is reset when it completes
+#pragma unroll
+        for (int i = 0; i < 4; ++i) {
+            const float2 pair = s_input[i * TFft::fft_length_quarter + context.threadId()];
+            if (pair.x * pair.x + pair.y * pair.y > SILENCE_ENERGY_THRESHOLD)
+                state->segment_active = 1;
+        }
         context.synchronize();
 
-        ComplexAccumulator accumulator {};
-        if (_segmentZeroSamples[channel] == 0) {
-            for (int i = 1; i < segmentsCount; ++i)
-                accumulator.multiplyAddFourierSym(context, fourierInputSegments + ((_segmentOffset[channel] + i) % segmentsCount) * SymSize, fourierImpulseResponseSegments + i * SymSize);
+        if (state->segment_active == 0 && state->silent_segments >= segmentsCount - 1) {
+            // the running segment and all older segments of the delay line are silent
+            skipSilentSegment<TFft>(context, output, fourierInputSegments, overlap, inputSize, state, segmentsCount, inputSamplesPerIteration, overlapLength);
+            return;
+        }
+
+        dsp::FftCalculator<float>::template processR2C<TFft::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+        context.synchronize();
+
+        ComplexAccumulator<SymSize, BlockSize> accumulator {};
+        if (state->segment_zero_samples == 0) {
+            if (sliceCount != 0) {
+                // segments from 2 on have been accumulated by the slice task (see accumulateSlices)
+                if (activeSegmentCount > 0 && activeSegments[0] == 1)
+                    accumulator.multiplyAddFourierSym(context, fourierInputSegments + ((state->segment_offset + 1) % segmentsCount) * SymSize, fourierImpulseResponseSegments + SymSize);
+                for (int slice = 0; slice < sliceCount; ++slice)
+                    accumulator.add(context, sliceSpectra + slice * SymSize);
+            }
+            else {
+                // silent segments of the filter are skipped (see ChannelDescriptor::active_segments)
+                for (int n = 0; n < activeSegmentCount; ++n) {
+                    const int i = activeSegments[n];
+                    accumulator.multiplyAddFourierSym(context, fourierInputSegments + ((state->segment_offset + i) % segmentsCount) * SymSize, fourierImpulseResponseSegments + i * SymSize);
+                }
+            }
             context.synchronize();
 
-            ComplexAccumulator tempAccumulator = accumulator;
+            ComplexAccumulator<SymSize, BlockSize> tempAccumulator = accumulator;
             // add the new segment
             accumulator.multiplyAddFourierSym(context, s_input, fourierImpulseResponseSegments);
             context.synchronize();
@@ -219,8 +633,8 @@ private:
                 // write the fourier transformed input segment to memory
 #pragma unroll
                 for (int i = 0; i < 4; ++i) {
-                    int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
-                    fourierInputSegments[idx + _segmentOffset[channel] * SymSize] = s_input[idx];
+                    int idx = i * TFft::fft_length_quarter + context.threadId();
+                    fourierInputSegments[idx + state->segment_offset * SymSize] = fir::SpectrumStorage<TInputSpectrum>::store(s_input[idx]);
                 }
             }
             context.synchronize();
@@ -233,7 +647,7 @@ private:
                 context.synchronize();
 
                 // backward FFT
-                dsp::FftCalculator<float>::template processC2R<FftParameters::config::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+                dsp::FftCalculator<float>::template processC2R<TFft::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
                 context.synchronize();
 
                 // store the filter overlap for this segment
@@ -247,12 +661,13 @@ private:
             // add the fourier transformed input segment to memory
 #pragma unroll
             for (int i = 0; i < 4; ++i) {
-                int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
-                __device_addr float2& aStorage = fourierInputSegments[idx + _segmentOffset[channel] * SymSize];
+                int idx = i * TFft::fft_length_quarter + context.threadId();
+                __device_addr TInputSpectrum& aStorage = fourierInputSegments[idx + state->segment_offset * SymSize];
                 __threadgroup_addr float2& aLocal = s_input[idx];
-                float2 a = aStorage;
+                float2 a = fir::SpectrumStorage<TInputSpectrum>::load(aStorage);
                 float2 aL = aLocal;
-                aStorage = aLocal = make_float2(a.x + aL.x, a.y + aL.y);
+                aLocal = make_float2(a.x + aL.x, a.y + aL.y);
+                aStorage = fir::SpectrumStorage<TInputSpectrum>::store(aLocal);
             }
             context.synchronize();
 
@@ -262,20 +677,20 @@ private:
         }
 
         // new first segment is second last segments
-        if (context.threadId() == 0 && _segmentZeroSamples[channel] + inputSize == inputSamplesPerIteration)
-            _segmentOffset[channel] = (_segmentOffset[channel] - 1 + segmentsCount) % segmentsCount;
+        if (context.threadId() == 0 && state->segment_zero_samples + inputSize == inputSamplesPerIteration)
+            state->segment_offset = (state->segment_offset - 1 + segmentsCount) % segmentsCount;
 
         // convert from symmetric only part
         accumulator.expandToShared(context, s_input);
         context.synchronize();
 
         // backward FFT
-        dsp::FftCalculator<float>::template processC2R<FftParameters::config::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+        dsp::FftCalculator<float>::template processC2R<TFft::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
         context.synchronize();
 
         // write result out
         for (int i = context.threadId(); i < inputSize; i += BlockSize) {
-            int relative = _segmentZeroSamples[channel] + i;
+            int relative = state->segment_zero_samples + i;
             T overlapValue = 0;
             if (relative < overlapLength)
                 overlapValue = overlap[relative];
@@ -284,7 +699,7 @@ private:
         context.synchronize();
 
         // store the new overlap (potentially combine with leftover overlap)
-        if (_segmentZeroSamples[channel] + inputSize == inputSamplesPerIteration) {
+        if (state->segment_zero_samples + inputSize == inputSamplesPerIteration) {
             for (int i = 0; i < overlapLength; i += BlockSize) {
                 T accValue = 0;
                 if (i + inputSamplesPerIteration < overlapLength) {
@@ -295,7 +710,7 @@ private:
                 }
                 int resultId = i + inputSamplesPerIteration + context.threadId();
                 int outId = i + context.threadId();
-                if (resultId < 2 * FftParameters::config::fft_length)
+                if (resultId < 2 * TFft::fft_length)
                     accValue += ((__threadgroup_addr float*)s_input)[resultId];
 
                 if (outId < overlapLength)
@@ -304,43 +719,714 @@ private:
         }
         context.synchronize();
 
-        if (context.threadId() == 0)
-            _segmentZeroSamples[channel] = (_segmentZeroSamples[channel] + inputSize) % inputSamplesPerIteration;
+        if (context.threadId() == 0) {
+            if (state->segment_zero_samples + inputSize == inputSamplesPerIteration) {
+                state->silent_segments = state->segment_active ? 0 : min(state->silent_segments + 1, segmentsCount);
+                state->segment_active = 0;
+            }
+            state->idle = 0;
+            state->segment_zero_samples = (state->segment_zero_samples + inputSize) % inputSamplesPerIteration;
+        }
         context.synchronize();
     }
 
-    template <class TContext>
+    // processInternal for a silent input chunk while the delay line only holds silent segments: the spectrum of the
+    // chunk and the accumulated segments are zero, so the output is the remaining overlap and the FFTs are skipped.
+    // the segment is stored as a zero spectrum so processing resumes with a consistent delay line.
+    template <class TFft, class TContext, class TInputSpectrum>
+    __device_fct static void skipSilentSegment(__thread_addr TContext& context, __device_addr T* output, __device_addr TInputSpectrum* fourierInputSegments,
+        __device_addr T* overlap, int inputSize, __device_addr fir::ChannelState* state, int segmentsCount, int inputSamplesPerIteration, int overlapLength) {
+        constexpr int SymSize = TFft::fft_length;
+        constexpr int BlockSize = TFft::fft_length_quarter;
+        const bool segmentCompletes = state->segment_zero_samples + inputSize == inputSamplesPerIteration;
+
+        if (state->segment_zero_samples == 0 && (segmentsCount > 1 || inputSize != inputSamplesPerIteration)) {
+#pragma unroll
+            for (int i = 0; i < 4; ++i) {
+                int idx = i * TFft::fft_length_quarter + context.threadId();
+                fourierInputSegments[idx + state->segment_offset * SymSize] = fir::SpectrumStorage<TInputSpectrum>::store(make_float2(0, 0));
+            }
+        }
+
+        drainOverlap<BlockSize>(context, output, overlap, inputSize, state->segment_zero_samples, inputSamplesPerIteration, overlapLength);
+
+        if (context.threadId() == 0) {
+            if (segmentCompletes) {
+                state->segment_offset = (state->segment_offset - 1 + segmentsCount) % segmentsCount;
+                state->silent_segments = min(state->silent_segments + 1, segmentsCount);
+            }
+            state->idle = 1;
+            state->segment_zero_samples = (state->segment_zero_samples + inputSize) % inputSamplesPerIteration;
+        }
+        context.synchronize();
+    }
+
+    // output of a chunk while the new segment and the delay line are silent: the remaining overlap, which is shifted by
+    // one segment once the segment completes
+    template <int BlockSize, class TContext>
+    __device_fct static void drainOverlap(__thread_addr TContext& context, __device_addr T* output, __device_addr T* overlap, int inputSize, int segmentZeroSamples,
+        int inputSamplesPerIteration, int overlapLength) {
+        for (int i = context.threadId(); i < inputSize; i += BlockSize) {
+            int relative = segmentZeroSamples + i;
+            output[i] = relative < overlapLength ? overlap[relative] : 0;
+        }
+        context.synchronize();
+
+        if (segmentZeroSamples + inputSize == inputSamplesPerIteration) {
+            // shift the overlap by one segment
+            for (int i = 0; i < overlapLength; i += BlockSize) {
+                T accValue = 0;
+                int prevOverlapId = i + inputSamplesPerIteration + context.threadId();
+                if (prevOverlapId < overlapLength)
+                    accValue = overlap[prevOverlapId];
+                context.synchronize();
+                if (i + context.threadId() < overlapLength)
+                    overlap[i + context.threadId()] = accValue;
+            }
+        }
+        context.synchronize();
+    }
+
+    // sets `active` if a sample of the chunk exceeds the silence threshold, threads only ever set the flag
+    template <int BlockSize, class TContext>
+    __device_fct static void detectSignal(__thread_addr TContext& context, const __device_addr T* input, int inputSize, __device_addr int* active) {
+        for (int i = context.threadId(); i < inputSize; i += BlockSize)
+            if (input[i] * input[i] > SILENCE_ENERGY_THRESHOLD)
+                *active = 1;
+    }
+
+    // the filter spectra are built on the host (see SpectrumBuilder.h), a filter change only resets the channel state
+    // and clears the delay lines and histories
+    template <class TInputSpectrum, class TContext>
     __device_fct void init(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params) __device_addr {
-        // initFilter
-        __device_addr float2* pResponseSegments = const_cast<__device_addr float2*>(params->fourier_impulse_response_segments[context.blockId()]);
+        if (context.threadId() == 0) {
+            params->channel_states[context.blockId()].segment_zero_samples = (params->init_buffer_offset) % params->input_samples_per_iteration;
+            params->channel_states[context.blockId()].segment_offset = 0;
+            params->channel_states[context.blockId()].tail_position = 0;
+            params->channel_states[context.blockId()].segment_active = 0;
+            params->channel_states[context.blockId()].silent_segments = 0;
+            params->channel_states[context.blockId()].idle = 0;
+            params->channel_states[context.blockId()].tail_block_active = 0;
+            for (int stage = 0; stage < MAX_TAIL_STAGES; ++stage) {
+                params->channel_states[context.blockId()].tail_segment_offset[stage] = 0;
+                params->channel_states[context.blockId()].tail_silent_blocks[stage] = 0;
+            }
+        }
+
+        // initSignalSegments
+        for (int i = context.threadId(); i < params->spectrum_length; i += context.blockDim())
+            inputSpectra<TInputSpectrum>(params)[params->spectrum_length * context.blockId() + i] = fir::SpectrumStorage<TInputSpectrum>::store(make_float2(0, 0));
+        for (int i = context.threadId(); i < params->overlap_length; i += context.blockDim())
+            params->overlap[params->overlap_length * context.blockId() + i] = 0;
+        for (int i = context.threadId(); i < params->tail_history_length; i += context.blockDim())
+            params->tail_history[params->tail_history_length * context.blockId() + i] = 0;
+        for (int i = context.threadId(); i < params->tail_output_length; i += context.blockDim())
+            params->tail_output[params->tail_output_length * context.blockId() + i] = 0;
+        for (int i = context.threadId(); i < params->history_length; i += context.blockDim())
+            params->history[params->history_length * context.blockId() + i] = 0;
+        context.synchronize();
+    }
+
+    ////////////////////////////////////////////////////////
+    // stereo fast path
+    //
+    // The two channels x and y are interleaved, z[2n] = x[n] and z[2n + 1] = y[n], and transformed with a single real FFT
+    // of twice the size. With W = exp(-i pi / (2 * SymSize)) the spectrum is Z[k] = X[k] + W^k Y[k], and as x and y are
+    // real, conj(Z[2 * SymSize - k]) = X[k] - W^k Y[k]. This separates X and Y after the forward transform and combines
+    // the accumulated spectra again before the backward transform.
+
+    template <class TStereoFft, class TContext>
+    __device_fct static __threadgroup_addr float2* loadStereoInputToSharedChecked(__thread_addr TContext& context, const __device_addr T* input0, const __device_addr T* input1,
+        int length, int offset = 0) {
+        __threadgroup_addr float2* s_input = context.template smem_offset<float2>(0);
+#pragma unroll
+        for (int i = 0; i < 4; ++i) {
+            int idx = i * TStereoFft::fft_length_quarter + context.threadId();
+            bool valid = idx >= offset && idx < offset + length;
+            s_input[idx] = make_float2(valid ? input0[idx - offset] : 0, valid ? input1[idx - offset] : 0);
+        }
+        return s_input;
+    }
+
+    // Z (2 * SymSize packed bins) -> X (bins [0, SymSize)) and Y (bins [SymSize, 2 * SymSize)), packed like the spectra of processR2C
+    template <int SymSize, int BlockSize, class TContext>
+    __device_fct static void separateStereoSpectra(__thread_addr TContext& context, __threadgroup_addr float2* s_input) {
+        constexpr int Count = SymSize / BlockSize;
+        float2 x[Count];
+        float2 y[Count];
+#pragma unroll
+        for (int i = 0; i < Count; ++i) {
+            int k = i * BlockSize + context.threadId();
+            float2 a = s_input[k];
+            if (k == 0) {
+                // (Z[0], Z[2 * SymSize]) hold (X[0] + Y[0], X[0] - Y[0]), Z[SymSize] = X[SymSize] - i Y[SymSize]
+                float2 b = s_input[SymSize];
+                x[i] = make_float2(0.5f * (a.x + a.y), b.x);
+                y[i] = make_float2(0.5f * (a.x - a.y), -b.y);
+            }
+            else {
+                float2 b = s_input[2 * SymSize - k];
+                float2 d = make_float2(0.5f * (a.x - b.x), 0.5f * (a.y + b.y));
+                float angle = 3.14159265358979f * k / (2 * SymSize);
+                float c = cos(angle);
+                float s = sin(angle);
+                x[i] = make_float2(0.5f * (a.x + b.x), 0.5f * (a.y - b.y));
+                y[i] = make_float2(d.x * c - d.y * s, d.x * s + d.y * c);
+            }
+        }
+        context.synchronize();
+#pragma unroll
+        for (int i = 0; i < Count; ++i) {
+            int k = i * BlockSize + context.threadId();
+            s_input[k] = x[i];
+            s_input[SymSize + k] = y[i];
+        }
+        context.synchronize();
+    }
+
+    // inverse of separateStereoSpectra
+    template <int SymSize, int BlockSize, class TContext>
+    __device_fct static void combineStereoSpectra(__thread_addr TContext& context, __threadgroup_addr float2* s_input) {
+        constexpr int Count = SymSize / BlockSize;
+        float2 z[Count];
+        float2 zMirror[Count];
+#pragma unroll
+        for (int i = 0; i < Count; ++i) {
+            int k = i * BlockSize + context.threadId();
+            float2 x = s_input[k];
+            float2 y = s_input[SymSize + k];
+            if (k == 0) {
+                z[i] = make_float2(x.x + y.x, x.x - y.x);
+                zMirror[i] = make_float2(x.y, -y.y);
+            }
+            else {
+                float angle = 3.14159265358979f * k / (2 * SymSize);
+                float c = cos(angle);
+                float s = sin(angle);
+                float2 wy = make_float2(y.x * c + y.y * s, y.y * c - y.x * s);
+                z[i] = make_float2(x.x + wy.x, x.y + wy.y);
+                zMirror[i] = make_float2(x.x - wy.x, wy.y - x.y);
+            }
+        }
+        context.synchronize();
+#pragma unroll
+        for (int i = 0; i < Count; ++i) {
+            int k = i * BlockSize + context.threadId();
+            s_input[k] = z[i];
+            s_input[k == 0 ? SymSize : 2 * SymSize - k] = zMirror[i];
+        }
+        context.synchronize();
+    }
+
+    template <class TFft, class TStereoFft, class TContext>
+    __device_fct void processStereoInternal(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, const __device_addr T* input, __device_addr T* output,
+        int inputSize) __device_addr {
+        constexpr int SymSize = TFft::fft_length;
+        constexpr int BlockSize = TStereoFft::fft_length_quarter;
+        const int segmentsCount = params->segments_count;
+        const int inputSamplesPerIteration = params->input_samples_per_iteration;
+        const int overlapLength = params->overlap_length;
+        const int segmentZeroSamples = params->channel_states[0].segment_zero_samples;
+        const int segmentOffset = params->channel_states[0].segment_offset;
+        __device_addr float2* fourierInputSegments[2] = {params->fourier_input_segments, params->fourier_input_segments + params->spectrum_length};
+        __device_addr T* overlap[2] = {params->overlap, params->overlap + overlapLength};
+        __device_addr fir::ChannelState* state = params->channel_states;
+        const bool segmentCompletes = segmentZeroSamples + inputSize == inputSamplesPerIteration;
+
+        // silence detection of both channels, which share the segment state (see processInternal)
+        for (int channel = 0; channel < 2; ++channel)
+            detectSignal<BlockSize>(context, input + channel * params->input_length, inputSize, &state->segment_active);
+        context.synchronize();
+
+        if (state->segment_active == 0 && state->silent_segments >= segmentsCount - 1) {
+            // like skipSilentSegment for both channels
+            if (segmentZeroSamples == 0 && (segmentsCount > 1 || inputSize != inputSamplesPerIteration)) {
+                for (int channel = 0; channel < 2; ++channel)
+                    for (int i = context.threadId(); i < SymSize; i += BlockSize)
+                        fourierInputSegments[channel][i + segmentOffset * SymSize] = make_float2(0, 0);
+            }
+            for (int channel = 0; channel < 2; ++channel)
+                drainOverlap<BlockSize>(context, output + channel * params->input_length, overlap[channel], inputSize, segmentZeroSamples, inputSamplesPerIteration, overlapLength);
+
+            if (context.threadId() == 0) {
+                if (segmentCompletes) {
+                    state[0].segment_offset = state[1].segment_offset = (segmentOffset - 1 + segmentsCount) % segmentsCount;
+                    state->silent_segments = min(state->silent_segments + 1, segmentsCount);
+                }
+                state->idle = 1;
+                state[0].segment_zero_samples = state[1].segment_zero_samples = (segmentZeroSamples + inputSize) % inputSamplesPerIteration;
+            }
+            context.synchronize();
+            return;
+        }
+
+        // fft of the new segments of both channels to shared
+        __threadgroup_addr float2* s_input = loadStereoInputToSharedChecked<TStereoFft>(context, input, input + params->input_length, inputSize, segmentZeroSamples);
+        context.synchronize();
+
+        dsp::FftCalculator<float>::template processR2C<SymSize * 4>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+        context.synchronize();
+        separateStereoSpectra<SymSize, BlockSize>(context, s_input);
+
+        ComplexAccumulator<SymSize, BlockSize> accumulator[2];
+        ComplexAccumulator<SymSize, BlockSize> tempAccumulator[2];
+        for (int channel = 0; channel < 2; ++channel) {
+            const __device_addr float2* fourierImpulseResponseSegments = params->channels[channel].fourier_impulse_response_segments;
+            __threadgroup_addr float2* s_spectrum = s_input + channel * SymSize;
+            if (segmentZeroSamples == 0) {
+                for (int n = 0; n < params->channels[channel].active_segment_count; ++n) {
+                    const int i = params->channels[channel].active_segments[n];
+                    accumulator[channel].multiplyAddFourierSym(context, fourierInputSegments[channel] + ((segmentOffset + i) % segmentsCount) * SymSize, fourierImpulseResponseSegments + i * SymSize);
+                }
+                tempAccumulator[channel] = accumulator[channel];
+                // add the new segment
+                accumulator[channel].multiplyAddFourierSym(context, s_spectrum, fourierImpulseResponseSegments);
+
+                if (segmentsCount > 1 || inputSize != inputSamplesPerIteration) {
+                    // write the fourier transformed input segment to memory
+                    for (int i = context.threadId(); i < SymSize; i += BlockSize)
+                        fourierInputSegments[channel][i + segmentOffset * SymSize] = s_spectrum[i];
+                }
+            }
+            else {
+                // add the fourier transformed input segment to memory
+                for (int i = context.threadId(); i < SymSize; i += BlockSize) {
+                    __device_addr float2& aStorage = fourierInputSegments[channel][i + segmentOffset * SymSize];
+                    float2 a = aStorage;
+                    float2 aL = s_spectrum[i];
+                    aStorage = s_spectrum[i] = make_float2(a.x + aL.x, a.y + aL.y);
+                }
+                context.synchronize();
+
+                // add the new segment
+                accumulator[channel].multiplyAddFourierSym(context, s_spectrum, fourierImpulseResponseSegments);
+            }
+        }
+        context.synchronize();
+
+        if (segmentZeroSamples == 0 && segmentsCount > 1 && inputSize != inputSamplesPerIteration) {
+            // the combined filters up to this point need to be added to the overlap
+            tempAccumulator[0].expandToShared(context, s_input);
+            tempAccumulator[1].expandToShared(context, s_input + SymSize);
+            context.synchronize();
+            combineStereoSpectra<SymSize, BlockSize>(context, s_input);
+
+            // backward FFT
+            dsp::FftCalculator<float>::template processC2R<SymSize * 4>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+            context.synchronize();
+
+            // store the filter overlap for this segment
+            for (int i = context.threadId() + inputSize; i < overlapLength; i += BlockSize) {
+                overlap[0][i] += s_input[i].x;
+                overlap[1][i] += s_input[i].y;
+            }
+            context.synchronize();
+        }
+
+        // new first segment is second last segments
+        if (context.threadId() == 0 && segmentZeroSamples + inputSize == inputSamplesPerIteration)
+            params->channel_states[0].segment_offset = params->channel_states[1].segment_offset = (segmentOffset - 1 + segmentsCount) % segmentsCount;
 
+        // convert from symmetric only part
+        accumulator[0].expandToShared(context, s_input);
+        accumulator[1].expandToShared(context, s_input + SymSize);
+        context.synchronize();
+        combineStereoSpectra<SymSize, BlockSize>(context, s_input);
+
+        // backward FFT, the result holds the samples of both channels interleaved
+        dsp::FftCalculator<float>::template processC2R<SymSize * 4>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+        context.synchronize();
+
+        // write result out
+        for (int i = context.threadId(); i < inputSize; i += BlockSize) {
+            int relative = segmentZeroSamples + i;
+            float2 overlapValue = make_float2(0, 0);
+            if (relative < overlapLength)
+                overlapValue = make_float2(overlap[0][relative], overlap[1][relative]);
+            output[i] = s_input[relative].x + overlapValue.x;
+            output[params->input_length + i] = s_input[relative].y + overlapValue.y;
+        }
+        context.synchronize();
+
+        // store the new overlap (potentially combine with leftover overlap)
+        if (segmentZeroSamples + inputSize == inputSamplesPerIteration) {
+            for (int i = 0; i < overlapLength; i += BlockSize) {
+                float2 accValue = make_float2(0, 0);
+                if (i + inputSamplesPerIteration < overlapLength) {
+                    int prevOverlapId = i + inputSamplesPerIteration + context.threadId();
+                    if (prevOverlapId < overlapLength)
+                        accValue = make_float2(overlap[0][prevOverlapId], overlap[1][prevOverlapId]);
+                    context.synchronize();
+                }
+                int resultId = i + inputSamplesPerIteration + context.threadId();
+                int outId = i + context.threadId();
+                if (resultId < 2 * SymSize) {
+                    accValue.x += s_input[resultId].x;
+                    accValue.y += s_input[resultId].y;
+                }
+
+                if (outId < overlapLength) {
+                    overlap[0][outId] = accValue.x;
+                    overlap[1][outId] = accValue.y;
+                }
+            }
+        }
+        context.synchronize();
+
+        if (context.threadId() == 0) {
+            if (segmentCompletes) {
+                state->silent_segments = state->segment_active ? 0 : min(state->silent_segments + 1, segmentsCount);
+                state->segment_active = 0;
+            }
+            state->idle = 0;
+            state[0].segment_zero_samples = state[1].segment_zero_samples = (segmentZeroSamples + inputSize) % inputSamplesPerIteration;
+        }
+        context.synchronize();
+    }
+
+    template <class TContext>
+    __device_fct void initStereo(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params) __device_addr {
         if (context.threadId() == 0) {
-            _segmentZeroSamples[context.blockId()] = (params->init_buffer_offset) % params->input_samples_per_iteration;
+            for (int channel = 0; channel < 2; ++channel) {
+                params->channel_states[channel].segment_zero_samples = (params->init_buffer_offset) % params->input_samples_per_iteration;
+                params->channel_states[channel].segment_offset = 0;
+                params->channel_states[channel].segment_active = 0;
+                params->channel_states[channel].silent_segments = 0;
+                params->channel_states[channel].idle = 0;
+            }
         }
 
-        for (int offset = 0; offset < params->filter_length_to_translate_init; offset += params->fir_samples_per_iteration) {
+        // initSignalSegments
+        for (int i = context.threadId(); i < 2 * params->spectrum_length; i += context.blockDim())
+            params->fourier_input_segments[i] = make_float2(0, 0);
+        for (int i = context.threadId(); i < 2 * params->overlap_length; i += context.blockDim())
+            params->overlap[i] = 0;
+        context.synchronize();
+    }
+
+    ////////////////////////////////////////////////////////
+    // matrix mode
+    //
+    // A single block runs the uniform partitioned convolution for all inputs and outputs. Every input is transformed
+    // once into its frequency-domain delay line, every output accumulates the delay lines of all inputs multiplied with
+    // the segments of the corresponding paths and is transformed back once. All inputs share the segment state of channel 0.
+
+    template <class TFft, class TContext>
+    __device_fct void processMatrix(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, __device_addr T* __device_addr* input, __device_addr T* __device_addr* output) __device_addr {
+        if (params->filter_length_to_translate_init && context.call() == 0) [[unlikely]] {
+            initMatrix(context, params);
+        }
+
+        int cursor;
+        if (params->channel_states[0].segment_zero_samples != 0) {
+            int processSamples = min(params->input_length - (int)context.call() * params->grain, min(params->grain, params->input_samples_per_iteration - params->channel_states[0].segment_zero_samples));
+            int dataOffset = context.call() * params->grain;
+            processMatrixInternal<TFft>(context, params, input[0] + dataOffset, output[0] + dataOffset, processSamples);
+            cursor = processSamples;
+        }
+        else
+            cursor = 0;
+
+        for (; cursor < params->grain; cursor += params->input_samples_per_iteration) {
+            int processSamples = min(min(params->input_length - (int)context.call() * params->grain, params->grain) - cursor, params->input_samples_per_iteration);
+            int dataOffset = cursor + context.call() * params->grain;
+            processMatrixInternal<TFft>(context, params, input[0] + dataOffset, output[0] + dataOffset, processSamples);
+        }
+
+        int processSamples = min(params->input_length - (int)context.call() * params->grain, params->grain);
+        int dataOffset = context.call() * params->grain;
+        for (int out = 0; out < params->matrix_outputs; ++out)
+            delayOutput(context, params, output[0] + out * params->input_length + dataOffset, out, processSamples);
+    }
+
+    template <class TFft, class TContext>
+    __device_fct void processMatrixInternal(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, const __device_addr T* input, __device_addr T* output,
+        int inputSize) __device_addr {
+        constexpr int SymSize = TFft::fft_length;
+        constexpr int BlockSize = TFft::fft_length_quarter;
+        const int segmentsCount = params->segments_count;
+        const int inputSamplesPerIteration = params->input_samples_per_iteration;
+        const int overlapLength = params->overlap_length;
+        const int segmentZeroSamples = params->channel_states[0].segment_zero_samples;
+        const int segmentOffset = params->channel_states[0].segment_offset;
+        __device_addr fir::ChannelState* state = params->channel_states;
+        const bool segmentCompletes = segmentZeroSamples + inputSize == inputSamplesPerIteration;
+
+        // silence detection of all inputs, which share the segment state (see processInternal)
+        for (int in = 0; in < params->matrix_inputs; ++in)
+            detectSignal<BlockSize>(context, input + in * params->input_length, inputSize, &state->segment_active);
+        context.synchronize();
+
+        if (state->segment_active == 0 && state->silent_segments >= segmentsCount - 1) {
+            // like skipSilentSegment for every input and output
+            if (segmentZeroSamples == 0) {
+                for (int in = 0; in < params->matrix_inputs; ++in)
+                    for (int i = context.threadId(); i < SymSize; i += BlockSize)
+                        params->fourier_input_segments[in * params->spectrum_length + segmentOffset * SymSize + i] = make_float2(0, 0);
+            }
+            for (int out = 0; out < params->matrix_outputs; ++out)
+                drainOverlap<BlockSize>(context, output + out * params->input_length, params->overlap + out * overlapLength, inputSize, segmentZeroSamples, inputSamplesPerIteration, overlapLength);
+
+            if (context.threadId() == 0) {
+                if (segmentCompletes) {
+                    state->segment_offset = (segmentOffset - 1 + segmentsCount) % segmentsCount;
+                    state->silent_segments = min(state->silent_segments + 1, segmentsCount);
+                }
+                state->idle = 1;
+                state->segment_zero_samples = (segmentZeroSamples + inputSize) % inputSamplesPerIteration;
+            }
             context.synchronize();
+            return;
+        }
 
-            __threadgroup_addr float2* s_input = loadInputToSharedChecked(context, params->real_filter[context.blockId()] + offset, min(params->fir_samples_per_iteration, params->filter_length_to_translate_init - offset));
+        // fft of the new segment of every input, added to the partial segment of the delay line or starting a new one
+        for (int in = 0; in < params->matrix_inputs; ++in) {
+            __threadgroup_addr float2* s_input = loadInputToSharedChecked<TFft>(context, input + in * params->input_length, inputSize, segmentZeroSamples);
             context.synchronize();
 
-            dsp::FftCalculator<float>::template processR2C<FftParameters::config::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
+            dsp::FftCalculator<float>::template processR2C<TFft::fft_length * 2>(context, (__threadgroup_addr float*)s_input, (__threadgroup_addr float*)s_input);
             context.synchronize();
 
+            __device_addr float2* segment = params->fourier_input_segments + in * params->spectrum_length + segmentOffset * SymSize;
 #pragma unroll
             for (int i = 0; i < 4; ++i) {
-                int idx = i * FftParameters::config::fft_length_quarter + context.threadId();
-                pResponseSegments[idx] = s_input[idx];
+                int idx = i * TFft::fft_length_quarter + context.threadId();
+                float2 a = segmentZeroSamples == 0 ? make_float2(0, 0) : segment[idx];
+                float2 aL = s_input[idx];
+                segment[idx] = make_float2(a.x + aL.x, a.y + aL.y);
             }
+            context.synchronize();
+        }
+
+        __threadgroup_addr float* s_real = context.template smem_offset<float>(0);
+        __threadgroup_addr float2* s_input = context.template smem_offset<float2>(0);
+        for (int out = 0; out < params->matrix_outputs; ++out) {
+            __device_addr T* outputChannel = output + out * params->input_length;
+            __device_addr T* overlap = params->overlap + out * overlapLength;
+
+            ComplexAccumulator<SymSize, BlockSize> accumulator {};
+            if (segmentZeroSamples == 0) {
+                // the previous segments only change once per segment, their contribution is kept in the overlap
+                for (int in = 0; in < params->matrix_inputs; ++in) {
+                    const __device_addr float2* fourierInputSegments = params->fourier_input_segments + in * params->spectrum_length;
+                    const __device_addr fir::ChannelDescriptor& path = params->channels[in * params->matrix_outputs + out];
+                    for (int n = 0; n < path.active_segment_count; ++n) {
+                        const int i = path.active_segments[n];
+                        accumulator.multiplyAddFourierSym(context, fourierInputSegments + ((segmentOffset + i) % segmentsCount) * SymSize, path.fourier_impulse_response_segments + i * SymSize);
+                    }
+                }
+
+                if (segmentsCount > 1 && inputSize != inputSamplesPerIteration) {
+                    accumulator.expandToShared(context, s_input);
+                    context.synchronize();
 
-            pResponseSegments += SymSize;
+                    dsp::FftCalculator<float>::template processC2R<TFft::fft_length * 2>(context, s_real, s_real);
+                    context.synchronize();
+
+                    for (int i = context.threadId() + inputSize; i < overlapLength; i += BlockSize)
+                        overlap[i] += s_real[i];
+                    context.synchronize();
+                }
+            }
+
+            // add the (partial) new segment of every input
+            for (int in = 0; in < params->matrix_inputs; ++in)
+                accumulator.multiplyAddFourierSym(context, params->fourier_input_segments + in * params->spectrum_length + segmentOffset * SymSize,
+                    params->channels[in * params->matrix_outputs + out].fourier_impulse_response_segments);
+
+            accumulator.expandToShared(context, s_input);
+            context.synchronize();
+
+            // backward FFT
+            dsp::FftCalculator<float>::template processC2R<TFft::fft_length * 2>(context, s_real, s_real);
+            context.synchronize();
+
+            // write result out
+            for (int i = context.threadId(); i < inputSize; i += BlockSize) {
+                int relative = segmentZeroSamples + i;
+                T overlapValue = 0;
+                if (relative < overlapLength)
+                    overlapValue = overlap[relative];
+                outputChannel[i] = s_real[relative] + overlapValue;
+            }
+            context.synchronize();
+
+            // store the new overlap (potentially combine with leftover overlap)
+            if (segmentZeroSamples + inputSize == inputSamplesPerIteration) {
+                for (int i = 0; i < overlapLength; i += BlockSize) {
+                    T accValue = 0;
+                    if (i + inputSamplesPerIteration < overlapLength) {
+                        int prevOverlapId = i + inputSamplesPerIteration + context.threadId();
+                        if (prevOverlapId < overlapLength)
+                            accValue = overlap[prevOverlapId];
+                        context.synchronize();
+                    }
+                    int resultId = i + inputSamplesPerIteration + context.threadId();
+                    int outId = i + context.threadId();
+                    if (resultId < 2 * SymSize)
+                        accValue += s_real[resultId];
+
+                    if (outId < overlapLength)
+                        overlap[outId] = accValue;
+                }
+            }
+            context.synchronize();
+        }
+
+        if (context.threadId() == 0) {
+            // new first segment is second last segments
+            if (segmentCompletes) {
+                state->segment_offset = (segmentOffset - 1 + segmentsCount) % segmentsCount;
+                state->silent_segments = state->segment_active ? 0 : min(state->silent_segments + 1, segmentsCount);
+                state->segment_active = 0;
+            }
+            state->idle = 0;
+            state->segment_zero_samples = (segmentZeroSamples + inputSize) % inputSamplesPerIteration;
+        }
+        context.synchronize();
+    }
+
+    template <class TContext>
+    __device_fct void initMatrix(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params) __device_addr {
+        if (context.threadId() == 0) {
+            params->channel_states[0].segment_zero_samples = (params->init_buffer_offset) % params->input_samples_per_iteration;
+            params->channel_states[0].segment_offset = 0;
+            params->channel_states[0].segment_active = 0;
+            params->channel_states[0].silent_segments = 0;
+            params->channel_states[0].idle = 0;
         }
 
         // initSignalSegments
-        for (int i = context.threadId(); i < params->segments_count * SymSize; i += context.blockDim())
-            params->fourier_input_segments[params->segments_count * SymSize * context.blockId() + i] = make_float2(0, 0);
-        for (int i = context.threadId(); i < params->overlap_length; i += context.blockDim())
-            params->overlap[params->overlap_length * context.blockId() + i] = 0;
+        for (int i = context.threadId(); i < params->matrix_inputs * params->spectrum_length; i += context.blockDim())
+            params->fourier_input_segments[i] = make_float2(0, 0);
+        for (int i = context.threadId(); i < params->matrix_outputs * params->overlap_length; i += context.blockDim())
+            params->overlap[i] = 0;
+        context.synchronize();
+    }
+
+    ////////////////////////////////////////////////////////
+    // non-uniform tail partitions
+    //
+    // Every tail stage runs a uniformly partitioned convolution on the filter range
+    // [filter_offset, filter_offset + segments_count * block_length). Its blocks use the transform of the task, the
+    // only one the fft_length_quarter threads of the task fit (see PartitionPlan.cpp). A stage is only
+    // evaluated once per block, when the last sample of the block arrived. As filter_offset >= block_length
+    // (see PartitionPlan.cpp), its result is never needed before that and it is added to the tail
+    // output ring, from which every grain takes its share.
+
+    template <class TFft, class TIrSpectrum, class TInputSpectrum, class TContext>
+    __device_fct void processTail(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, const __device_addr T* input, __device_addr T* output,
+        int inputSize, int channel) __device_addr {
+        constexpr int BlockSize = TFft::fft_length_quarter;
+        const int position = params->channel_states[channel].tail_position;
+        __device_addr float* history = params->tail_history + params->tail_history_length * channel;
+        __device_addr float* tailOutput = params->tail_output + params->tail_output_length * channel;
+
+        // append the new input to the history
+        for (int i = context.threadId(); i < inputSize; i += BlockSize)
+            history[(position + i) % params->tail_history_length] = input[i];
+        context.synchronize();
+
+        // run every stage whose block has been completed by this input (block lengths exceed the grain, so at most once)
+        for (int stage = 0; stage < params->tail_stage_count; ++stage) {
+            const int blockLength = params->tail_stages[stage].block_length;
+            const int blockEnd = (position + inputSize) / blockLength * blockLength;
+            if (blockEnd <= position)
+                continue;
+
+            processTailStage<TFft, TIrSpectrum, TInputSpectrum>(context, params, stage, channel, blockEnd);
+        }
+
+        // add the tail contributions to the output and free the ring entries for the future
+        for (int i = context.threadId(); i < inputSize; i += BlockSize) {
+            const int ringId = (position + i) % params->tail_output_length;
+            output[i] += tailOutput[ringId];
+            tailOutput[ringId] = 0;
+        }
+        context.synchronize();
+
+        if (context.threadId() == 0) {
+            params->channel_states[channel].tail_position = (position + inputSize) % params->tail_output_length;
+            // the channel is only idle while every stage skips its blocks as well (see processTailStage)
+            for (int stage = 0; stage < params->tail_stage_count; ++stage)
+                if (params->channel_states[channel].tail_silent_blocks[stage] < params->tail_stages[stage].segments_count)
+                    params->channel_states[channel].idle = 0;
+        }
+        context.synchronize();
+    }
+
+    template <class TFft, class TIrSpectrum, class TInputSpectrum, class TContext>
+    __device_fct void processTailStage(__thread_addr TContext& context, __device_addr fir::ProcessorParameter* params, int stage, int channel, int blockEnd) __device_addr {
+        constexpr int StageSize = TFft::fft_length;
+        constexpr int BlockSize = TFft::fft_length_quarter;
+        const int segmentsCount = params->tail_stages[stage].segments_count;
+        const int segmentOffset = params->channel_states[channel].tail_segment_offset[stage];
+        const __device_addr float* history = params->tail_history + params->tail_history_length * channel;
+        __device_addr float* tailOutput = params->tail_output + params->tail_output_length * channel;
+        __device_addr TInputSpectrum* fourierInputSegments = inputSpectra<TInputSpectrum>(params) + params->spectrum_length * channel + params->tail_stages[stage].spectrum_offset;
+        const __device_addr TIrSpectrum* fourierImpulseResponseSegments = filterSpectra<TIrSpectrum>(params, channel) + params->tail_stages[stage].spectrum_offset;
+        __threadgroup_addr float* s_real = context.template smem_offset<float>(0);
+        __threadgroup_addr float2* s_input = context.template smem_offset<float2>(0);
+
+        __device_addr fir::ChannelState* state = params->channel_states + channel;
+
+        // fft of the completed block (zero padded) to shared
+        for (int i = context.threadId(); i < 2 * StageSize; i += BlockSize)
+            s_real[i] = i < StageSize ? history[(blockEnd - StageSize + i + params->tail_history_length) % params->tail_history_length] : 0;
+        context.synchronize();
+
+        // silence detection of the block, see processInternal
+        for (int i = context.threadId(); i < StageSize; i += BlockSize)
+            if (s_real[i] * s_real[i] > SILENCE_ENERGY_THRESHOLD)
+                state->tail_block_active = 1;
+        context.synchronize();
+
+        if (state->tail_block_active == 0 && state->tail_silent_blocks[stage] >= segmentsCount - 1) {
+            // the block and every block of the delay line are silent, the stage adds nothing to the tail output. the
+            // block is stored as a zero spectrum so the stage resumes with a consistent delay line
+            for (int i = context.threadId(); i < StageSize; i += BlockSize)
+                fourierInputSegments[segmentOffset * StageSize + i] = fir::SpectrumStorage<TInputSpectrum>::store(make_float2(0, 0));
+            if (context.threadId() == 0) {
+                state->tail_segment_offset[stage] = (segmentOffset - 1 + segmentsCount) % segmentsCount;
+                state->tail_silent_blocks[stage] = min(state->tail_silent_blocks[stage] + 1, segmentsCount);
+            }
+            context.synchronize();
+            return;
+        }
+
+        dsp::FftCalculator<float>::template processR2C<StageSize * 2>(context, s_real, s_real);
+        context.synchronize();
+
+        // multiply-accumulate with the frequency-domain delay line of the stage
+        ComplexAccumulator<StageSize, BlockSize> accumulator {};
+        accumulator.multiplyAddFourierSym(context, s_input, fourierImpulseResponseSegments);
+        for (int i = 1; i < segmentsCount; ++i)
+            accumulator.multiplyAddFourierSym(context, fourierInputSegments + ((segmentOffset + i) % segmentsCount) * StageSize, fourierImpulseResponseSegments + i * StageSize);
+
+        // write the fourier transformed block to the delay line
+        for (int i = context.threadId(); i < StageSize; i += BlockSize)
+            fourierInputSegments[segmentOffset * StageSize + i] = fir::SpectrumStorage<TInputSpectrum>::store(s_input[i]);
+        context.synchronize();
+
+        if (context.threadId() == 0) {
+            state->tail_segment_offset[stage] = (segmentOffset - 1 + segmentsCount) % segmentsCount;
+            state->tail_silent_blocks[stage] = state->tail_block_active ? 0 : min(state->tail_silent_blocks[stage] + 1, segmentsCount);
+            state->tail_block_active = 0;
+        }
+
+        // convert from symmetric only part
+        accumulator.expandToShared(context, s_input);
+        context.synchronize();
+
+        // backward FFT
+        dsp::FftCalculator<float>::template processC2R<StageSize * 2>(context, s_real, s_real);
+        context.synchronize();
+
+        // the block [blockEnd - StageSize, blockEnd) contributes from blockEnd - StageSize + filter_offset onwards
+        const int resultOffset = blockEnd - StageSize + params->tail_stages[stage].filter_offset;
+        for (int i = context.threadId(); i < 2 * StageSize; i += BlockSize)
+            tailOutput[(resultOffset + i) % params->tail_output_length] += s_real[i];
+        context.synchronize();
     }
 };
 } // namespace FirProcessor
@@ -30,7 +30,32 @@ YS3jRTDPrNDhZohM0vBh, \
 rv18b4FUn1JcELdIBaPn, \
 nZhpER8T7QmHOZi7LGau, \
 YMvzEVWpaivpX5byw4ys, \
-PP3YSq7ouIVJRW5tfYQ8
+PP3YSq7ouIVJRW5tfYQ8, \
+Wq4mTzG0hXcR8vLbN2ys, \
+eK7pD1sVuY5oJf3aHn9Q, \
+Lr6ZbC2wXiM0tQe8gUv4, \
+Tg3XnR7cWb1KzqP5oLmE, \
+uF8sJd2VhN6yAe0QiCwR, \
+Hc5vQ9nZ1sEwK7rTyB3d, \
+pM2jX8aLf4GzU6oWi0Ns, \
+Ra7Yt1kVe9DqC3bPx5Jh, \
+gN0wS6uI2mZc8HfLr4Ty, \
+Xb4Kq7Ej1OvT9sAd3WnM, \
+iD6Pz0yRg5LhF2cUk8Vo, \
+tW3eB9xNa7QjM1sKv5Gf, \
+Ys8Hn2Co6ZrE4pLb0Xwq, \
+Ke1Vd7Rq3NtB9mXs5ZuA, \
+oQ4cW8hJ0LyF6iTp2GbD, \
+Nz9Ua3Mk7SeH1xCv5RjW, \
+bT6Gw0Pq4YdL8nKs2EhF, \
+Vj2Xm5Rc9AoZ3uWt7IqB, \
+fH8Ly1Nb6DkS4gQe0MzP, \
+Wc3Ti9Ep5JvR7aXo1KdU, \
+qS0Fz4Hn8BmY2cVl6TgJ, \
+Ea7Ok3Wd1RuN9pGh5XsC, \
+mL5Bq9Yf2ZtI6vKj0PeR, \
+Dy8Gc1Xs4KwO7hNb3VqT, \
+zR6Pm0Lf9UaJ2tEi5CkH
 // clang-format on
 
 // DO NOT REMOVE! Contains macros for device function name substitution.
@@ -38,25 +63,105 @@ PP3YSq7ouIVJRW5tfYQ8
 
 #include "SM_FFT_parameters.cuh" // TODO: we should use <dsp_library/FftCalculatorParams.h>
 
+// FFT sizes (complex bins, i.e., samples per segment) of the processor tasks: MIN_FFT_WIDTH, 2 * MIN_FFT_WIDTH, ..., MAX_FFT_WIDTH.
+// Every size has its own task (see FirProcessor.cu), FirProcessor selects one at runtime (see SelectFftLength).
 // NOTE that you need to decrease the max registers for higher FFT sizes
 // always use 128 max register
 // for 4096 you need 64!!
+__program_scope constexpr int MIN_FFT_WIDTH = 256;
 #if defined(GPU_AUDIO_MAC)
-__program_scope constexpr int FFT_WIDTH = 1024;
+__program_scope constexpr int MAX_FFT_WIDTH = 1024;
+__program_scope constexpr int FFT_TASK_COUNT = 3;
 #else
-__program_scope constexpr int FFT_WIDTH = 2048;
+__program_scope constexpr int MAX_FFT_WIDTH = 4096;
+__program_scope constexpr int FFT_TASK_COUNT = 5;
 #endif
-__program_scope constexpr int MAX_CHANNELS = 2;
+// maximum number of non-uniform partition stages following the head partition
+__program_scope constexpr int MAX_TAIL_STAGES = 4;
 
-using FftParameters = FFTParameters<FFT_WIDTH, false, true>;
+// filters up to DIRECT_FORM_MAX_FILTER_LENGTH samples are convolved in the time domain by the direct form task,
+// which follows the FFT tasks in FirProcessor.cu and runs DIRECT_FORM_THREAD_COUNT threads per block
+__program_scope constexpr int DIRECT_FORM_MAX_FILTER_LENGTH = 512;
+__program_scope constexpr int DIRECT_FORM_TASK_INDEX = FFT_TASK_COUNT;
+__program_scope constexpr int DIRECT_FORM_THREAD_COUNT = 256;
+__program_scope constexpr int DIRECT_FORM_MAX_GRAIN = 1024;
+
+// stereo tasks follow the direct form task, one per FFT size from MIN_FFT_WIDTH to MAX_FFT_WIDTH / 2
+// (both channels are transformed with one FFT of twice the size)
+__program_scope constexpr int STEREO_TASK_INDEX = DIRECT_FORM_TASK_INDEX + 1;
+__program_scope constexpr int STEREO_TASK_COUNT = FFT_TASK_COUNT - 1;
+
+// slice tasks follow the stereo tasks, one per FFT size. with long filters, they accumulate the head segments of a
+// channel in up to MAX_SEGMENT_SLICES blocks before the FFT task of the same call reduces the partial spectra
+__program_scope constexpr int SLICE_TASK_INDEX = STEREO_TASK_INDEX + STEREO_TASK_COUNT;
+__program_scope constexpr int SLICE_TASK_COUNT = FFT_TASK_COUNT;
+__program_scope constexpr int MAX_SEGMENT_SLICES = 32;
+
+// impulse responses with at most SPARSE_MAX_TAPS non-zero samples per channel (tap delays) are convolved by the sparse
+// task, which follows the slice tasks and reads the input history at the tap offsets only
+__program_scope constexpr int SPARSE_MAX_TAPS = 64;
+__program_scope constexpr int SPARSE_TASK_INDEX = SLICE_TASK_INDEX + SLICE_TASK_COUNT;
+__program_scope constexpr int SPARSE_THREAD_COUNT = 256;
+
+// an input segment is silent while the energy of its samples stays at or below SILENCE_ENERGY_THRESHOLD (about
+// -200 dBFS). the head partition, the stereo and matrix tasks and every tail stage stop transforming the input once
+// all segments of their delay line are silent
+__program_scope constexpr float SILENCE_ENERGY_THRESHOLD = 1e-20f;
 
 // parameter struct passed to each task (members are set in FirProcessor::PrepareChunk)
 namespace fir {
+// one stage of the non-uniform partition plan following the head partition (see PartitionPlan.h)
+struct PartitionStage {
+    int block_length;    // samples per segment, transformed with a 2 * block_length real FFT
+    int segments_count;  // number of segments of the stage
+    int filter_offset;   // first filter sample covered by the stage
+    int spectrum_offset; // offset of the stage in the per-channel spectrum storage (in float2)
+};
+
+// non-zero samples of a sparse filter (see processSparse)
+struct SparseTaps {
+    int offsets[SPARSE_MAX_TAPS];
+    float gains[SPARSE_MAX_TAPS];
+    int count;
+};
+
+// impulse response of a channel, or of an input/output channel pair in matrix mode. The table is kept in
+// device memory and only uploaded when the filter buffers change (see FirProcessor::UpdateChannelTable)
+struct ChannelDescriptor {
+    const __device_addr float2* fourier_impulse_response_segments;
+    const __device_addr float* real_filter; // real -> audio
+    // ascending indices of the head segments 1..segments_count - 1 that are not silent (see FindActiveSegments),
+    // segment 0 is always accumulated
+    const __device_addr int* active_segments;
+    int active_segment_count;
+    // taps of sparse filters, only set for the sparse task
+    const __device_addr SparseTaps* sparse_taps;
+};
+
+// processing state of a channel, only written by the device and reset when the filter changes
+struct ChannelState {
+    int segment_offset;                       // points to the last input segment
+    int segment_zero_samples;                 // samples as overlaps from last iteration
+    int tail_position;                        // position in the tail history/output ring
+    int tail_segment_offset[MAX_TAIL_STAGES]; // points to the last input segment of each tail stage
+    int delay_position;                       // position in the output delay line
+    int history_position;                     // position in the input history ring of the sparse task
+    // silence detection of the head partition (see processInternal)
+    int segment_active;  // set when a sample of the running input segment exceeds the silence threshold
+    int silent_segments; // completed input segments in a row that were silent (saturates at segments_count)
+    int idle;            // 1 while the input, all segments of the delay line and all tail stages are silent and the FFTs are skipped
+    // silence detection of the tail stages (see processTailStage)
+    int tail_block_active;                    // set when a sample of the completed block exceeds the silence threshold
+    int tail_silent_blocks[MAX_TAIL_STAGES];  // completed blocks in a row of each stage that were silent (saturates at its segments_count)
+};
+
 struct ProcessorParameter {
     __device_addr float2* fourier_input_segments;
     __device_addr float* overlap;
-    const __device_addr float2* fourier_impulse_response_segments[MAX_CHANNELS];
-    const __device_addr float* real_filter[MAX_CHANNELS]; // real -> audio
+    // indexed by channel, in matrix mode by path (input * matrix_outputs + output)
+    const __device_addr ChannelDescriptor* channels;
+    // indexed by channel, the stereo and matrix tasks keep their shared state in the first entry
+    __device_addr ChannelState* channel_states;
 
     int segments_count;
     int input_samples_per_iteration;
@@ -64,9 +169,48 @@ struct ProcessorParameter {
     int overlap_length;
 
     int input_length;
+    // != 0 in the first chunk after a filter change: the tasks reset the channel state and clear the delay lines
     int filter_length_to_translate_init;
     int grain;
     int init_buffer_offset;
+
+    // per-channel length of fourier_input_segments and fourier_impulse_response_segments (in float2)
+    int spectrum_length;
+
+    // non-uniform tail partitions; tail_stage_count == 0 runs the uniform partitioned convolution only
+    __device_addr float* tail_history;
+    __device_addr float* tail_output;
+    int tail_history_length;
+    int tail_output_length;
+    int tail_stage_count;
+    PartitionStage tail_stages[MAX_TAIL_STAGES];
+
+    // direct form convolution with the first filter_length samples of the real filters;
+    // history keeps the last history_length input samples of each channel (as a ring for the sparse task)
+    __device_addr float* history;
+    int history_length;
+    int filter_length;
+
+    // matrix mode (matrix_outputs != 0): a single block convolves every input with every output. fourier_input_segments
+    // holds the spectra of matrix_inputs channels, overlap the overlap of matrix_outputs channels
+    int matrix_inputs;
+    int matrix_outputs;
+
+    // segment slices (slice_count != 0): the slice task stores slice_count partial spectra (spectrum size in float2 each)
+    // per channel in slice_spectra, which the FFT task adds instead of accumulating segments 2..segments_count - 1
+    __device_addr float2* slice_spectra;
+    int slice_count;
+
+    // storage format of the filter and input spectra (SPECTRUM_FLOAT32, ..., see SpectrumStorage.h). the reduced formats
+    // store one bin in 32 bit, so the spectrum offsets and lengths above count bins rather than float2. the input spectra
+    // use SPECTRUM_FLOAT32 or the format of the filter spectra. the stereo and matrix tasks only support SPECTRUM_FLOAT32.
+    int ir_spectrum_precision;
+    int input_spectrum_precision;
+
+    // leading zeros trimmed from the filters (output_delay != 0): every output channel is delayed by output_delay samples
+    // through its ring of output_delay samples in output_delay_line
+    __device_addr float* output_delay_line;
+    int output_delay;
 };
 
 // per task parameter struct. could be different for each task if the processor
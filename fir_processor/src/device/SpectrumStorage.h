@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef FIR_SPECTRUM_STORAGE_H
+#define FIR_SPECTRUM_STORAGE_H
+
+#include <platform/Abstraction.h>
+
+#if !defined(__METAL_DEVICE_COMPILE__) && !defined(__CUDA_ARCH__) && !defined(__HIP_DEVICE_COMPILE__)
+#include <cstring>
+#endif
+
+// storage formats of the spectra in device memory (values match FirConfig::SpectrumPrecision). all formats are
+// accumulated in fp32, the reduced formats pack a complex bin into 32 bit and halve the memory and the bytes read per bin.
+__program_scope constexpr int SPECTRUM_FLOAT32 = 0;
+__program_scope constexpr int SPECTRUM_FLOAT16 = 1;
+__program_scope constexpr int SPECTRUM_BFLOAT16 = 2;
+
+namespace fir {
+
+// complex bin as two IEEE half precision values, real part in the lower 16 bit
+struct Half2Spectrum {
+    unsigned int bits;
+};
+
+// complex bin as two bfloat16 values (upper half of a float), real part in the lower 16 bit
+struct BFloat2Spectrum {
+    unsigned int bits;
+};
+
+__device_fct inline unsigned int floatAsUint(float value) {
+#if defined(__METAL_DEVICE_COMPILE__)
+    return as_type<unsigned int>(value);
+#elif defined(__CUDA_ARCH__) || defined(__HIP_DEVICE_COMPILE__)
+    return __float_as_uint(value);
+#else
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+#endif
+}
+
+__device_fct inline float uintAsFloat(unsigned int bits) {
+#if defined(__METAL_DEVICE_COMPILE__)
+    return as_type<float>(bits);
+#elif defined(__CUDA_ARCH__) || defined(__HIP_DEVICE_COMPILE__)
+    return __uint_as_float(bits);
+#else
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+// round to nearest even, values beyond the half range saturate to infinity
+__device_fct inline unsigned int floatToHalf(float value) {
+    const unsigned int f = floatAsUint(value);
+    const unsigned int sign = (f >> 16) & 0x8000u;
+    const int exponent = (int)((f >> 23) & 0xFFu) - 127 + 15;
+    unsigned int mantissa = f & 0x7FFFFFu;
+    if (exponent >= 31)
+        return sign | 0x7C00u;
+    int shift = 13;
+    unsigned int half = sign | ((unsigned int)exponent << 10);
+    if (exponent <= 0) {
+        // subnormal half
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000u;
+        shift = 14 - exponent;
+        half = sign;
+    }
+    half |= mantissa >> shift;
+    const unsigned int rest = mantissa & ((1u << shift) - 1u);
+    const unsigned int halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1u)))
+        ++half; // a carry correctly moves into the exponent
+    return half;
+}
+
+__device_fct inline float halfToFloat(unsigned int half) {
+    const unsigned int sign = (half & 0x8000u) << 16;
+    const unsigned int exponent = (half >> 10) & 0x1Fu;
+    const unsigned int mantissa = half & 0x3FFu;
+    if (exponent == 0) {
+        const float subnormal = (float)mantissa * 5.9604644775390625e-8f; // 2^-24
+        return sign ? -subnormal : subnormal;
+    }
+    if (exponent == 31)
+        return uintAsFloat(sign | 0x7F800000u | (mantissa << 13));
+    return uintAsFloat(sign | ((exponent - 15u + 127u) << 23) | (mantissa << 13));
+}
+
+// round to nearest even
+__device_fct inline unsigned int floatToBFloat(float value) {
+    const unsigned int f = floatAsUint(value);
+    return (f + 0x7FFFu + ((f >> 16) & 1u)) >> 16;
+}
+
+__device_fct inline float bfloatToFloat(unsigned int bfloat) {
+    return uintAsFloat(bfloat << 16);
+}
+
+// conversion between the storage format of a spectrum and the fp32 bins used for the computations
+template <class TSpectrum>
+struct SpectrumStorage;
+
+template <>
+struct SpectrumStorage<float2> {
+    __device_fct static float2 load(float2 value) {
+        return value;
+    }
+    __device_fct static float2 store(float2 value) {
+        return value;
+    }
+};
+
+template <>
+struct SpectrumStorage<Half2Spectrum> {
+    __device_fct static float2 load(Half2Spectrum value) {
+        return make_float2(halfToFloat(value.bits & 0xFFFFu), halfToFloat(value.bits >> 16));
+    }
+    __device_fct static Half2Spectrum store(float2 value) {
+        Half2Spectrum result;
+        result.bits = floatToHalf(value.x) | (floatToHalf(value.y) << 16);
+        return result;
+    }
+};
+
+template <>
+struct SpectrumStorage<BFloat2Spectrum> {
+    __device_fct static float2 load(BFloat2Spectrum value) {
+        return make_float2(bfloatToFloat(value.bits & 0xFFFFu), bfloatToFloat(value.bits >> 16));
+    }
+    __device_fct static BFloat2Spectrum store(float2 value) {
+        BFloat2Spectrum result;
+        result.bits = floatToBFloat(value.x) | (floatToBFloat(value.y) << 16);
+        return result;
+    }
+};
+
+} // namespace fir
+
+#endif // FIR_SPECTRUM_STORAGE_H
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef CPU_TEST_CONTEXT_H
+#define CPU_TEST_CONTEXT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Emulates the scheduler context of a single block on the CPU to run device tasks without a GPU.
+// Every GPU thread is a std::thread, `synchronize()` is a barrier over all threads of the block.
+class CpuTestContext {
+public:
+    struct Block {
+        Block(uint32_t call, uint32_t block_id, uint32_t block_dim, size_t smem_bytes) :
+            call {call},
+            block_id {block_id},
+            block_dim {block_dim},
+            smem((smem_bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t)) {}
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            const auto current = generation;
+            if (++arrived == block_dim) {
+                arrived = 0;
+                ++generation;
+                condition.notify_all();
+            }
+            else {
+                condition.wait(lock, [&] { return generation != current; });
+            }
+        }
+
+        uint32_t call;
+        uint32_t block_id;
+        uint32_t block_dim;
+        std::vector<uint64_t> smem;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        uint32_t arrived {0};
+        uint64_t generation {0};
+    };
+
+    CpuTestContext(Block& block, uint32_t thread_id) :
+        m_block {&block},
+        m_thread_id {thread_id} {}
+
+    uint32_t call() const { return m_block->call; }
+    uint32_t blockId() const { return m_block->block_id; }
+    uint32_t threadId() const { return m_thread_id; }
+    uint32_t blockDim() const { return m_block->block_dim; }
+    void synchronize() { m_block->wait(); }
+
+    template <typename T>
+    T* smem_offset(size_t offset) {
+        return reinterpret_cast<T*>(m_block->smem.data()) + offset;
+    }
+
+    // runs `task(context)` with `block_dim` threads for one block of one call
+    template <typename Task>
+    static void RunBlock(uint32_t call, uint32_t block_id, uint32_t block_dim, size_t smem_bytes, Task&& task) {
+        Block block {call, block_id, block_dim, smem_bytes};
+        std::vector<std::thread> threads;
+        threads.reserve(block_dim);
+        for (uint32_t thread_id = 0; thread_id < block_dim; ++thread_id) {
+            threads.emplace_back([&block, &task, thread_id] { task(CpuTestContext {block, thread_id}); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    Block* m_block;
+    uint32_t m_thread_id;
+};
+
+#endif // CPU_TEST_CONTEXT_H
@@ -0,0 +1,821 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "CpuTestContext.h"
+
+#include "../src/PartitionPlan.h"
+#include "../src/SpectrumBuilder.h"
+#include "../src/device/FirProcessor.cuh"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<float> CreateNoise(size_t length, uint32_t seed) {
+    std::mt19937 generator {seed};
+    std::uniform_real_distribution<float> distribution {-1.f, 1.f};
+    std::vector<float> result(length);
+    std::generate(result.begin(), result.end(), [&] { return distribution(generator); });
+    return result;
+}
+
+std::vector<float> Convolve(const std::vector<float>& input, const std::vector<float>& filter) {
+    std::vector<float> result(input.size(), 0.f);
+    for (size_t n = 0; n < input.size(); ++n) {
+        double sum = 0.0;
+        for (size_t k = 0; k < filter.size() && k <= n; ++k) {
+            sum += static_cast<double>(filter[k]) * input[n - k];
+        }
+        result[n] = static_cast<float>(sum);
+    }
+    return result;
+}
+
+float MaxDifference(const std::vector<float>& a, const std::vector<float>& b) {
+    float result = 0.f;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); ++i) {
+        result = std::max(result, std::abs(a[i] - b[i]));
+    }
+    return result;
+}
+
+// signal to noise ratio of `signal` against `reference` in dB
+double SignalToNoiseRatio(const std::vector<float>& signal, const std::vector<float>& reference) {
+    double signal_energy = 0.0;
+    double noise_energy = 0.0;
+    for (size_t i = 0; i < std::min(signal.size(), reference.size()); ++i) {
+        signal_energy += static_cast<double>(reference[i]) * reference[i];
+        noise_energy += (static_cast<double>(signal[i]) - reference[i]) * (static_cast<double>(signal[i]) - reference[i]);
+    }
+    return 10.0 * std::log10(signal_energy / std::max(noise_energy, 1e-30));
+}
+
+// Sets up the buffers and the fir::ProcessorParameter like FirProcessor::PrepareChunk does
+// and runs the device task of FFT size FftLength call by call. Each filter is the impulse response of one channel,
+// the channels of the input and output signals are stored one after the other.
+template <int FftLength>
+class DeviceRunner {
+    using Fft = typename FFTParameters<FftLength>::config;
+
+public:
+    DeviceRunner(const std::vector<float>& filter, const PartitionPlan& plan) :
+        DeviceRunner(std::vector<std::vector<float>> {filter}, plan) {}
+
+    DeviceRunner(const std::vector<std::vector<float>>& filters, const PartitionPlan& plan) :
+        m_filters {filters},
+        m_plan {plan},
+        m_fourier_input_segments(plan.spectrum_length * filters.size()),
+        m_fourier_impulse_response_segments(filters.size(), std::vector<float2>(plan.spectrum_length)),
+        m_channels(filters.size()),
+        m_active_segments(filters.size()),
+        m_channel_states(std::max<size_t>(filters.size(), 2u)),
+        m_overlap(2 * FftLength * filters.size()),
+        m_tail_history(plan.tail_history_length * filters.size()),
+        m_tail_output(plan.tail_output_length * filters.size()),
+        m_history((std::max(plan.direct_length, 1u) - 1u) * filters.size()) {
+        // the task runs Fft::fft_length_quarter threads, which only fit transforms of FftLength
+        if (plan.max_block_length > FftLength)
+            throw std::runtime_error("Error in DeviceRunner: the plan uses blocks larger than the task transform");
+        for (size_t path = 0; path < filters.size(); ++path) {
+            m_active_segments[path] = FindActiveSegments(filters[path].data(), static_cast<uint32_t>(filters[path].size()), FftLength, plan.head_segment_count);
+        }
+        BuildSpectra();
+    }
+
+    // number of head segments after segment 0 the device accumulates for a path
+    size_t GetActiveSegmentCount(size_t path) const {
+        return m_active_segments[path].size();
+    }
+
+    std::vector<float> Process(const std::vector<float>& input, int grain) {
+        return Run(input, grain, false);
+    }
+
+    // runs the stereo task, which processes both channels in a single block
+    std::vector<float> ProcessStereo(const std::vector<float>& input, int grain) {
+        return Run(input, grain, true);
+    }
+
+    // storage format of the spectra (SPECTRUM_FLOAT32, ...), the float2 buffers are large enough for every format
+    void SetSpectrumPrecision(int ir_precision, int input_precision) {
+        m_ir_spectrum_precision = ir_precision;
+        m_input_spectrum_precision = input_precision;
+        BuildSpectra();
+    }
+
+    // delays every output channel by `delay` samples, like the leading zeros trimmed from an impulse response
+    void SetOutputDelay(uint32_t delay) {
+        m_output_delay = delay;
+        m_output_delay_line.assign(delay * m_filters.size(), 1.f);
+    }
+
+    // device state of a channel after the last call
+    const fir::ChannelState& GetChannelState(size_t channel) const {
+        return m_channel_states[channel];
+    }
+
+    // runs the slice task with slice_count blocks per channel before the FFT task of every call
+    std::vector<float> ProcessSliced(const std::vector<float>& input, int grain, uint32_t slice_count) {
+        m_slice_count = slice_count;
+        m_slice_spectra.assign(slice_count * FftLength * m_filters.size(), float2 {});
+        return Run(input, grain, false);
+    }
+
+    // matrix mode, the filters are the paths input * output_count + output
+    std::vector<float> ProcessMatrix(const std::vector<float>& input, int grain, uint32_t input_count) {
+        return Run(input, grain, false, input_count);
+    }
+
+private:
+    // the filter spectra are built on the host like FirProcessor::UpdateFilterCoefficients does
+    void BuildSpectra() {
+        SpectrumBuilder builder {m_plan, static_cast<uint32_t>(m_ir_spectrum_precision)};
+        for (size_t path = 0; path < m_filters.size(); ++path) {
+            builder.Build(m_filters[path].data(), static_cast<uint32_t>(m_filters[path].size()), m_fourier_impulse_response_segments[path].data());
+        }
+    }
+
+    std::vector<float> Run(const std::vector<float>& input, int grain, bool stereo, uint32_t matrix_inputs = 0u) {
+        using StereoFft = typename FFTParameters<2 * FftLength>::config;
+        const auto path_count = static_cast<uint32_t>(m_filters.size());
+        const auto input_count = matrix_inputs != 0u ? matrix_inputs : path_count;
+        const auto channel_count = matrix_inputs != 0u ? path_count / matrix_inputs : path_count;
+        const auto filter_length = m_filters[0].size();
+        const auto input_length = input.size() / input_count;
+        std::vector<float> in {input};
+        std::vector<float> out(input_length * channel_count, 0.f);
+        float* input_ptr = in.data();
+        float* output_ptr = out.data();
+
+        fir::ProcessorParameter params {};
+        params.fourier_input_segments = m_fourier_input_segments.data();
+        params.overlap = m_overlap.data();
+        for (uint32_t path = 0; path < path_count; ++path) {
+            m_channels[path].fourier_impulse_response_segments = m_fourier_impulse_response_segments[path].data();
+            m_channels[path].real_filter = m_filters[path].data();
+            m_channels[path].active_segments = m_active_segments[path].data();
+            m_channels[path].active_segment_count = static_cast<int>(m_active_segments[path].size());
+        }
+        params.channels = m_channels.data();
+        params.channel_states = m_channel_states.data();
+        params.segments_count = static_cast<int>(m_plan.head_segment_count);
+        params.input_samples_per_iteration = FftLength;
+        params.fir_samples_per_iteration = FftLength;
+        params.overlap_length = std::min<int>(static_cast<int>(std::min<size_t>(filter_length, m_plan.head_segment_count * FftLength)), 2 * FftLength);
+        params.input_length = static_cast<int>(input_length);
+        params.grain = grain;
+        params.filter_length_to_translate_init = static_cast<int>(filter_length);
+        params.spectrum_length = static_cast<int>(m_plan.spectrum_length);
+        params.tail_history = m_tail_history.data();
+        params.tail_output = m_tail_output.data();
+        params.tail_history_length = static_cast<int>(m_plan.tail_history_length);
+        params.tail_output_length = static_cast<int>(m_plan.tail_output_length);
+        params.tail_stage_count = static_cast<int>(m_plan.tail_stage_count);
+        std::copy(std::begin(m_plan.tail_stages), std::end(m_plan.tail_stages), std::begin(params.tail_stages));
+        params.history = m_history.data();
+        params.history_length = static_cast<int>(std::max(m_plan.direct_length, 1u) - 1u);
+        params.filter_length = static_cast<int>(m_plan.direct_length);
+        params.matrix_inputs = static_cast<int>(matrix_inputs);
+        params.matrix_outputs = static_cast<int>(matrix_inputs != 0u ? channel_count : 0u);
+        params.slice_spectra = m_slice_spectra.data();
+        params.slice_count = static_cast<int>(m_slice_count);
+        params.ir_spectrum_precision = m_ir_spectrum_precision;
+        params.input_spectrum_precision = m_input_spectrum_precision;
+        params.output_delay_line = m_output_delay_line.data();
+        params.output_delay = static_cast<int>(m_output_delay);
+
+        const auto shared_mem_size = std::max<uint32_t>(GetTransformSharedMemorySize(stereo ? 2 * FftLength : m_plan.max_block_length),
+            (2 * m_plan.direct_length + grain) * sizeof(float));
+        const auto num_calls = static_cast<uint32_t>((input_length + grain - 1) / grain);
+        for (uint32_t call = 0; call < num_calls; ++call) {
+            if (stereo || matrix_inputs != 0u) {
+                CpuTestContext::RunBlock(call, 0u, stereo ? StereoFft::fft_length_quarter : Fft::fft_length_quarter, shared_mem_size, [&](CpuTestContext context) {
+                    if (stereo)
+                        m_device.template processStereo<Fft, StereoFft>(context, &params, nullptr, &input_ptr, &output_ptr);
+                    else
+                        m_device.template process<Fft>(context, &params, nullptr, &input_ptr, &output_ptr);
+                });
+            }
+            else {
+                for (uint32_t block = 0; block < m_slice_count * channel_count; ++block) {
+                    CpuTestContext::RunBlock(call, block, Fft::fft_length_quarter, 0u, [&](CpuTestContext context) {
+                        m_device.template accumulateSlices<Fft>(context, &params);
+                    });
+                }
+                for (uint32_t channel = 0; channel < channel_count; ++channel) {
+                    CpuTestContext::RunBlock(call, channel, Fft::fft_length_quarter, shared_mem_size, [&](CpuTestContext context) {
+                        m_device.template process<Fft>(context, &params, nullptr, &input_ptr, &output_ptr);
+                    });
+                }
+            }
+            params.filter_length_to_translate_init = 0;
+        }
+        return out;
+    }
+
+    std::vector<std::vector<float>> m_filters;
+    PartitionPlan m_plan;
+    std::vector<float2> m_fourier_input_segments;
+    std::vector<std::vector<float2>> m_fourier_impulse_response_segments;
+    std::vector<fir::ChannelDescriptor> m_channels;
+    std::vector<std::vector<int>> m_active_segments;
+    std::vector<fir::ChannelState> m_channel_states;
+    std::vector<float> m_overlap;
+    std::vector<float> m_tail_history;
+    std::vector<float> m_tail_output;
+    std::vector<float> m_history;
+    std::vector<float2> m_slice_spectra;
+    uint32_t m_slice_count {0u};
+    int m_ir_spectrum_precision {SPECTRUM_FLOAT32};
+    int m_input_spectrum_precision {SPECTRUM_FLOAT32};
+    std::vector<float> m_output_delay_line;
+    uint32_t m_output_delay {0u};
+    FirProcessor::FirProcessorDevice<float> m_device;
+};
+
+} // namespace
+
+TEST(PartitionPlanTest, NonUniformPlanCoversFilter) {
+    constexpr uint32_t block_length = 2048u;
+    const auto plan = CreateNonUniformPartitionPlan(121522u, block_length);
+
+    ASSERT_GT(plan.tail_stage_count, 0u);
+    EXPECT_EQ(plan.head_segment_count, 2u);
+
+    uint32_t covered = plan.head_segment_count * block_length;
+    uint32_t segments = plan.head_segment_count;
+    for (uint32_t i = 0; i < plan.tail_stage_count; ++i) {
+        const auto& stage = plan.tail_stages[i];
+        // a stage must not be needed before its block is complete, and its transform must fit the threads of the task
+        EXPECT_GE(stage.filter_offset, stage.block_length);
+        EXPECT_EQ(static_cast<uint32_t>(stage.block_length), block_length);
+        EXPECT_EQ(static_cast<uint32_t>(stage.filter_offset), covered);
+        covered += stage.segments_count * stage.block_length;
+        segments += stage.segments_count;
+    }
+    EXPECT_GE(covered, 121522u);
+    EXPECT_EQ(segments, CreateUniformPartitionPlan(121522u, block_length, block_length).head_segment_count);
+    EXPECT_EQ(plan.max_block_length, block_length);
+}
+
+TEST(PartitionPlanTest, ShortFilterStaysInHead) {
+    constexpr uint32_t block_length = 2048u;
+    const auto plan = CreateNonUniformPartitionPlan(block_length + 1u, block_length);
+    EXPECT_EQ(plan.tail_stage_count, 0u);
+    EXPECT_EQ(plan.head_segment_count, 2u);
+}
+
+TEST(PartitionPlanTest, SelectFftLength) {
+    // small buffers with short filters use small transforms, large buffers with long filters large ones
+    EXPECT_EQ(SelectFftLength(128u, 300u), static_cast<uint32_t>(MIN_FFT_WIDTH));
+    EXPECT_EQ(SelectFftLength(8192u, 121522u), static_cast<uint32_t>(MAX_FFT_WIDTH));
+    EXPECT_LE(SelectFftLength(256u, 121522u), SelectFftLength(2048u, 121522u));
+
+    EXPECT_EQ(GetFftTaskIndex(MIN_FFT_WIDTH), 0u);
+    EXPECT_EQ(GetFftTaskIndex(MAX_FFT_WIDTH), static_cast<uint32_t>(FFT_TASK_COUNT - 1));
+    EXPECT_EQ(GetStereoTaskIndex(MAX_FFT_WIDTH / 2), static_cast<uint32_t>(STEREO_TASK_INDEX + STEREO_TASK_COUNT - 1));
+}
+
+TEST(PartitionPlanTest, HybridPlanStartsAfterDirectPart) {
+    constexpr uint32_t block_length = 256u;
+    const auto plan = CreateHybridPartitionPlan(20000u, 300u, block_length);
+
+    EXPECT_EQ(plan.direct_length, 300u);
+    EXPECT_EQ(plan.head_segment_count, 0u);
+    ASSERT_GT(plan.tail_stage_count, 0u);
+    EXPECT_EQ(plan.tail_stages[0].filter_offset, 300);
+    EXPECT_EQ(plan.tail_stages[0].block_length, static_cast<int>(block_length));
+
+    uint32_t covered = plan.direct_length;
+    for (uint32_t i = 0; i < plan.tail_stage_count; ++i) {
+        EXPECT_GE(plan.tail_stages[i].filter_offset, plan.tail_stages[i].block_length);
+        covered += plan.tail_stages[i].segments_count * plan.tail_stages[i].block_length;
+    }
+    EXPECT_GE(covered, 20000u);
+
+    // direct parts shorter than a block are extended, the first block would not be complete in time otherwise
+    EXPECT_EQ(CreateHybridPartitionPlan(20000u, 100u, block_length).direct_length, block_length);
+}
+
+TEST(PartitionPlanTest, SegmentSliceCount) {
+    EXPECT_EQ(SelectSegmentSliceCount(100u, 0u), 0u);
+    EXPECT_EQ(SelectSegmentSliceCount(2u, 1u), 0u);
+    // a single slice does not split the work
+    EXPECT_EQ(SelectSegmentSliceCount(10u, 8u), 0u);
+    EXPECT_EQ(SelectSegmentSliceCount(11u, 8u), 2u);
+    EXPECT_EQ(SelectSegmentSliceCount(100000u, 1u), static_cast<uint32_t>(MAX_SEGMENT_SLICES));
+    EXPECT_EQ(GetSliceTaskIndex(MIN_FFT_WIDTH), static_cast<uint32_t>(SLICE_TASK_INDEX));
+}
+
+TEST(PartitionPlanTest, TailLength) {
+    // the energy behind sample n of an exponential decay is exp(-2 n / 100) of the total
+    std::vector<float> filter(4000u);
+    for (size_t n = 0; n < filter.size(); ++n) {
+        filter[n] = std::exp(-static_cast<float>(n) / 100.f);
+    }
+    const auto length = static_cast<uint32_t>(filter.size());
+    EXPECT_NEAR(static_cast<double>(FindTailLength(filter.data(), length, -60.f)), 50.0 * std::log(1e6), 2.0);
+    EXPECT_NEAR(static_cast<double>(FindTailLength(filter.data(), length, -90.f)), 50.0 * std::log(1e9), 2.0);
+    // a threshold far below the decay keeps every sample, silence keeps a single sample
+    EXPECT_EQ(FindTailLength(filter.data(), 300u, -400.f), 300u);
+    filter.assign(filter.size(), 0.f);
+    EXPECT_EQ(FindTailLength(filter.data(), length, -60.f), 1u);
+}
+
+TEST(FirProcessorDeviceTest, NonUniformMatchesUniform) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    constexpr uint32_t block_length = fft_length;
+    constexpr int grain = block_length / 4;
+    const auto filter = CreateNoise(21u * block_length + 123u, 1u);
+    const auto input = CreateNoise(48u * block_length, 2u);
+
+    const auto uniform_plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filter.size()), block_length, block_length);
+    const auto non_uniform_plan = CreateNonUniformPartitionPlan(static_cast<uint32_t>(filter.size()), block_length);
+    ASSERT_EQ(uniform_plan.tail_stage_count, 0u);
+    ASSERT_GT(non_uniform_plan.tail_stage_count, 0u);
+
+    const auto uniform = DeviceRunner<fft_length> {filter, uniform_plan}.Process(input, grain);
+    const auto non_uniform = DeviceRunner<fft_length> {filter, non_uniform_plan}.Process(input, grain);
+    const auto reference = Convolve(input, filter);
+
+    EXPECT_LT(MaxDifference(uniform, reference), 1e-3f);
+    EXPECT_LT(MaxDifference(non_uniform, uniform), 1e-3f);
+}
+
+TEST(FirProcessorDeviceTest, DirectFormMatchesReference) {
+    // grain does not divide the input and is shorter than the filter, so the history spans several calls
+    constexpr int grain = 96;
+    const std::vector<float> filters[2] = {CreateNoise(DIRECT_FORM_MAX_FILTER_LENGTH, 1u), CreateNoise(37u, 2u)};
+    const int input_length = 40 * grain + 17;
+    std::vector<float> input = CreateNoise(2u * input_length, 3u);
+    std::vector<float> output(input.size(), 0.f);
+    std::vector<float> history(2u * (DIRECT_FORM_MAX_FILTER_LENGTH - 1), 1.f);
+    float* input_ptr = input.data();
+    float* output_ptr = output.data();
+
+    fir::ProcessorParameter params {};
+    params.input_length = input_length;
+    params.grain = grain;
+    params.history = history.data();
+    params.history_length = DIRECT_FORM_MAX_FILTER_LENGTH - 1;
+    params.filter_length_to_translate_init = 1;
+
+    fir::ChannelDescriptor channels[2] {};
+    params.channels = channels;
+
+    FirProcessor::FirProcessorDevice<float> device;
+    for (int channel = 0; channel < 2; ++channel) {
+        channels[channel].real_filter = filters[channel].data();
+        params.filter_length = static_cast<int>(filters[channel].size());
+        const auto shared_mem_size = static_cast<uint32_t>((2 * filters[channel].size() + grain) * sizeof(float));
+        for (uint32_t call = 0; call < static_cast<uint32_t>((input_length + grain - 1) / grain); ++call) {
+            CpuTestContext::RunBlock(call, static_cast<uint32_t>(channel), DIRECT_FORM_THREAD_COUNT, shared_mem_size, [&](CpuTestContext context) {
+                device.processDirect(context, &params, nullptr, &input_ptr, &output_ptr);
+            });
+        }
+
+        const std::vector<float> channel_input(input.begin() + channel * input_length, input.begin() + (channel + 1) * input_length);
+        const std::vector<float> channel_output(output.begin() + channel * input_length, output.begin() + (channel + 1) * input_length);
+        EXPECT_LT(MaxDifference(channel_output, Convolve(channel_input, filters[channel])), 1e-4f);
+    }
+}
+
+TEST(FirProcessorDeviceTest, SparseTapsMatchReference) {
+    // taps far behind the grain read the history ring, a short filter has a ring shorter than the grain
+    for (uint32_t filter_length : {3000u, 40u}) {
+        std::vector<std::vector<float>> filters(2u, std::vector<float>(filter_length, 0.f));
+        fir::SparseTaps taps[2] {};
+        for (int channel = 0; channel < 2; ++channel) {
+            const auto gains = CreateNoise(5u, 40u + channel);
+            for (int t = 0; t < 5; ++t) {
+                const int offset = t == 4 ? static_cast<int>(filter_length) - 1 : (t * 7 + channel * 3) * static_cast<int>(filter_length) / 40;
+                filters[channel][offset] = gains[t];
+                taps[channel].offsets[taps[channel].count] = offset;
+                taps[channel].gains[taps[channel].count++] = gains[t];
+            }
+        }
+
+        for (int grain : {96, 1024}) {
+            const int input_length = 20 * grain + 17;
+            std::vector<float> input = CreateNoise(2u * input_length, 41u);
+            std::vector<float> output(input.size(), 0.f);
+            std::vector<float> history(2u * (filter_length - 1), 1.f);
+            fir::ChannelState states[2] {};
+            fir::ChannelDescriptor channels[2] {};
+            channels[0].sparse_taps = &taps[0];
+            channels[1].sparse_taps = &taps[1];
+            float* input_ptr = input.data();
+            float* output_ptr = output.data();
+
+            fir::ProcessorParameter params {};
+            params.input_length = input_length;
+            params.grain = grain;
+            params.history = history.data();
+            params.history_length = static_cast<int>(filter_length) - 1;
+            params.channels = channels;
+            params.channel_states = states;
+
+            FirProcessor::FirProcessorDevice<float> device;
+            for (uint32_t call = 0; call < static_cast<uint32_t>((input_length + grain - 1) / grain); ++call) {
+                params.filter_length_to_translate_init = call == 0 ? 1 : 0;
+                for (uint32_t channel = 0; channel < 2u; ++channel) {
+                    CpuTestContext::RunBlock(call, channel, SPARSE_THREAD_COUNT, 0u, [&](CpuTestContext context) {
+                        device.processSparse(context, &params, nullptr, &input_ptr, &output_ptr);
+                    });
+                }
+            }
+
+            for (int channel = 0; channel < 2; ++channel) {
+                const std::vector<float> channel_input(input.begin() + channel * input_length, input.begin() + (channel + 1) * input_length);
+                const std::vector<float> channel_output(output.begin() + channel * input_length, output.begin() + (channel + 1) * input_length);
+                EXPECT_LT(MaxDifference(channel_output, Convolve(channel_input, filters[channel])), 1e-4f);
+            }
+        }
+    }
+}
+
+TEST(FirProcessorDeviceTest, HybridMatchesReference) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    constexpr int grain = 48;
+    const auto filter = CreateNoise(9u * fft_length + 77u, 4u);
+    const auto input = CreateNoise(24u * fft_length, 5u);
+    const auto reference = Convolve(input, filter);
+
+    const auto plan = CreateHybridPartitionPlan(static_cast<uint32_t>(filter.size()), fft_length + 64u, fft_length);
+    const auto hybrid = DeviceRunner<fft_length> {filter, plan}.Process(input, grain);
+    EXPECT_LT(MaxDifference(hybrid, reference), 1e-3f);
+}
+
+TEST(FirProcessorDeviceTest, StereoMatchesPerChannel) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const std::vector<std::vector<float>> filters = {CreateNoise(5u * fft_length + 31u, 6u), CreateNoise(5u * fft_length + 31u, 7u)};
+    const auto input = CreateNoise(2u * 20u * fft_length, 8u);
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filters[0].size()), fft_length, fft_length);
+
+    // a grain that does not divide the segment exercises the partial segments as well
+    for (int grain : {fft_length, 96}) {
+        const auto per_channel = DeviceRunner<fft_length> {filters, plan}.Process(input, grain);
+        const auto stereo = DeviceRunner<fft_length> {filters, plan}.ProcessStereo(input, grain);
+        EXPECT_LT(MaxDifference(stereo, per_channel), 1e-3f);
+
+        const std::vector<float> right_input(input.begin() + input.size() / 2, input.end());
+        const std::vector<float> right_output(stereo.begin() + stereo.size() / 2, stereo.end());
+        EXPECT_LT(MaxDifference(right_output, Convolve(right_input, filters[1])), 1e-3f);
+    }
+}
+
+TEST(FirProcessorDeviceTest, MatrixMatchesReference) {
+    // true-stereo: 2 inputs x 2 outputs with a separate impulse response per path
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    constexpr uint32_t input_count = 2u;
+    constexpr uint32_t output_count = 2u;
+    const size_t input_length = 16u * fft_length;
+    std::vector<std::vector<float>> filters;
+    for (uint32_t path = 0; path < input_count * output_count; ++path) {
+        filters.push_back(CreateNoise(3u * fft_length + 45u, 10u + path));
+    }
+    const auto input = CreateNoise(input_count * input_length, 9u);
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filters[0].size()), fft_length, fft_length);
+
+    for (int grain : {fft_length, 80}) {
+        const auto output = DeviceRunner<fft_length> {filters, plan}.ProcessMatrix(input, grain, input_count);
+        ASSERT_EQ(output.size(), output_count * input_length);
+
+        for (uint32_t out = 0; out < output_count; ++out) {
+            std::vector<float> reference(input_length, 0.f);
+            for (uint32_t in = 0; in < input_count; ++in) {
+                const std::vector<float> channel_input(input.begin() + in * input_length, input.begin() + (in + 1) * input_length);
+                const auto contribution = Convolve(channel_input, filters[in * output_count + out]);
+                std::transform(reference.begin(), reference.end(), contribution.begin(), reference.begin(), std::plus<float>());
+            }
+            const std::vector<float> channel_output(output.begin() + out * input_length, output.begin() + (out + 1) * input_length);
+            EXPECT_LT(MaxDifference(channel_output, reference), 1e-3f);
+        }
+    }
+}
+
+TEST(FirProcessorDeviceTest, ManyChannelsMatchReference) {
+    // 7.1.4 layout: every channel has its own impulse response and state, including the tail stages
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    constexpr uint32_t channel_count = 12u;
+    const size_t input_length = 24u * fft_length;
+    std::vector<std::vector<float>> filters;
+    for (uint32_t channel = 0; channel < channel_count; ++channel) {
+        filters.push_back(CreateNoise(9u * fft_length + 77u, 20u + channel));
+    }
+    const auto input = CreateNoise(channel_count * input_length, 19u);
+    const auto plan = CreateNonUniformPartitionPlan(static_cast<uint32_t>(filters[0].size()), fft_length);
+    ASSERT_GT(plan.tail_stage_count, 0u);
+
+    const auto output = DeviceRunner<fft_length> {filters, plan}.Process(input, 96);
+    for (uint32_t channel = 0; channel < channel_count; ++channel) {
+        const std::vector<float> channel_input(input.begin() + channel * input_length, input.begin() + (channel + 1) * input_length);
+        const std::vector<float> channel_output(output.begin() + channel * input_length, output.begin() + (channel + 1) * input_length);
+        EXPECT_LT(MaxDifference(channel_output, Convolve(channel_input, filters[channel])), 1e-3f);
+    }
+}
+
+TEST(FirProcessorDeviceTest, SlicedMatchesSingleBlock) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const std::vector<std::vector<float>> filters = {CreateNoise(23u * fft_length + 101u, 30u), CreateNoise(23u * fft_length + 101u, 31u)};
+    const auto input = CreateNoise(2u * 40u * fft_length, 32u);
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filters[0].size()), fft_length, fft_length);
+    const auto slice_count = SelectSegmentSliceCount(plan.head_segment_count, 5u);
+    ASSERT_GT(slice_count, 1u);
+
+    // a grain that does not divide the segment starts segments in the middle of a call
+    for (int grain : {fft_length, 96}) {
+        const auto single = DeviceRunner<fft_length> {filters, plan}.Process(input, grain);
+        const auto sliced = DeviceRunner<fft_length> {filters, plan}.ProcessSliced(input, grain, slice_count);
+        EXPECT_LT(MaxDifference(sliced, single), 1e-3f);
+
+        const std::vector<float> left_input(input.begin(), input.begin() + input.size() / 2);
+        const std::vector<float> left_output(sliced.begin(), sliced.begin() + sliced.size() / 2);
+        EXPECT_LT(MaxDifference(left_output, Convolve(left_input, filters[0])), 1e-3f);
+    }
+}
+
+TEST(PartitionPlanTest, ActiveSegments) {
+    std::vector<float> filter(10u * 16u, 0.f);
+    filter[3] = 1.f;
+    filter[4u * 16u + 7u] = 0.5f;
+    // -140 dB relative to the loudest segment
+    filter[6u * 16u] = 1e-7f;
+    EXPECT_EQ(FindActiveSegments(filter.data(), static_cast<uint32_t>(filter.size()), 16u, 10u), (std::vector<int> {4}));
+    // the last segment only partially covers the filter
+    filter[9u * 16u + 2u] = 1.f;
+    EXPECT_EQ(FindActiveSegments(filter.data(), 9u * 16u + 3u, 16u, 10u), (std::vector<int> {4, 9}));
+    EXPECT_TRUE(FindActiveSegments(filter.data(), 16u, 16u, 1u).empty());
+}
+
+TEST(FirProcessorDeviceTest, SilentSegmentsAreSkipped) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const auto input = CreateNoise(2u * 40u * fft_length, 33u);
+
+    // a pure delay only accumulates the segment holding the impulse besides segment 0
+    std::vector<float> delay(23u * fft_length + 101u, 0.f);
+    delay[17u * fft_length + 5u] = 1.f;
+    const auto delay_plan = CreateUniformPartitionPlan(static_cast<uint32_t>(delay.size()), fft_length, fft_length);
+    DeviceRunner<fft_length> delay_runner {delay, delay_plan};
+    EXPECT_EQ(delay_runner.GetActiveSegmentCount(0u), 1u);
+    const std::vector<float> mono_input(input.begin(), input.begin() + input.size() / 2);
+    EXPECT_LT(MaxDifference(delay_runner.Process(mono_input, 96), Convolve(mono_input, delay)), 1e-3f);
+
+    // sparse reflections: the slices and the stereo task skip the silent segments as well
+    std::vector<std::vector<float>> filters(2u, std::vector<float>(delay.size(), 0.f));
+    for (uint32_t channel = 0; channel < 2u; ++channel) {
+        const auto noise = CreateNoise(fft_length, 34u + channel);
+        for (uint32_t segment : {0u, 1u, 6u, 7u, 15u + channel}) {
+            std::copy(noise.begin(), noise.end(), filters[channel].begin() + segment * fft_length);
+        }
+    }
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(delay.size()), fft_length, fft_length);
+    for (int grain : {fft_length, 96}) {
+        DeviceRunner<fft_length> runner {filters, plan};
+        EXPECT_EQ(runner.GetActiveSegmentCount(1u), 4u);
+        const auto output = runner.Process(input, grain);
+        const auto stereo = DeviceRunner<fft_length> {filters, plan}.ProcessStereo(input, grain);
+        const auto sliced = DeviceRunner<fft_length> {filters, plan}.ProcessSliced(input, grain, SelectSegmentSliceCount(plan.head_segment_count, 5u));
+        EXPECT_LT(MaxDifference(stereo, output), 1e-3f);
+        EXPECT_LT(MaxDifference(sliced, output), 1e-3f);
+
+        const std::vector<float> right_input(input.begin() + input.size() / 2, input.end());
+        const std::vector<float> right_output(output.begin() + output.size() / 2, output.end());
+        EXPECT_LT(MaxDifference(right_output, Convolve(right_input, filters[1])), 1e-3f);
+    }
+}
+
+TEST(FirProcessorDeviceTest, TrimmedFilterWithOutputDelay) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const auto input = CreateNoise(2u * 24u * fft_length, 36u);
+    const auto tail = CreateNoise(3u * fft_length + 19u, 37u);
+
+    // delays shorter and longer than a call, the delay line starts with garbage that the filter change clears
+    for (uint32_t delay : {50u, 7u * fft_length + 3u}) {
+        std::vector<std::vector<float>> filters(2u, std::vector<float>(delay, 0.f));
+        for (auto& filter : filters) {
+            filter.insert(filter.end(), tail.begin(), tail.end());
+        }
+        const std::vector<std::vector<float>> trimmed(2u, tail);
+        const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(tail.size()), fft_length, fft_length);
+
+        for (int grain : {fft_length, 96}) {
+            DeviceRunner<fft_length> runner {trimmed, plan};
+            runner.SetOutputDelay(delay);
+            const auto output = runner.Process(input, grain);
+            DeviceRunner<fft_length> stereo_runner {trimmed, plan};
+            stereo_runner.SetOutputDelay(delay);
+            const auto stereo = stereo_runner.ProcessStereo(input, grain);
+
+            for (uint32_t channel = 0; channel < 2u; ++channel) {
+                const std::vector<float> channel_input(input.begin() + channel * input.size() / 2, input.begin() + (channel + 1) * input.size() / 2);
+                const auto reference = Convolve(channel_input, filters[channel]);
+                const std::vector<float> channel_output(output.begin() + channel * output.size() / 2, output.begin() + (channel + 1) * output.size() / 2);
+                const std::vector<float> stereo_output(stereo.begin() + channel * stereo.size() / 2, stereo.begin() + (channel + 1) * stereo.size() / 2);
+                EXPECT_LT(MaxDifference(channel_output, reference), 1e-3f);
+                EXPECT_LT(MaxDifference(stereo_output, reference), 1e-3f);
+            }
+        }
+    }
+}
+
+TEST(FirProcessorDeviceTest, SilentInputSkipsTransforms) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const std::vector<std::vector<float>> filters = {CreateNoise(5u * fft_length + 37u, 38u), CreateNoise(5u * fft_length + 37u, 39u)};
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filters[0].size()), fft_length, fft_length);
+
+    // the left channel is silent in between and at the end, the right channel never
+    const size_t input_length = 40u * fft_length;
+    auto input = CreateNoise(2u * input_length, 40u);
+    std::fill(input.begin() + 8u * fft_length, input.begin() + 24u * fft_length + 37u, 0.f);
+    std::fill(input.begin() + 30u * fft_length, input.begin() + input_length, 0.f);
+
+    for (int grain : {fft_length, 96}) {
+        DeviceRunner<fft_length> runner {filters, plan};
+        const auto output = runner.Process(input, grain);
+        const auto sliced = DeviceRunner<fft_length> {filters, plan}.ProcessSliced(input, grain, 2u);
+        EXPECT_EQ(runner.GetChannelState(0u).idle, 1);
+        EXPECT_EQ(runner.GetChannelState(1u).idle, 0);
+        EXPECT_LT(MaxDifference(sliced, output), 1e-3f);
+
+        for (uint32_t channel = 0; channel < 2u; ++channel) {
+            const std::vector<float> channel_input(input.begin() + channel * input_length, input.begin() + (channel + 1) * input_length);
+            const std::vector<float> channel_output(output.begin() + channel * input_length, output.begin() + (channel + 1) * input_length);
+            EXPECT_LT(MaxDifference(channel_output, Convolve(channel_input, filters[channel])), 1e-3f);
+        }
+        // the tail of the left channel has decayed completely
+        EXPECT_TRUE(std::all_of(output.begin() + 36u * fft_length, output.begin() + input_length, [](float value) { return value == 0.f; }));
+    }
+}
+
+TEST(FirProcessorDeviceTest, SilentInputSkipsTailStages) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const auto filter = CreateNoise(21u * fft_length + 123u, 41u);
+    const auto plan = CreateNonUniformPartitionPlan(static_cast<uint32_t>(filter.size()), fft_length);
+    ASSERT_GT(plan.tail_stage_count, 0u);
+
+    // silent for longer than the filter in between, so every stage stops and resumes, and at the end
+    const size_t input_length = 96u * fft_length;
+    auto input = CreateNoise(input_length, 42u);
+    std::fill(input.begin() + 16u * fft_length, input.begin() + 40u * fft_length + 11u, 0.f);
+    std::fill(input.begin() + 48u * fft_length, input.end(), 0.f);
+
+    for (int grain : {fft_length / 4, 96}) {
+        DeviceRunner<fft_length> runner {filter, plan};
+        const auto output = runner.Process(input, grain);
+        EXPECT_LT(MaxDifference(output, Convolve(input, filter)), 1e-3f);
+        EXPECT_EQ(runner.GetChannelState(0u).idle, 1);
+        for (uint32_t stage = 0; stage < plan.tail_stage_count; ++stage) {
+            EXPECT_EQ(runner.GetChannelState(0u).tail_silent_blocks[stage], static_cast<int>(plan.tail_stages[stage].segments_count)) << "stage " << stage;
+        }
+    }
+
+    // the head skips its transforms after a few silent segments, while the tail stage still holds signal
+    DeviceRunner<fft_length> runner {filter, plan};
+    runner.Process(std::vector<float>(input.begin(), input.begin() + 20u * fft_length), fft_length / 4);
+    EXPECT_GE(runner.GetChannelState(0u).silent_segments, static_cast<int>(plan.head_segment_count));
+    EXPECT_EQ(runner.GetChannelState(0u).idle, 0);
+}
+
+TEST(FirProcessorDeviceTest, SilentInputSkipsStereoAndMatrixTransforms) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    constexpr uint32_t channel_count = 2u;
+    const size_t input_length = 40u * fft_length;
+    auto input = CreateNoise(channel_count * input_length, 43u);
+    for (uint32_t channel = 0; channel < channel_count; ++channel) {
+        const auto begin = input.begin() + channel * input_length;
+        std::fill(begin + 8u * fft_length, begin + 24u * fft_length + 37u, 0.f);
+        std::fill(begin + 30u * fft_length, begin + input_length, 0.f);
+    }
+    const auto channel_input = [&input, input_length](uint32_t channel) {
+        return std::vector<float>(input.begin() + channel * input_length, input.begin() + (channel + 1) * input_length);
+    };
+    const auto channel_output = [input_length](const std::vector<float>& output, uint32_t channel) {
+        return std::vector<float>(output.begin() + channel * input_length, output.begin() + (channel + 1) * input_length);
+    };
+
+    const std::vector<std::vector<float>> filters = {CreateNoise(5u * fft_length + 31u, 44u), CreateNoise(5u * fft_length + 31u, 45u)};
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filters[0].size()), fft_length, fft_length);
+    std::vector<std::vector<float>> paths;
+    for (uint32_t path = 0; path < channel_count * channel_count; ++path) {
+        paths.push_back(CreateNoise(3u * fft_length + 45u, 46u + path));
+    }
+    const auto matrix_plan = CreateUniformPartitionPlan(static_cast<uint32_t>(paths[0].size()), fft_length, fft_length);
+
+    for (int grain : {fft_length, 96}) {
+        DeviceRunner<fft_length> stereo_runner {filters, plan};
+        const auto stereo = stereo_runner.ProcessStereo(input, grain);
+        EXPECT_EQ(stereo_runner.GetChannelState(0u).idle, 1);
+        for (uint32_t channel = 0; channel < channel_count; ++channel) {
+            EXPECT_LT(MaxDifference(channel_output(stereo, channel), Convolve(channel_input(channel), filters[channel])), 1e-3f);
+        }
+
+        DeviceRunner<fft_length> matrix_runner {paths, matrix_plan};
+        const auto matrix = matrix_runner.ProcessMatrix(input, grain, channel_count);
+        EXPECT_EQ(matrix_runner.GetChannelState(0u).idle, 1);
+        for (uint32_t out = 0; out < channel_count; ++out) {
+            std::vector<float> reference(input_length, 0.f);
+            for (uint32_t in = 0; in < channel_count; ++in) {
+                const auto contribution = Convolve(channel_input(in), paths[in * channel_count + out]);
+                std::transform(reference.begin(), reference.end(), contribution.begin(), reference.begin(), std::plus<float>());
+            }
+            EXPECT_LT(MaxDifference(channel_output(matrix, out), reference), 1e-3f);
+        }
+    }
+}
+
+TEST(SpectrumBuilderTest, RealFftMatchesDeviceTransform) {
+    using Fft = FFTParameters<MIN_FFT_WIDTH>::config;
+    // odd lengths are zero padded like the last segment of a filter
+    for (uint32_t length : {2u * MIN_FFT_WIDTH, 301u}) {
+        const auto input = CreateNoise(length, 41u);
+        std::vector<float2> host(MIN_FFT_WIDTH);
+        RealFft {MIN_FFT_WIDTH}.Transform(input.data(), length, host.data());
+
+        std::vector<float> device(2u * MIN_FFT_WIDTH, 0.f);
+        std::copy(input.begin(), input.end(), device.begin());
+        CpuTestContext::RunBlock(0u, 0u, Fft::fft_length_quarter, GetTransformSharedMemorySize(MIN_FFT_WIDTH), [&](CpuTestContext context) {
+            float* s_data = context.smem_offset<float>(0);
+            for (uint32_t i = context.threadId(); i < 2u * MIN_FFT_WIDTH; i += context.blockDim()) {
+                s_data[i] = device[i];
+            }
+            dsp::FftCalculator<float>::processR2C<2 * MIN_FFT_WIDTH>(context, s_data, s_data);
+            for (uint32_t i = context.threadId(); i < 2u * MIN_FFT_WIDTH; i += context.blockDim()) {
+                device[i] = s_data[i];
+            }
+        });
+
+        for (uint32_t k = 0; k < MIN_FFT_WIDTH; ++k) {
+            EXPECT_NEAR(host[k].x, device[2u * k], 1e-3f) << "bin " << k;
+            EXPECT_NEAR(host[k].y, device[2u * k + 1u], 1e-3f) << "bin " << k;
+        }
+    }
+}
+
+TEST(SpectrumBuilderTest, ReducedPrecisionLayout) {
+    const auto filter = CreateNoise(3u * 64u + 5u, 42u);
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filter.size()), 64u, 64u);
+    std::vector<uint8_t> full;
+    std::vector<uint8_t> half;
+    SpectrumBuilder {plan, SPECTRUM_FLOAT32}.Build(filter.data(), static_cast<uint32_t>(filter.size()), full);
+    SpectrumBuilder {plan, SPECTRUM_FLOAT16}.Build(filter.data(), static_cast<uint32_t>(filter.size()), half);
+    ASSERT_EQ(full.size(), plan.spectrum_length * sizeof(float2));
+    ASSERT_EQ(half.size(), plan.spectrum_length * sizeof(fir::Half2Spectrum));
+
+    const auto* bins = reinterpret_cast<const float2*>(full.data());
+    const auto* packed = reinterpret_cast<const fir::Half2Spectrum*>(half.data());
+    for (uint32_t i = 0; i < plan.spectrum_length; ++i) {
+        const float2 value = fir::SpectrumStorage<fir::Half2Spectrum>::load(packed[i]);
+        EXPECT_NEAR(value.x, bins[i].x, 1e-2f * (1.f + std::abs(bins[i].x)));
+        EXPECT_NEAR(value.y, bins[i].y, 1e-2f * (1.f + std::abs(bins[i].y)));
+    }
+}
+
+TEST(SpectrumStorageTest, HalfConversion) {
+    EXPECT_EQ(fir::floatToHalf(1.f), 0x3C00u);
+    EXPECT_EQ(fir::floatToHalf(-2.f), 0xC000u);
+    EXPECT_EQ(fir::floatToHalf(65504.f), 0x7BFFu);
+    EXPECT_EQ(fir::floatToHalf(1e6f), 0x7C00u);
+    // smallest subnormal and round to nearest even
+    EXPECT_EQ(fir::floatToHalf(5.9604645e-8f), 0x0001u);
+    EXPECT_EQ(fir::floatToHalf(1.f + 1.f / 2048.f), 0x3C00u);
+    EXPECT_EQ(fir::floatToHalf(1.f + 3.f / 2048.f), 0x3C02u);
+    for (float value : {0.f, 1.f, -0.5f, 3.140625f, 6.1035156e-05f, 1.1920929e-07f, 65504.f}) {
+        EXPECT_EQ(fir::halfToFloat(fir::floatToHalf(value)), value);
+    }
+    EXPECT_EQ(fir::bfloatToFloat(fir::floatToBFloat(-3.f)), -3.f);
+    EXPECT_EQ(fir::floatToBFloat(1.f + 1.f / 256.f), 0x3F80u);
+}
+
+TEST(FirProcessorDeviceTest, ReducedPrecisionSpectraSnr) {
+    constexpr int fft_length = MIN_FFT_WIDTH;
+    const auto filter = CreateNoise(13u * fft_length + 57u, 40u);
+    const auto input = CreateNoise(32u * fft_length, 41u);
+    const auto plan = CreateNonUniformPartitionPlan(static_cast<uint32_t>(filter.size()), fft_length);
+    const auto reference = Convolve(input, filter);
+
+    struct Case {
+        int ir_precision;
+        int input_precision;
+        double min_snr;
+    };
+    for (const Case& c : {Case {SPECTRUM_FLOAT32, SPECTRUM_FLOAT32, 100.0}, Case {SPECTRUM_FLOAT16, SPECTRUM_FLOAT32, 60.0},
+             Case {SPECTRUM_FLOAT16, SPECTRUM_FLOAT16, 55.0}, Case {SPECTRUM_BFLOAT16, SPECTRUM_FLOAT32, 40.0},
+             Case {SPECTRUM_BFLOAT16, SPECTRUM_BFLOAT16, 35.0}}) {
+        DeviceRunner<fft_length> runner {filter, plan};
+        runner.SetSpectrumPrecision(c.ir_precision, c.input_precision);
+        const double snr = SignalToNoiseRatio(runner.Process(input, 96), reference);
+        RecordProperty("snr_" + std::to_string(c.ir_precision) + "_" + std::to_string(c.input_precision), std::to_string(snr));
+        EXPECT_GT(snr, c.min_snr) << "precision " << c.ir_precision << "/" << c.input_precision;
+    }
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "TestMemoryManager.h"
+
+#include "../src/FirProcessor.h"
+#include "../src/GpuMemoryPool.h"
+#include "../src/SpectrumCache.h"
+#include "../src/convolution_filter/StaticIRShare.h"
+
+#include <processor_api/OutputPort.h>
+#include <processor_api/PortFactory.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const float* GetSamples(GPUA::processor::v2::GpuPointer pointer) {
+    return reinterpret_cast<const float*>(pointer);
+}
+
+// the port the processor reads from and the one it writes to
+class TestOutputPort : public GPUA::processor::v2::OutputPort {
+public:
+    explicit TestOutputPort(const GPUA::processor::v2::PortInfo& info) :
+        m_info(info) {}
+
+    GPUA::processor::v2::PortInfo& GetPortInfo() const override {
+        return m_info;
+    }
+
+    GPUA::processor::v2::PortId GetPortId() const override {
+        return 0u;
+    }
+
+    void Changed(GPUA::processor::v2::PortChangedFlags) override {}
+
+    mutable GPUA::processor::v2::PortInfo m_info;
+};
+
+class TestPortFactory : public GPUA::processor::v2::PortFactory {
+public:
+    GPUA::processor::v2::OutputPortPointer CreateDataPort(uint32_t, const GPUA::processor::v2::PortInfo& info) override {
+        return {new TestOutputPort(info), [](GPUA::processor::v2::OutputPort* port) { delete port; }};
+    }
+};
+
+GPUA::processor::v2::PortInfo CreateInputPortInfo(uint32_t buffer_length, uint32_t channel_count) {
+    GPUA::processor::v2::PortInfo info {};
+    info.type = GPUA::processor::v2::PortType::eRegularPort;
+    info.data_type = GPUA::processor::v2::PortDataType::eSample32;
+    info.capacity_in_bytes = buffer_length * static_cast<uint32_t>(sizeof(float));
+    info.size_in_bytes = info.capacity_in_bytes;
+    info.channel_count = channel_count;
+    info.grain = buffer_length;
+    info.is_produced = true;
+    return info;
+}
+
+uint32_t GetFilterLength(const FirProcessor& processor) {
+    FirConfig::FilterInfo info;
+    uint32_t size = sizeof(info);
+    return processor.GetData(&info, size) == GPUA::processor::v2::ErrorCode::eSuccess ? info.filter_length : 0u;
+}
+
+// runs PrepareForProcess like the engine until the processor switched to a filter of `filter_length` samples
+bool WaitForFilterLength(FirProcessor& processor, uint32_t filter_length) {
+    const GPUA::processor::v2::LaunchData launch_data {nullptr, 0u};
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (std::chrono::steady_clock::now() < deadline) {
+        processor.PrepareForProcess(launch_data, 1u);
+        if (GetFilterLength(processor) == filter_length) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+void RequestFilter(FirProcessor& processor, uint32_t choice) {
+    FirConfig::Parameters parameters;
+    parameters.ir_index = choice;
+    processor.SetData(&parameters, sizeof(parameters));
+}
+
+// the spectra of the tests are not kept on disk
+void DisableSpectrumCache() {
+    StaticIRShare::GetSpectrumCache().SetBudget(0u);
+}
+
+} // namespace
+
+TEST(StaticIRShareTest, SharesBuffersOfTheSameSamples) {
+    DisableSpectrumCache();
+    CountingMemoryManager memory_manager;
+
+    StaticIRShare first {memory_manager, 1024u, 10u};
+    const auto raw = first.getRawIR(0u);
+    EXPECT_EQ(GetSamples(raw)[0], 1.f);
+    const uint32_t allocation_count = memory_manager.m_allocation_count;
+    const uint32_t upload_count = memory_manager.m_upload_count;
+
+    // the same impulse response uses the buffers of the first instance without uploading it again
+    StaticIRShare second {memory_manager, 1024u, 10u};
+    EXPECT_EQ(second.getRawIR(0u), raw);
+    EXPECT_EQ(memory_manager.m_allocation_count, allocation_count);
+    EXPECT_EQ(memory_manager.m_upload_count, upload_count);
+
+    // other samples get buffers of their own, also if only the position of the impulse differs
+    StaticIRShare other {memory_manager, 1024u, 20u};
+    EXPECT_NE(other.getRawIR(0u), raw);
+    StaticIRShare longer {memory_manager, 2048u, 10u};
+    EXPECT_NE(longer.getRawIR(0u), raw);
+
+    // switching to the samples of another instance shares its buffers
+    other.GenerateIR(1024u, 10u);
+    EXPECT_EQ(other.getRawIR(0u), raw);
+}
+
+TEST(StaticIRShareTest, AcquireAndReleaseAcrossThreads) {
+    DisableSpectrumCache();
+    CountingMemoryManager memory_manager;
+    const auto pool = GpuMemoryPool::GetShared(memory_manager);
+
+    // few keys for many threads, so entries are acquired, released and removed while others look them up
+    constexpr uint32_t thread_count = 8u;
+    constexpr uint32_t iteration_count = 200u;
+    std::atomic<uint32_t> mismatches {0u};
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 0; thread < thread_count; ++thread) {
+        threads.emplace_back([&memory_manager, &mismatches, thread] {
+            for (uint32_t iteration = 0; iteration < iteration_count; ++iteration) {
+                const uint32_t location = (thread + iteration) % 4u;
+                StaticIRShare filter {memory_manager, 256u, location};
+                StaticIRShare same {memory_manager, 256u, location};
+                const auto raw = filter.getRawIR(0u);
+                // the trimmed impulse starts the filter, the rest stays silent
+                if (same.getRawIR(0u) != raw || GetSamples(raw)[0] != 1.f || GetSamples(raw)[1] != 0.f) {
+                    ++mismatches;
+                }
+                if (iteration % 2u == 0u) {
+                    filter.GenerateIR(256u, (location + 1u) % 4u);
+                    if (GetSamples(filter.getRawIR(0u))[0] != 1.f) {
+                        ++mismatches;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(mismatches, 0u);
+    // the last user of every entry removed it and its buffers went back to the pool
+    EXPECT_EQ(pool->GetStatistics().in_use_bytes, 0u);
+}
+
+TEST(FirProcessorTest, PortChangesWithinBoundsDoNotAllocate) {
+    DisableSpectrumCache();
+    CountingMemoryManager memory_manager;
+    const auto pool = GpuMemoryPool::GetShared(memory_manager);
+    TestPortFactory port_factory;
+    GPUA::processor::v2::ModuleBase module;
+
+    // the generated impulse response of 8192 samples is trimmed to its last 4096, the matrix mode convolves it with
+    // the partitioned convolution, whose layout depends on the port capacity
+    constexpr uint32_t max_channel_count = 4u;
+    constexpr uint32_t matrix_output_count = 2u;
+    FirConfig::Specification specification;
+    specification.last_choice = static_cast<uint32_t>(-8192);
+    specification.matrix_output_count = matrix_output_count;
+    specification.max_channel_count = max_channel_count;
+    GPUA::processor::v2::ProcessorSpecification processor_specification {port_factory, memory_manager, &specification, sizeof(specification)};
+    FirProcessor processor {processor_specification, module};
+
+    TestOutputPort input {CreateInputPortInfo(4096u, 1u)};
+    ASSERT_EQ(processor.Connect(input), GPUA::processor::v2::ErrorCode::eSuccess);
+
+    const uint32_t allocation_count = memory_manager.m_allocation_count;
+    const uint64_t reuse_count = pool->GetStatistics().reuses;
+    for (const uint32_t buffer_length : {32u, 128u, 256u, 480u, 1024u, 2048u, 8192u, 64u}) {
+        for (const uint32_t channel_count : {1u, 3u, max_channel_count, 2u}) {
+            const uint64_t uploaded_bytes = memory_manager.m_uploaded_bytes;
+            input.m_info = CreateInputPortInfo(buffer_length, channel_count);
+            EXPECT_EQ(processor.InputPortUpdated(GPUA::processor::v2::PortChangedFlags::eCapacityChanged | GPUA::processor::v2::PortChangedFlags::eChannelCountChanged, input),
+                GPUA::processor::v2::ErrorCode::eSuccess);
+
+            // neither the buffers of the processor nor the ones of the shared impulse response are allocated, and only
+            // the channel table is uploaded: the filter and its spectra are already on the device
+            EXPECT_EQ(memory_manager.m_allocation_count, allocation_count) << "port " << buffer_length << " x " << channel_count;
+            EXPECT_EQ(pool->GetStatistics().reuses, reuse_count) << "port " << buffer_length << " x " << channel_count;
+            EXPECT_LE(memory_manager.m_uploaded_bytes - uploaded_bytes, channel_count * matrix_output_count * sizeof(fir::ChannelDescriptor));
+        }
+    }
+}
+
+TEST(FirProcessorTest, LoaderPreparesFilterChanges) {
+    DisableSpectrumCache();
+    CountingMemoryManager memory_manager;
+    TestPortFactory port_factory;
+    GPUA::processor::v2::ModuleBase module;
+    constexpr auto port_flags = GPUA::processor::v2::PortChangedFlags::eCapacityChanged | GPUA::processor::v2::PortChangedFlags::eChannelCountChanged;
+
+    // without declared bounds the loader builds the layout of the port at the request only. the generated impulse
+    // responses keep the second half of their length, the matrix mode convolves them in the frequency domain
+    FirConfig::Specification specification;
+    specification.last_choice = static_cast<uint32_t>(-4096);
+    specification.matrix_output_count = 2u;
+    GPUA::processor::v2::ProcessorSpecification processor_specification {port_factory, memory_manager, &specification, sizeof(specification)};
+    FirProcessor processor {processor_specification, module};
+    TestOutputPort input {CreateInputPortInfo(1024u, 1u)};
+    ASSERT_EQ(processor.Connect(input), GPUA::processor::v2::ErrorCode::eSuccess);
+    ASSERT_EQ(GetFilterLength(processor), 2048u);
+
+    // a longer impulse response needs larger buffers and other spectra, the loader allocates and builds them
+    uint32_t engine_allocation_count = memory_manager.m_engine_allocation_count;
+    RequestFilter(processor, static_cast<uint32_t>(-16384));
+    ASSERT_TRUE(WaitForFilterLength(processor, 8192u));
+    EXPECT_EQ(memory_manager.m_engine_allocation_count, engine_allocation_count);
+
+    // the port changes before the switch: the filter prepared for the previous port is kept back and prepared again
+    // for the current one instead of being built on the engine thread
+    RequestFilter(processor, static_cast<uint32_t>(-32768));
+    input.m_info = CreateInputPortInfo(256u, 3u);
+    ASSERT_EQ(processor.InputPortUpdated(port_flags, input), GPUA::processor::v2::ErrorCode::eSuccess);
+    engine_allocation_count = memory_manager.m_engine_allocation_count;
+    ASSERT_TRUE(WaitForFilterLength(processor, 16384u));
+    EXPECT_EQ(memory_manager.m_engine_allocation_count, engine_allocation_count);
+
+    // the loader releases the replaced impulse response, so another instance of it is uploaded again
+    bool released = false;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!released && std::chrono::steady_clock::now() < deadline) {
+        StaticIRShare replaced {memory_manager, 1024u, 10u};
+        replaced.GenerateIR(16384u, 8192u);
+        const uint32_t upload_count = memory_manager.m_upload_count;
+        replaced.getRawIR(0u);
+        released = memory_manager.m_upload_count != upload_count;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(released);
+}
+
+TEST(FirProcessorTest, LoaderReportsFailedRequests) {
+    DisableSpectrumCache();
+    CountingMemoryManager memory_manager;
+    TestPortFactory port_factory;
+    GPUA::processor::v2::ModuleBase module;
+
+    FirConfig::Specification specification;
+    specification.last_choice = static_cast<uint32_t>(-4096);
+    specification.matrix_output_count = 2u;
+    GPUA::processor::v2::ProcessorSpecification processor_specification {port_factory, memory_manager, &specification, sizeof(specification)};
+    FirProcessor processor {processor_specification, module};
+    TestOutputPort input {CreateInputPortInfo(1024u, 1u)};
+    ASSERT_EQ(processor.Connect(input), GPUA::processor::v2::ErrorCode::eSuccess);
+
+    const auto get_info = [&processor] {
+        FirConfig::FilterInfo info;
+        uint32_t size = sizeof(info);
+        EXPECT_EQ(processor.GetData(&info, size), GPUA::processor::v2::ErrorCode::eSuccess);
+        return info;
+    };
+    EXPECT_EQ(get_info().choice, static_cast<uint32_t>(-4096));
+
+    // the loader cannot allocate the buffers of the longer impulse response: the current one keeps playing and stays
+    // the committed choice, the failure is reported
+    memory_manager.m_fail_allocations = true;
+    RequestFilter(processor, static_cast<uint32_t>(-65536));
+    const GPUA::processor::v2::LaunchData launch_data {nullptr, 0u};
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (get_info().load_failures == 0u && std::chrono::steady_clock::now() < deadline) {
+        processor.PrepareForProcess(launch_data, 1u);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto info = get_info();
+    EXPECT_EQ(info.load_failures, 1u);
+    EXPECT_EQ(info.failed_choice, static_cast<uint32_t>(-65536));
+    EXPECT_EQ(info.choice, static_cast<uint32_t>(-4096));
+    EXPECT_EQ(info.loading, 0u);
+    EXPECT_EQ(info.filter_length, 2048u);
+
+    // the next request is loaded and committed once the processor switched to it
+    memory_manager.m_fail_allocations = false;
+    RequestFilter(processor, static_cast<uint32_t>(-16384));
+    ASSERT_TRUE(WaitForFilterLength(processor, 8192u));
+    info = get_info();
+    EXPECT_EQ(info.choice, static_cast<uint32_t>(-16384));
+    EXPECT_EQ(info.loading, 0u);
+    EXPECT_EQ(info.load_failures, 1u);
+}
+
+TEST(FirProcessorTest, RejectsUnsupportedSpectrumPrecisions) {
+    CountingMemoryManager memory_manager;
+    TestPortFactory port_factory;
+    GPUA::processor::v2::ModuleBase module;
+    const auto create = [&](FirConfig::SpectrumPrecision spectrum_precision, FirConfig::SpectrumPrecision input_spectrum_precision, uint32_t matrix_output_count) {
+        FirConfig::Specification specification;
+        specification.last_choice = static_cast<uint32_t>(-4096);
+        specification.spectrum_precision = spectrum_precision;
+        specification.input_spectrum_precision = input_spectrum_precision;
+        specification.matrix_output_count = matrix_output_count;
+        GPUA::processor::v2::ProcessorSpecification processor_specification {port_factory, memory_manager, &specification, sizeof(specification)};
+        FirProcessor processor {processor_specification, module};
+    };
+    using Precision = FirConfig::SpectrumPrecision;
+
+    EXPECT_NO_THROW(create(Precision::eFloat16, Precision::eFloat32, 0u));
+    EXPECT_NO_THROW(create(Precision::eBFloat16, Precision::eBFloat16, 0u));
+    EXPECT_NO_THROW(create(Precision::eFloat32, Precision::eFloat32, 2u));
+    // the input spectra use fp32 or the format of the impulse response spectra
+    EXPECT_THROW(create(Precision::eFloat16, Precision::eBFloat16, 0u), std::runtime_error);
+    EXPECT_THROW(create(Precision::eFloat32, Precision::eFloat16, 0u), std::runtime_error);
+    EXPECT_THROW(create(static_cast<Precision>(3u), Precision::eFloat32, 0u), std::runtime_error);
+    // the matrix mode only supports fp32
+    EXPECT_THROW(create(Precision::eFloat16, Precision::eFloat32, 2u), std::runtime_error);
+    EXPECT_THROW(create(Precision::eBFloat16, Precision::eBFloat16, 2u), std::runtime_error);
+}
+
+TEST(FirProcessorTest, ReportsIdleChannels) {
+    DisableSpectrumCache();
+    CountingMemoryManager memory_manager;
+    TestPortFactory port_factory;
+    GPUA::processor::v2::ModuleBase module;
+
+    FirConfig::Specification specification;
+    specification.last_choice = static_cast<uint32_t>(-8192);
+    specification.matrix_output_count = 2u;
+    GPUA::processor::v2::ProcessorSpecification processor_specification {port_factory, memory_manager, &specification, sizeof(specification)};
+    FirProcessor processor {processor_specification, module};
+    TestOutputPort input {CreateInputPortInfo(512u, 2u)};
+    ASSERT_EQ(processor.Connect(input), GPUA::processor::v2::ErrorCode::eSuccess);
+
+    const auto query = [&processor](uint32_t channel, uint32_t& idle) {
+        FirConfig::ChannelInfo info;
+        info.channel = channel;
+        uint32_t size = sizeof(info);
+        const auto result = processor.GetData(&info, size);
+        idle = info.idle;
+        return result;
+    };
+    uint32_t idle = 0u;
+    ASSERT_EQ(query(1u, idle), GPUA::processor::v2::ErrorCode::eSuccess);
+    EXPECT_EQ(idle, 0u);
+
+    // the device marks the channel idle, the matrix task keeps the state of all outputs in the first entry
+    fir::ProcessorParameter params {};
+    ASSERT_EQ(processor.PrepareChunk(&params, nullptr, 0u), GPUA::processor::v2::ErrorCode::eSuccess);
+    params.channel_states[0].idle = 1;
+    ASSERT_EQ(query(1u, idle), GPUA::processor::v2::ErrorCode::eSuccess);
+    EXPECT_EQ(idle, 1u);
+    EXPECT_EQ(query(2u, idle), GPUA::processor::v2::ErrorCode::eOutOfRange);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "TestMemoryManager.h"
+
+#include "../src/GpuMemoryPool.h"
+
+#include <gtest/gtest.h>
+
+TEST(GpuMemoryPoolTest, ReusesSizeClassesAcrossUsers) {
+    EXPECT_EQ(GpuMemoryPool::GetSizeClass(0u), 128u);
+    EXPECT_EQ(GpuMemoryPool::GetSizeClass(128u), 128u);
+    EXPECT_EQ(GpuMemoryPool::GetSizeClass(129u), 256u);
+    EXPECT_EQ(GpuMemoryPool::GetSizeClass(4096u), 4096u);
+    // above 4 KB the classes are a quarter of the octave apart
+    EXPECT_EQ(GpuMemoryPool::GetSizeClass(4097u), 5120u);
+    EXPECT_EQ(GpuMemoryPool::GetSizeClass(9000u), 10240u);
+
+    CountingMemoryManager memory_manager;
+    {
+        auto pool = GpuMemoryPool::GetShared(memory_manager);
+        EXPECT_EQ(GpuMemoryPool::GetShared(memory_manager), pool);
+
+        // a processor grows its buffer, the old block is left for the next one
+        auto first = pool->Allocate(1000u);
+        ASSERT_TRUE(first);
+        EXPECT_EQ(CountingMemoryManager::GetSize(*first), 1024u);
+        EXPECT_EQ(first.GetCapacity(), 1024u);
+        first = pool->Allocate(3000u);
+        auto second = pool->Allocate(900u);
+        EXPECT_EQ(memory_manager.m_allocation_count, 2u);
+
+        auto statistics = pool->GetStatistics();
+        EXPECT_EQ(statistics.allocations, 2u);
+        EXPECT_EQ(statistics.reuses, 1u);
+        EXPECT_EQ(statistics.allocated_bytes, 1024u + 3072u);
+        EXPECT_EQ(statistics.in_use_bytes, 1024u + 3072u);
+        EXPECT_EQ(statistics.requested_bytes, 3900u);
+        // the larger block is allocated before the smaller one is released
+        EXPECT_EQ(statistics.peak_requested_bytes, 4000u);
+        EXPECT_NEAR(statistics.GetFragmentation(), 1.0 - 3900.0 / 4096.0, 1e-9);
+
+        // free blocks count as fragmentation until they are used again or trimmed
+        second.reset();
+        statistics = pool->GetStatistics();
+        EXPECT_EQ(statistics.free_bytes, 1024u);
+        EXPECT_EQ(statistics.peak_allocated_bytes, 4096u);
+        EXPECT_NEAR(statistics.GetFragmentation(), 1.0 - 3000.0 / 4096.0, 1e-9);
+        pool->Trim();
+        EXPECT_EQ(memory_manager.m_live_count, 1u);
+        EXPECT_EQ(pool->GetStatistics().allocated_bytes, 3072u);
+
+        // nothing is kept beyond the free budget
+        pool->SetFreeBudget(0u);
+        first.reset();
+        EXPECT_EQ(memory_manager.m_live_count, 0u);
+        statistics = pool->GetStatistics();
+        EXPECT_EQ(statistics.allocated_bytes, 0u);
+        EXPECT_EQ(statistics.releases, 2u);
+
+        // blocks keep their pool, free blocks go back to the memory manager with it
+        pool->SetFreeBudget(DEFAULT_GPU_POOL_FREE_BUDGET);
+        first = pool->Allocate(200u);
+        pool.reset();
+        first.reset();
+    }
+    EXPECT_EQ(memory_manager.m_live_count, 0u);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "../src/ImpulseResponseCache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+TEST(ImpulseResponseCacheTest, EvictsLeastRecentlyUsedBeyondBudget) {
+    // every impulse response holds 256 samples and one gain
+    const size_t size = 257u * sizeof(float);
+    ImpulseResponseCache cache {11u, 3u * size};
+    uint32_t loads = 0;
+    const auto loader = [&loads](ImpulseResponse& impulse_response) {
+        ++loads;
+        impulse_response.channel_count = 1u;
+        impulse_response.length = 256u;
+        impulse_response.samples.assign(256u, static_cast<float>(loads));
+        impulse_response.gains.assign(1u, 1.f);
+        return true;
+    };
+
+    const auto first = cache.Get(0u, loader);
+    ASSERT_NE(first, nullptr);
+    EXPECT_EQ(cache.Get(1u, loader)->samples[0], 2.f);
+    EXPECT_EQ(cache.Get(2u, loader)->samples[0], 3.f);
+    // 0 becomes the most recently used, so 1 is evicted for 3
+    EXPECT_EQ(cache.Get(0u, loader), first);
+    cache.Get(3u, loader);
+    EXPECT_TRUE(cache.Contains(0u));
+    EXPECT_FALSE(cache.Contains(1u));
+    EXPECT_EQ(loads, 4u);
+
+    auto statistics = cache.GetStatistics();
+    EXPECT_EQ(statistics.hits, 1u);
+    EXPECT_EQ(statistics.misses, 4u);
+    EXPECT_EQ(statistics.evictions, 1u);
+    EXPECT_EQ(statistics.cached_count, 3u);
+    EXPECT_EQ(statistics.cached_bytes, 3u * size);
+
+    // evicted impulse responses stay valid for their users, pinned ones never count
+    cache.Pin(10u, std::make_shared<const ImpulseResponse>(ImpulseResponse {1u, 1u, 48000u, {1.f}, {1.f}}));
+    cache.SetMemoryBudget(size);
+    EXPECT_EQ(first->samples[0], 1.f);
+    EXPECT_TRUE(cache.Contains(3u));
+    EXPECT_TRUE(cache.Contains(10u));
+    EXPECT_FALSE(cache.Contains(0u));
+    statistics = cache.GetStatistics();
+    EXPECT_EQ(statistics.evictions, 3u);
+    EXPECT_EQ(statistics.cached_bytes, size);
+
+    EXPECT_EQ(cache.Get(4u, [](ImpulseResponse&) { return false; }), nullptr);
+    EXPECT_FALSE(cache.Contains(4u));
+}
+
+TEST(ImpulseResponseCacheTest, LoadsEachEntryOnceAcrossThreads) {
+    constexpr uint32_t KEY_COUNT = 16u;
+    constexpr uint32_t THREAD_COUNT = 8u;
+    constexpr uint32_t REQUEST_COUNT = 2000u;
+    const size_t size = 65u * sizeof(float);
+    // room for a few entries only, so loads and evictions race with hits
+    ImpulseResponseCache cache {KEY_COUNT, 4u * size};
+
+    std::vector<std::atomic<uint32_t>> loading(KEY_COUNT);
+    std::atomic<uint32_t> overlapping_loads {0u};
+    std::atomic<uint32_t> corrupt_reads {0u};
+    const auto create_loader = [&](uint32_t key) {
+        return [&, key](ImpulseResponse& impulse_response) {
+            if (loading[key].fetch_add(1u) != 0u) {
+                ++overlapping_loads;
+            }
+            impulse_response.channel_count = 1u;
+            impulse_response.length = 64u;
+            impulse_response.samples.assign(64u, static_cast<float>(key));
+            impulse_response.gains.assign(1u, 1.f);
+            std::this_thread::yield();
+            loading[key].fetch_sub(1u);
+            return true;
+        };
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 0; thread < THREAD_COUNT; ++thread) {
+        threads.emplace_back([&, thread] {
+            std::mt19937 random {thread};
+            std::uniform_int_distribution<uint32_t> keys {0u, KEY_COUNT - 1u};
+            for (uint32_t request = 0; request < REQUEST_COUNT; ++request) {
+                const uint32_t key = keys(random);
+                const auto impulse_response = cache.Get(key, create_loader(key));
+                if (impulse_response == nullptr || impulse_response->samples.size() != 64u ||
+                    std::any_of(impulse_response->samples.begin(), impulse_response->samples.end(), [key](float sample) { return sample != static_cast<float>(key); })) {
+                    ++corrupt_reads;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(overlapping_loads.load(), 0u);
+    EXPECT_EQ(corrupt_reads.load(), 0u);
+    const auto statistics = cache.GetStatistics();
+    EXPECT_EQ(statistics.hits + statistics.misses, uint64_t {THREAD_COUNT} * REQUEST_COUNT);
+    EXPECT_EQ(statistics.misses, statistics.evictions + statistics.cached_count);
+    EXPECT_LE(statistics.cached_bytes, 4u * size);
+    EXPECT_EQ(statistics.cached_bytes, statistics.cached_count * size);
+}
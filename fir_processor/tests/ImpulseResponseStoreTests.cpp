@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "TestWavFile.h"
+
+#include "../src/ImpulseResponseStore.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+// a float WAV file with the channels of `channels` interleaved
+void WriteFloatWavFile(const std::filesystem::path& path, const std::vector<std::vector<float>>& channels) {
+    const size_t length = channels.front().size();
+    std::vector<float> interleaved(channels.size() * length);
+    for (size_t channel = 0; channel < channels.size(); ++channel) {
+        for (size_t i = 0; i < length; ++i) {
+            interleaved[i * channels.size() + channel] = channels[channel][i];
+        }
+    }
+    std::vector<uint8_t> bytes(interleaved.size() * sizeof(float));
+    std::memcpy(bytes.data(), interleaved.data(), bytes.size());
+    WriteWavFile(path, 3u, static_cast<uint16_t>(channels.size()), 32u, bytes);
+}
+
+// `length` samples of noise behind `leading_zeros` zeros
+std::vector<float> CreateNoise(uint32_t length, uint32_t leading_zeros, uint32_t seed) {
+    std::mt19937 random {seed};
+    std::uniform_real_distribution<float> distribution {-1.f, 1.f};
+    std::vector<float> samples(length, 0.f);
+    for (uint32_t i = leading_zeros; i < length; ++i) {
+        samples[i] = distribution(random);
+    }
+    return samples;
+}
+
+bool IsSameKey(const SpectrumCache::ContentKey& a, const SpectrumCache::ContentKey& b) {
+    return a.hash == b.hash && a.check_hash == b.check_hash && a.filter_length == b.filter_length && a.channel_count == b.channel_count;
+}
+} // namespace
+
+TEST(ImpulseResponseStoreTest, AnalyzesEachEntryOnceAcrossThreads) {
+    const auto directory = std::filesystem::temp_directory_path() / "FirImpulseResponseStoreTest";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    // a tap delay, two dense impulse responses and a file that cannot be read
+    std::vector<float> taps(256u, 0.f);
+    taps[100] = 0.5f;
+    taps[150] = -0.25f;
+    taps[200] = 0.125f;
+    WriteFloatWavFile(directory / "taps.wav", {taps});
+    WriteFloatWavFile(directory / "stereo.wav", {CreateNoise(4096u, 37u, 1u), CreateNoise(4096u, 50u, 2u)});
+    WriteFloatWavFile(directory / "late.wav", {CreateNoise(2048u, 1000u, 3u)});
+    {
+        std::ofstream file(directory / "broken.wav", std::ios::binary | std::ios::trunc);
+        file << "RIFF0000WAVEnot a wav file";
+    }
+    struct Expected {
+        uint32_t leading_zero_count;
+        uint32_t sparse_tap_count;
+    };
+    const std::map<std::string, Expected> expected {{"taps.wav", {100u, 3u}}, {"stereo.wav", {37u, 0u}}, {"late.wav", {1000u, 0u}}, {"broken.wav", {0u, 0u}}};
+
+    ImpulseResponseStore store {directory, 1024u, 0u};
+    ASSERT_EQ(store.GetLoadedAudioFileCount(), expected.size());
+    // room for a single impulse response, so decodes and evictions race with the analysis
+    store.SetMemoryBudget(4096u * sizeof(float));
+    const int entry_count = static_cast<int>(store.GetLoadedAudioFileCount());
+
+    constexpr uint32_t THREAD_COUNT = 16u;
+    constexpr uint32_t REQUEST_COUNT = 500u;
+    std::atomic<bool> start {false};
+    std::atomic<uint32_t> wrong_results {0u};
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 0; thread < THREAD_COUNT; ++thread) {
+        threads.emplace_back([&, thread] {
+            while (!start.load()) {
+                std::this_thread::yield();
+            }
+            std::mt19937 random {thread};
+            std::uniform_int_distribution<int> indices {0, entry_count - 1};
+            for (uint32_t request = 0; request < REQUEST_COUNT; ++request) {
+                const int index = indices(random);
+                const Expected& entry = expected.at(store.GetAudioFileNameByIndex(index));
+                // the analysis runs first for some threads and after the decode for others
+                const uint32_t leading_zero_count = request % 2 == 0 ? store.GetLeadingZeroCount(index) : 0u;
+                const auto impulse_response = store.GetImpulseResponse(index);
+                const uint32_t sparse_tap_count = store.GetSparseTapCount(index);
+                const SpectrumCache::ContentKey content_key = store.GetContentKey(index);
+                if ((request % 2 == 0 && leading_zero_count != entry.leading_zero_count) || store.GetLeadingZeroCount(index) != entry.leading_zero_count ||
+                    sparse_tap_count != entry.sparse_tap_count || ImpulseResponseStore::FindLeadingZeroCount(*impulse_response) != entry.leading_zero_count ||
+                    !IsSameKey(content_key, ImpulseResponseStore::HashSamples(*impulse_response))) {
+                    ++wrong_results;
+                }
+            }
+        });
+    }
+    start.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(wrong_results.load(), 0u);
+
+    // the unreadable file is served as silence and not read again, even once it became readable
+    int broken = 0;
+    while (store.GetAudioFileNameByIndex(broken) != "broken.wav") {
+        ++broken;
+    }
+    WriteFloatWavFile(directory / "broken.wav", {taps});
+    const auto silence = store.GetImpulseResponse(broken);
+    EXPECT_EQ(silence->channel_count, 1u);
+    ASSERT_EQ(silence->samples.size(), 1u);
+    EXPECT_EQ(silence->samples[0], 0.f);
+    EXPECT_FALSE(store.IsFileLoaded(broken));
+    EXPECT_EQ(store.GetSparseTapCount(broken), 0u);
+
+    std::filesystem::remove_all(directory);
+}
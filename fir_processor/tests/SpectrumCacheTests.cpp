@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "../src/PartitionPlan.h"
+#include "../src/SpectrumBuilder.h"
+#include "../src/SpectrumCache.h"
+#include "../src/device/SpectrumStorage.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace {
+std::vector<float> CreateNoise(size_t length, uint32_t seed) {
+    std::mt19937 generator {seed};
+    std::uniform_real_distribution<float> distribution {-1.f, 1.f};
+    std::vector<float> result(length);
+    std::generate(result.begin(), result.end(), [&] { return distribution(generator); });
+    return result;
+}
+} // namespace
+
+TEST(SpectrumCacheTest, StoreAndFind) {
+    const auto directory = std::filesystem::temp_directory_path() / "FirSpectrumCacheTest";
+    std::filesystem::remove_all(directory);
+    const SpectrumCache cache {directory};
+
+    const auto filter = CreateNoise(3u * 64u + 5u, 43u);
+    const auto plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filter.size()), 64u, 64u);
+    SpectrumBuilder builder {plan, SPECTRUM_FLOAT32};
+    const size_t spectrum_size = builder.GetSpectrumSize();
+    std::vector<uint8_t> spectra(2u * spectrum_size);
+    builder.Build(filter.data(), static_cast<uint32_t>(filter.size()), spectra.data());
+    builder.Build(filter.data() + 64u, static_cast<uint32_t>(filter.size()) - 64u, spectra.data() + spectrum_size);
+
+    SpectrumCache::ContentKey key;
+    key.Append(filter.data(), filter.size() * sizeof(float));
+    key.filter_length = static_cast<uint32_t>(filter.size());
+    key.channel_count = 2u;
+    EXPECT_EQ(cache.Find(key, plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    ASSERT_TRUE(cache.Store(key, plan, SPECTRUM_FLOAT32, spectrum_size, spectra.data()));
+
+    const auto entry = cache.Find(key, plan, SPECTRUM_FLOAT32, spectrum_size);
+    ASSERT_NE(entry.spectra, nullptr);
+    EXPECT_EQ(std::memcmp(entry.GetSpectrum(0u, spectrum_size), spectra.data(), spectrum_size), 0);
+    EXPECT_EQ(std::memcmp(entry.GetSpectrum(1u, spectrum_size), spectra.data() + spectrum_size, spectrum_size), 0);
+
+    // any part of the key that differs misses, also if only the content hash collides
+    const auto modified = [&key](const std::function<void(SpectrumCache::ContentKey&)>& modify) {
+        SpectrumCache::ContentKey other = key;
+        modify(other);
+        return other;
+    };
+    EXPECT_EQ(cache.Find(modified([](SpectrumCache::ContentKey& other) { ++other.hash; }), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_EQ(cache.Find(modified([](SpectrumCache::ContentKey& other) { ++other.check_hash; }), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_EQ(cache.Find(modified([](SpectrumCache::ContentKey& other) { --other.filter_length; }), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_EQ(cache.Find(modified([](SpectrumCache::ContentKey& other) { other.channel_count = 1u; }), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_EQ(cache.Find(key, plan, SPECTRUM_FLOAT16, spectrum_size).spectra, nullptr);
+    const auto other_plan = CreateUniformPartitionPlan(static_cast<uint32_t>(filter.size()), 128u, 128u);
+    EXPECT_EQ(cache.Find(key, other_plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST(SpectrumCacheTest, EvictsLeastRecentlyUsedBeyondBudget) {
+    const auto directory = std::filesystem::temp_directory_path() / "FirSpectrumCacheBudgetTest";
+    std::filesystem::remove_all(directory);
+
+    const auto plan = CreateUniformPartitionPlan(256u, 64u, 64u);
+    const size_t spectrum_size = SpectrumBuilder {plan, SPECTRUM_FLOAT32}.GetSpectrumSize();
+    const std::vector<uint8_t> spectra(spectrum_size, 1u);
+    const auto key = [](uint64_t hash) { return SpectrumCache::ContentKey {hash, hash, 256u, 1u}; };
+    SpectrumCache cache {directory};
+    ASSERT_TRUE(cache.Store(key(1u), plan, SPECTRUM_FLOAT32, spectrum_size, spectra.data()));
+    const auto file_size = std::filesystem::file_size(std::filesystem::directory_iterator(directory)->path());
+
+    // room for two files
+    cache.SetBudget(2u * file_size + file_size / 2u);
+    ASSERT_TRUE(cache.Store(key(2u), plan, SPECTRUM_FLOAT32, spectrum_size, spectra.data()));
+    // the hit makes the first file the most recently used one, so the second is evicted
+    EXPECT_NE(cache.Find(key(1u), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    ASSERT_TRUE(cache.Store(key(3u), plan, SPECTRUM_FLOAT32, spectrum_size, spectra.data()));
+    EXPECT_NE(cache.Find(key(1u), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_EQ(cache.Find(key(2u), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_NE(cache.Find(key(3u), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+
+    // files larger than the budget are not written, a budget of 0 turns the cache off
+    cache.SetBudget(file_size - 1u);
+    EXPECT_FALSE(cache.Store(key(4u), plan, SPECTRUM_FLOAT32, spectrum_size, spectra.data()));
+    cache.SetBudget(0u);
+    EXPECT_EQ(cache.Find(key(1u), plan, SPECTRUM_FLOAT32, spectrum_size).spectra, nullptr);
+    EXPECT_FALSE(cache.Store(key(5u), plan, SPECTRUM_FLOAT32, spectrum_size, spectra.data()));
+
+    std::filesystem::remove_all(directory);
+}
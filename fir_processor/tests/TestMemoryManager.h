@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef TEST_MEMORY_MANAGER_H
+#define TEST_MEMORY_MANAGER_H
+
+#include <processor_api/MemoryManager.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// stands in for the memory manager of the engine: the device memory lives on the host, allocations, uploads and the
+// buffers alive are counted
+class CountingMemoryManager : public GPUA::processor::v2::MemoryManager {
+public:
+    class HostGpuMemory : public GPUA::processor::v2::GpuMemory {
+    public:
+        HostGpuMemory(CountingMemoryManager& manager, size_t size) :
+            m_manager {manager},
+            m_bytes(size) {
+            ++m_manager.m_live_count;
+        }
+        ~HostGpuMemory() { --m_manager.m_live_count; }
+
+        GPUA::processor::v2::GpuPointer GetGpuPointer() const noexcept override {
+            return reinterpret_cast<GPUA::processor::v2::GpuPointer>(m_bytes.data());
+        }
+
+        CountingMemoryManager& m_manager;
+        std::vector<uint8_t> m_bytes;
+    };
+
+    GPUA::processor::v2::GpuMemoryPointer AllocateGpuMemory(size_t size) override {
+        if (m_fail_allocations) {
+            throw std::bad_alloc();
+        }
+        ++m_allocation_count;
+        if (std::this_thread::get_id() == m_engine_thread) {
+            ++m_engine_allocation_count;
+        }
+        return {new HostGpuMemory(*this, size), [](GPUA::processor::v2::GpuMemory* memory) { delete static_cast<HostGpuMemory*>(memory); }};
+    }
+
+    GPUA::processor::v2::ErrorCode MemCpyCpuToGpu(GPUA::processor::v2::GpuMemory& memory, size_t offset, const void* data, size_t size) noexcept override {
+        ++m_upload_count;
+        m_uploaded_bytes += size;
+        std::memcpy(static_cast<HostGpuMemory&>(memory).m_bytes.data() + offset, data, size);
+        return GPUA::processor::v2::ErrorCode::eSuccess;
+    }
+
+    GPUA::processor::v2::ErrorCode MemCpyGpuToCpu(void* data, GPUA::processor::v2::GpuMemory& memory, size_t offset, size_t size) noexcept override {
+        std::memcpy(data, static_cast<HostGpuMemory&>(memory).m_bytes.data() + offset, size);
+        return GPUA::processor::v2::ErrorCode::eSuccess;
+    }
+
+    // size of a buffer allocated by AllocateGpuMemory
+    static size_t GetSize(const GPUA::processor::v2::GpuMemory& memory) {
+        return static_cast<const HostGpuMemory&>(memory).m_bytes.size();
+    }
+
+    // the thread that creates the memory manager stands in for the engine thread
+    const std::thread::id m_engine_thread {std::this_thread::get_id()};
+    std::atomic<uint32_t> m_allocation_count {0u};
+    std::atomic<uint32_t> m_engine_allocation_count {0u};
+    std::atomic<uint32_t> m_live_count {0u};
+    std::atomic<uint32_t> m_upload_count {0u};
+    std::atomic<uint64_t> m_uploaded_bytes {0u};
+    // makes AllocateGpuMemory throw
+    std::atomic<bool> m_fail_allocations {false};
+};
+
+} // namespace
+
+#endif // TEST_MEMORY_MANAGER_H
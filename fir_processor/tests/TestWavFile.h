@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef TEST_WAV_FILE_H
+#define TEST_WAV_FILE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// writes a canonical WAV file with `header_padding` bytes of an extra chunk in front of the data chunk
+void WriteWavFile(const std::filesystem::path& path, uint16_t format_tag, uint16_t channel_count, uint16_t bit_depth, const std::vector<uint8_t>& samples,
+    uint32_t header_padding = 0u) {
+    const uint16_t block_align = channel_count * (bit_depth / 8);
+    const uint32_t sample_rate = 48000u;
+    const uint32_t byte_rate = sample_rate * block_align;
+    const uint32_t format_size = 16u;
+    const auto data_size = static_cast<uint32_t>(samples.size());
+    const uint32_t riff_size = 4u + 8u + format_size + (header_padding != 0 ? 8u + header_padding : 0u) + 8u + data_size;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    const auto write = [&file](const void* data, size_t size) { file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size)); };
+    write("RIFF", 4);
+    write(&riff_size, 4);
+    write("WAVEfmt ", 8);
+    write(&format_size, 4);
+    write(&format_tag, 2);
+    write(&channel_count, 2);
+    write(&sample_rate, 4);
+    write(&byte_rate, 4);
+    write(&block_align, 2);
+    write(&bit_depth, 2);
+    if (header_padding != 0) {
+        const std::vector<uint8_t> padding(header_padding, 0u);
+        write("LIST", 4);
+        write(&header_padding, 4);
+        write(padding.data(), padding.size());
+    }
+    write("data", 4);
+    write(&data_size, 4);
+    write(samples.data(), samples.size());
+}
+
+} // namespace
+
+#endif // TEST_WAV_FILE_H
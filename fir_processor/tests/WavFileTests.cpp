@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2024 Braingines SA - All Rights Reserved
+ * Unauthorized copying of this file is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include "TestWavFile.h"
+
+#include "../src/WavFile.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+TEST(WavFileTest, ReadsFloatInPlaceAndConvertsPcm) {
+    const auto directory = std::filesystem::temp_directory_path() / "FirWavFileTest";
+    std::filesystem::create_directories(directory);
+
+    // stereo float32: both channels are views into the mapping
+    const std::vector<float> interleaved {0.5f, -0.25f, 0.125f, 1.f, -1.f, 0.f};
+    std::vector<uint8_t> bytes(interleaved.size() * sizeof(float));
+    std::memcpy(bytes.data(), interleaved.data(), bytes.size());
+    WriteWavFile(directory / "float.wav", 3u, 2u, 32u, bytes);
+    {
+        const WavFile file {directory / "float.wav"};
+        ASSERT_TRUE(file.IsValid());
+        EXPECT_EQ(file.GetFormat(), WavSampleFormat::Float32);
+        EXPECT_EQ(file.GetChannelCount(), 2u);
+        EXPECT_EQ(file.GetSampleRate(), 48000u);
+        ASSERT_EQ(file.GetFrameCount(), 3u);
+        const auto right = file.GetChannelSpan(1u);
+        ASSERT_FALSE(right.empty());
+        EXPECT_EQ(right.length, 3u);
+        EXPECT_EQ(right[0], -0.25f);
+        EXPECT_EQ(right[1], 1.f);
+        EXPECT_EQ(right[2], 0.f);
+    }
+
+    // a data chunk at an odd offset can only be read through ReadChannel
+    WriteWavFile(directory / "unaligned.wav", 3u, 2u, 32u, bytes, 2u);
+    {
+        const WavFile file {directory / "unaligned.wav"};
+        ASSERT_TRUE(file.IsValid());
+        EXPECT_TRUE(file.GetChannelSpan(0u).empty());
+        std::vector<float> left(3u);
+        ASSERT_EQ(file.ReadChannel(0u, left.data(), 0u, 8u), 3u);
+        EXPECT_EQ(left, (std::vector<float> {0.5f, 0.125f, -1.f}));
+    }
+
+    // 16 and 24 bit PCM are converted to [-1, 1)
+    const std::vector<int16_t> pcm16 {16384, -32768, 32767};
+    bytes.resize(pcm16.size() * sizeof(int16_t));
+    std::memcpy(bytes.data(), pcm16.data(), bytes.size());
+    WriteWavFile(directory / "pcm16.wav", 1u, 1u, 16u, bytes);
+    {
+        const WavFile file {directory / "pcm16.wav"};
+        ASSERT_TRUE(file.IsValid());
+        EXPECT_TRUE(file.GetChannelSpan(0u).empty());
+        std::vector<float> samples(3u);
+        ASSERT_EQ(file.ReadChannel(0u, samples.data(), 0u, 3u), 3u);
+        EXPECT_EQ(samples[0], 0.5f);
+        EXPECT_EQ(samples[1], -1.f);
+        EXPECT_NEAR(samples[2], 1.f, 1e-4f);
+    }
+    bytes = {0x00, 0x00, 0x40, 0x00, 0x00, 0x80, 0xFF, 0xFF, 0xFF};
+    WriteWavFile(directory / "pcm24.wav", 1u, 1u, 24u, bytes);
+    {
+        const WavFile file {directory / "pcm24.wav"};
+        ASSERT_TRUE(file.IsValid());
+        std::vector<float> samples(2u);
+        ASSERT_EQ(file.ReadChannel(0u, samples.data(), 1u, 2u), 2u);
+        EXPECT_EQ(samples[0], -1.f);
+        EXPECT_EQ(samples[1], -1.f / 8388608.f);
+    }
+
+    // 64 bit float is left to AudioFile
+    WriteWavFile(directory / "double.wav", 3u, 1u, 64u, std::vector<uint8_t>(16u, 0u));
+    EXPECT_FALSE(WavFile {directory / "double.wav"}.IsValid());
+    EXPECT_FALSE(WavFile {directory / "missing.wav"}.IsValid());
+
+    std::filesystem::remove_all(directory);
+}